@@ -33,6 +33,60 @@
 #include "adlist.h"
 #include "zmalloc.h"
 
+/* Every list allocates its nodes from slabs of its own, that are arrays of
+ * nodes without any allocator overhead for every node. The first slab
+ * holds LIST_SLAB_MIN nodes and every new slab doubles the previous one,
+ * up to LIST_SLAB_MAX. Deleted nodes are reused by the next insertions,
+ * and the slabs are freed all together when the list gets empty or is
+ * released: a client reply list, that is filled and emptied for every
+ * command, costs a single allocation instead of one for every node. */
+#define LIST_SLAB_MIN 4
+#define LIST_SLAB_MAX 1024
+
+typedef struct listNodeSlab {
+    struct listNodeSlab *next;
+    unsigned long size;     /* number of nodes in the slab */
+    unsigned long used;     /* nodes handed out, the others were never used */
+    listNode nodes[];
+} listNodeSlab;
+
+static listNode *listAllocNode(list *list)
+{
+    listNodeSlab *slab = list->slabs;
+    listNode *node;
+
+    if ((node = list->freenodes) != NULL) {
+        list->freenodes = node->next;
+        return node;
+    }
+    if (slab == NULL || slab->used == slab->size) {
+        unsigned long size = slab ? slab->size*2 : LIST_SLAB_MIN;
+
+        if (size > LIST_SLAB_MAX) size = LIST_SLAB_MAX;
+        if ((slab = zmalloc(sizeof(*slab)+sizeof(listNode)*size)) == NULL)
+            return NULL;
+        slab->next = list->slabs;
+        slab->size = size;
+        slab->used = 0;
+        list->slabs = slab;
+    }
+    return slab->nodes+(slab->used++);
+}
+
+/* Free all the slabs, no node can be still linked in the list */
+static void listReleaseSlabs(list *list)
+{
+    listNodeSlab *slab = list->slabs, *next;
+
+    while(slab) {
+        next = slab->next;
+        zfree(slab);
+        slab = next;
+    }
+    list->slabs = NULL;
+    list->freenodes = NULL;
+}
+
 /* Create a new list. The created list can be freed with
  * AlFreeList(), but private value of every node need to be freed
  * by the user before to call AlFreeList().
@@ -49,25 +103,24 @@ list *listCreate(void)
     list->dup = NULL;
     list->free = NULL;
     list->match = NULL;
+    list->slabs = NULL;
+    list->freenodes = NULL;
     return list;
 }
 
-/* Free the whole list.
+/* Free the whole list. The nodes are freed with their slabs, so they are
+ * only visited to free their values.
  *
  * This function can't fail. */
 void listRelease(list *list)
 {
-    unsigned int len;
-    listNode *current, *next;
+    listNode *current;
 
-    current = list->head;
-    len = list->len;
-    while(len--) {
-        next = current->next;
-        if (list->free) list->free(current->value);
-        zfree(current);
-        current = next;
+    if (list->free) {
+        for (current = list->head; current; current = current->next)
+            list->free(current->value);
     }
+    listReleaseSlabs(list);
     zfree(list);
 }
 
@@ -81,7 +134,7 @@ list *listAddNodeHead(list *list, void *value)
 {
     listNode *node;
 
-    if ((node = zmalloc(sizeof(*node))) == NULL)
+    if ((node = listAllocNode(list)) == NULL)
         return NULL;
     node->value = value;
     if (list->len == 0) {
@@ -107,7 +160,7 @@ list *listAddNodeTail(list *list, void *value)
 {
     listNode *node;
 
-    if ((node = zmalloc(sizeof(*node))) == NULL)
+    if ((node = listAllocNode(list)) == NULL)
         return NULL;
     node->value = value;
     if (list->len == 0) {
@@ -138,8 +191,9 @@ void listDelNode(list *list, listNode *node)
     else
         list->tail = node->prev;
     if (list->free) list->free(node->value);
-    zfree(node);
-    list->len--;
+    node->next = list->freenodes;
+    list->freenodes = node;
+    if (--list->len == 0) listReleaseSlabs(list);
 }
 
 /* Returns a list iterator 'iter'. After the initialization every
@@ -51,6 +51,8 @@ typedef struct list {
     void (*free)(void *ptr);
     int (*match)(void *ptr, void *key);
     unsigned int len;
+    struct listNodeSlab *slabs; /* nodes are allocated from here */
+    listNode *freenodes; /* deleted nodes, linked by their next field */
 } list;
 
 /* Functions implemented as macros */
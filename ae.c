@@ -52,32 +52,110 @@
     #endif
 #endif
 
-aeEventLoop *aeCreateEventLoop(void) {
+static void aeTimerHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te);
+static void aeFreeTimeEvent(aeEventLoop *eventLoop, aeTimeEvent *te);
+
+/* Create a new event loop able to track file descriptors up to setsize-1.
+ * The table is grown on demand by aeCreateFileEvent() if a bigger file
+ * descriptor is registered, so setsize is just a hint that avoids
+ * reallocations, usually the max number of clients plus a few more fds. */
+aeEventLoop *aeCreateEventLoop(int setsize) {
     aeEventLoop *eventLoop;
     int i;
 
+    if (setsize < AE_SETSIZE_MIN) setsize = AE_SETSIZE_MIN;
     eventLoop = zmalloc(sizeof(*eventLoop));
     if (!eventLoop) return NULL;
-    eventLoop->timeEventHead = NULL;
+    eventLoop->setsize = setsize;
+    eventLoop->events = zmalloc(sizeof(aeFileEvent)*setsize);
+    eventLoop->fired = zmalloc(sizeof(aeFiredEvent)*setsize);
     eventLoop->timeEventNextId = 0;
+    eventLoop->timers = NULL;
+    eventLoop->timerslen = eventLoop->timerssize = 0;
+    eventLoop->slots = NULL;
+    eventLoop->freeslots = NULL;
+    eventLoop->slotssize = eventLoop->freeslotslen = 0;
+    eventLoop->firing = NULL;
+    eventLoop->firingsize = 0;
     eventLoop->stop = 0;
     eventLoop->maxfd = -1;
+    eventLoop->edgetriggered = 0;
+    eventLoop->beforesleep = NULL;
     if (aeApiCreate(eventLoop) == -1) {
+        zfree(eventLoop->events);
+        zfree(eventLoop->fired);
         zfree(eventLoop);
         return NULL;
     }
     /* Events with mask == AE_NONE are not set. So let's initialize the
      * vector with it. */
-    for (i = 0; i < AE_SETSIZE; i++)
+    for (i = 0; i < setsize; i++)
         eventLoop->events[i].mask = AE_NONE;
     return eventLoop;
 }
 
+int aeGetSetSize(aeEventLoop *eventLoop) {
+    return eventLoop->setsize;
+}
+
+/* Grow the file events table so that fds up to setsize-1 can be tracked.
+ * Shrinking is not supported: if setsize is not bigger than the current
+ * size nothing is done. Returns AE_ERR if the polling API is not able to
+ * handle the new size (select() is limited to FD_SETSIZE). */
+int aeResizeSetSize(aeEventLoop *eventLoop, int setsize) {
+    int i;
+
+    if (setsize <= eventLoop->setsize) return AE_OK;
+    if (aeApiResize(eventLoop,setsize) == -1) return AE_ERR;
+    eventLoop->events = zrealloc(eventLoop->events,sizeof(aeFileEvent)*setsize);
+    eventLoop->fired = zrealloc(eventLoop->fired,sizeof(aeFiredEvent)*setsize);
+    for (i = eventLoop->setsize; i < setsize; i++)
+        eventLoop->events[i].mask = AE_NONE;
+    eventLoop->setsize = setsize;
+    return AE_OK;
+}
+
 void aeDeleteEventLoop(aeEventLoop *eventLoop) {
+    while (eventLoop->timerslen) {
+        aeTimeEvent *te = eventLoop->timers[0];
+
+        aeTimerHeapRemove(eventLoop,te);
+        aeFreeTimeEvent(eventLoop,te);
+    }
+    zfree(eventLoop->timers);
+    zfree(eventLoop->slots);
+    zfree(eventLoop->freeslots);
+    zfree(eventLoop->firing);
     aeApiFree(eventLoop);
+    zfree(eventLoop->events);
+    zfree(eventLoop->fired);
     zfree(eventLoop);
 }
 
+/* Switch the event loop to edge triggered notifications, if the polling
+ * API supports it. This must be called before any file event is registered.
+ *
+ * In edge triggered mode a file event is reported only when the fd changes
+ * state, so handlers must read/write until EAGAIN. A handler that stops
+ * before (for instance because it consumed its per-event budget) must call
+ * aeRearmFileEvent() or it will not be called again for the same fd.
+ *
+ * Returns AE_ERR if edge triggered mode is not supported. */
+int aeSetEdgeTriggered(aeEventLoop *eventLoop, int enable) {
+    if (eventLoop->maxfd != -1) return AE_ERR;
+    if (enable && aeApiSetEdgeTriggered(eventLoop) == -1) return AE_ERR;
+    eventLoop->edgetriggered = enable;
+    return AE_OK;
+}
+
+/* Ask the polling API to report the fd again if it is still readable or
+ * writable. This is a no-op in level triggered mode. */
+void aeRearmFileEvent(aeEventLoop *eventLoop, int fd) {
+    if (!eventLoop->edgetriggered || fd >= eventLoop->setsize ||
+        eventLoop->events[fd].mask == AE_NONE) return;
+    aeApiRearm(eventLoop, fd);
+}
+
 void aeStop(aeEventLoop *eventLoop) {
     eventLoop->stop = 1;
 }
@@ -85,10 +163,19 @@ void aeStop(aeEventLoop *eventLoop) {
 int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
         aeFileProc *proc, void *clientData)
 {
-    if (fd >= AE_SETSIZE) return AE_ERR;
-    aeFileEvent *fe = &eventLoop->events[fd];
+    aeFileEvent *fe;
+
+    if (fd >= eventLoop->setsize) {
+        int setsize = eventLoop->setsize*2;
 
-    if (aeApiAddEvent(eventLoop, fd, mask) == -1)
+        if (setsize <= fd) setsize = fd+1;
+        if (aeResizeSetSize(eventLoop,setsize) == AE_ERR) return AE_ERR;
+    }
+    fe = &eventLoop->events[fd];
+
+    /* No need to ask the kernel for something we are already polling. */
+    if ((fe->mask & mask) != mask &&
+        aeApiAddEvent(eventLoop, fd, mask) == -1)
         return AE_ERR;
     fe->mask |= mask;
     if (mask & AE_READABLE) fe->rfileProc = proc;
@@ -101,10 +188,10 @@ int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
 
 void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask)
 {
-    if (fd >= AE_SETSIZE) return;
+    if (fd >= eventLoop->setsize) return;
     aeFileEvent *fe = &eventLoop->events[fd];
 
-    if (fe->mask == AE_NONE) return;
+    if ((fe->mask & mask) == AE_NONE) return;
     fe->mask = fe->mask & (~mask);
     if (fd == eventLoop->maxfd && fe->mask == AE_NONE) {
         /* Update the max fd */
@@ -140,45 +227,172 @@ static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms)
     *ms = when_ms;
 }
 
+/* ============================= Timers heap ================================ */
+
+/* Return non zero if the time event 'a' should fire before 'b'. Events
+ * expiring at the same time are sorted by ID, that is, in creation order. */
+static int aeTimerBefore(aeTimeEvent *a, aeTimeEvent *b) {
+    if (a->when_sec != b->when_sec) return a->when_sec < b->when_sec;
+    if (a->when_ms != b->when_ms) return a->when_ms < b->when_ms;
+    return a->id < b->id;
+}
+
+static void aeTimerHeapSet(aeEventLoop *eventLoop, int idx, aeTimeEvent *te) {
+    eventLoop->timers[idx] = te;
+    te->heapidx = idx;
+}
+
+static void aeTimerHeapUp(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent *te = eventLoop->timers[idx];
+
+    while (idx > 0) {
+        int parent = (idx-1)/2;
+
+        if (!aeTimerBefore(te,eventLoop->timers[parent])) break;
+        aeTimerHeapSet(eventLoop,idx,eventLoop->timers[parent]);
+        idx = parent;
+    }
+    aeTimerHeapSet(eventLoop,idx,te);
+}
+
+static void aeTimerHeapDown(aeEventLoop *eventLoop, int idx) {
+    aeTimeEvent *te = eventLoop->timers[idx];
+
+    while (1) {
+        int child = idx*2+1;
+
+        if (child >= eventLoop->timerslen) break;
+        if (child+1 < eventLoop->timerslen &&
+            aeTimerBefore(eventLoop->timers[child+1],eventLoop->timers[child]))
+            child++;
+        if (!aeTimerBefore(eventLoop->timers[child],te)) break;
+        aeTimerHeapSet(eventLoop,idx,eventLoop->timers[child]);
+        idx = child;
+    }
+    aeTimerHeapSet(eventLoop,idx,te);
+}
+
+static int aeTimerHeapInsert(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    if (eventLoop->timerslen == eventLoop->timerssize) {
+        int newsize = eventLoop->timerssize ? eventLoop->timerssize*2 : 16;
+        aeTimeEvent **timers;
+
+        timers = zrealloc(eventLoop->timers,sizeof(aeTimeEvent*)*newsize);
+        if (timers == NULL) return AE_ERR;
+        eventLoop->timers = timers;
+        eventLoop->timerssize = newsize;
+    }
+    eventLoop->timers[eventLoop->timerslen++] = te;
+    aeTimerHeapUp(eventLoop,eventLoop->timerslen-1);
+    return AE_OK;
+}
+
+static void aeTimerHeapRemove(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int idx = te->heapidx;
+    aeTimeEvent *last = eventLoop->timers[--eventLoop->timerslen];
+
+    te->heapidx = -1;
+    if (last == te) return;
+    /* Move the last element in the hole and restore the heap property,
+     * the moved element may need to go either up or down. */
+    aeTimerHeapSet(eventLoop,idx,last);
+    aeTimerHeapUp(eventLoop,idx);
+    aeTimerHeapDown(eventLoop,last->heapidx);
+}
+
+/* Reserve a slot in the ID lookup table. Returns -1 on out of memory. */
+static int aeTimerGetSlot(aeEventLoop *eventLoop) {
+    if (eventLoop->freeslotslen == 0) {
+        int newsize = eventLoop->slotssize ? eventLoop->slotssize*2 : 16;
+        aeTimeEvent **slots;
+        int *freeslots, j;
+
+        slots = zrealloc(eventLoop->slots,sizeof(aeTimeEvent*)*newsize);
+        if (slots == NULL) return -1;
+        eventLoop->slots = slots;
+        freeslots = zrealloc(eventLoop->freeslots,sizeof(int)*newsize);
+        if (freeslots == NULL) return -1;
+        eventLoop->freeslots = freeslots;
+        /* Push the new slots in reverse order so that lower slots are
+         * used first. */
+        for (j = newsize-1; j >= eventLoop->slotssize; j--) {
+            eventLoop->slots[j] = NULL;
+            eventLoop->freeslots[eventLoop->freeslotslen++] = j;
+        }
+        eventLoop->slotssize = newsize;
+    }
+    return eventLoop->freeslots[--eventLoop->freeslotslen];
+}
+
+static aeTimeEvent *aeTimerLookup(aeEventLoop *eventLoop, long long id) {
+    long long slot = id & 0xffffffffLL;
+    aeTimeEvent *te;
+
+    if (id < 0 || slot >= eventLoop->slotssize) return NULL;
+    te = eventLoop->slots[slot];
+    return (te && te->id == id) ? te : NULL;
+}
+
+/* Release the slot and the memory used by a time event that is no longer
+ * in the heap, calling the finalizer if any. */
+static void aeFreeTimeEvent(aeEventLoop *eventLoop, aeTimeEvent *te) {
+    int slot = (int)(te->id & 0xffffffffLL);
+
+    eventLoop->slots[slot] = NULL;
+    eventLoop->freeslots[eventLoop->freeslotslen++] = slot;
+    if (te->finalizerProc)
+        te->finalizerProc(eventLoop, te->clientData);
+    zfree(te);
+}
+
+/* ============================= Time events ================================ */
+
+/* Time event IDs are composed of a sequence number in the high 32 bits,
+ * so that IDs are never reused and grow with the creation time, and of
+ * the index of the slot used by the event in the low 32 bits. */
 long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
         aeTimeProc *proc, void *clientData,
         aeEventFinalizerProc *finalizerProc)
 {
-    long long id = eventLoop->timeEventNextId++;
     aeTimeEvent *te;
+    int slot;
 
     te = zmalloc(sizeof(*te));
     if (te == NULL) return AE_ERR;
-    te->id = id;
+    if ((slot = aeTimerGetSlot(eventLoop)) == -1) {
+        zfree(te);
+        return AE_ERR;
+    }
+    te->id = (eventLoop->timeEventNextId++ << 32) | slot;
     aeAddMillisecondsToNow(milliseconds,&te->when_sec,&te->when_ms);
     te->timeProc = proc;
     te->finalizerProc = finalizerProc;
     te->clientData = clientData;
-    te->next = eventLoop->timeEventHead;
-    eventLoop->timeEventHead = te;
-    return id;
+    te->deleted = 0;
+    if (aeTimerHeapInsert(eventLoop,te) == AE_ERR) {
+        eventLoop->freeslots[eventLoop->freeslotslen++] = slot;
+        zfree(te);
+        return AE_ERR;
+    }
+    eventLoop->slots[slot] = te;
+    return te->id;
 }
 
 int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
 {
-    aeTimeEvent *te, *prev = NULL;
-
-    te = eventLoop->timeEventHead;
-    while(te) {
-        if (te->id == id) {
-            if (prev == NULL)
-                eventLoop->timeEventHead = te->next;
-            else
-                prev->next = te->next;
-            if (te->finalizerProc)
-                te->finalizerProc(eventLoop, te->clientData);
-            zfree(te);
-            return AE_OK;
-        }
-        prev = te;
-        te = te->next;
+    aeTimeEvent *te = aeTimerLookup(eventLoop,id);
+
+    if (te == NULL || te->deleted)
+        return AE_ERR; /* NO event with the specified ID found */
+    if (te->heapidx == -1) {
+        /* The event is being processed by processTimeEvents(), that will
+         * take care of releasing it. */
+        te->deleted = 1;
+        return AE_OK;
     }
-    return AE_ERR; /* NO event with the specified ID found */
+    aeTimerHeapRemove(eventLoop,te);
+    aeFreeTimeEvent(eventLoop,te);
+    return AE_OK;
 }
 
 /* Search the first timer to fire.
@@ -186,74 +400,52 @@ int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id)
  * put in sleep without to delay any event.
  * If there are no timers NULL is returned.
  *
- * Note that's O(N) since time events are unsorted.
- * Possible optimizations (not needed by Redis so far, but...):
- * 1) Insert the event in order, so that the nearest is just the head.
- *    Much better but still insertion or deletion of timers is O(N).
- * 2) Use a skiplist to have this operation as O(1) and insertion as O(log(N)).
- */
+ * Time events are taken into a min-heap so this is O(1). */
 static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop)
 {
-    aeTimeEvent *te = eventLoop->timeEventHead;
-    aeTimeEvent *nearest = NULL;
-
-    while(te) {
-        if (!nearest || te->when_sec < nearest->when_sec ||
-                (te->when_sec == nearest->when_sec &&
-                 te->when_ms < nearest->when_ms))
-            nearest = te;
-        te = te->next;
-    }
-    return nearest;
+    return eventLoop->timerslen ? eventLoop->timers[0] : NULL;
 }
 
 /* Process time events */
 static int processTimeEvents(aeEventLoop *eventLoop) {
-    int processed = 0;
-    aeTimeEvent *te;
-    long long maxId;
+    int processed = 0, numfiring = 0, j;
+    long now_sec, now_ms;
+
+    /* Detach from the heap every timer already expired before calling any
+     * handler. This way we make sure to don't process events registered
+     * or rescheduled by event handlers itself in order to don't loop
+     * forever. */
+    aeGetTime(&now_sec, &now_ms);
+    while (eventLoop->timerslen) {
+        aeTimeEvent *te = eventLoop->timers[0];
+
+        if (now_sec < te->when_sec ||
+            (now_sec == te->when_sec && now_ms < te->when_ms)) break;
+        if (numfiring == eventLoop->firingsize) {
+            int newsize = eventLoop->firingsize ? eventLoop->firingsize*2 : 16;
+
+            eventLoop->firing = zrealloc(eventLoop->firing,
+                sizeof(aeTimeEvent*)*newsize);
+            eventLoop->firingsize = newsize;
+        }
+        aeTimerHeapRemove(eventLoop,te);
+        eventLoop->firing[numfiring++] = te;
+    }
 
-    te = eventLoop->timeEventHead;
-    maxId = eventLoop->timeEventNextId-1;
-    while(te) {
-        long now_sec, now_ms;
-        long long id;
+    for (j = 0; j < numfiring; j++) {
+        aeTimeEvent *te = eventLoop->firing[j];
+        int retval;
 
-        if (te->id > maxId) {
-            te = te->next;
-            continue;
-        }
-        aeGetTime(&now_sec, &now_ms);
-        if (now_sec > te->when_sec ||
-            (now_sec == te->when_sec && now_ms >= te->when_ms))
-        {
-            int retval;
-
-            id = te->id;
-            retval = te->timeProc(eventLoop, id, te->clientData);
+        /* A previous handler may have deleted this event. */
+        if (!te->deleted) {
+            retval = te->timeProc(eventLoop, te->id, te->clientData);
             processed++;
-            /* After an event is processed our time event list may
-             * no longer be the same, so we restart from head.
-             * Still we make sure to don't process events registered
-             * by event handlers itself in order to don't loop forever.
-             * To do so we saved the max ID we want to handle.
-             *
-             * FUTURE OPTIMIZATIONS:
-             * Note that this is NOT great algorithmically. Redis uses
-             * a single time event so it's not a problem but the right
-             * way to do this is to add the new elements on head, and
-             * to flag deleted elements in a special way for later
-             * deletion (putting references to the nodes to delete into
-             * another linked list). */
-            if (retval != AE_NOMORE) {
+            if (retval != AE_NOMORE && !te->deleted) {
                 aeAddMillisecondsToNow(retval,&te->when_sec,&te->when_ms);
-            } else {
-                aeDeleteTimeEvent(eventLoop, id);
+                if (aeTimerHeapInsert(eventLoop,te) == AE_OK) continue;
             }
-            te = eventLoop->timeEventHead;
-        } else {
-            te = te->next;
         }
+        aeFreeTimeEvent(eventLoop,te);
     }
     return processed;
 }
@@ -373,10 +565,81 @@ int aeWait(int fd, int mask, long long milliseconds) {
 
 void aeMain(aeEventLoop *eventLoop) {
     eventLoop->stop = 0;
-    while (!eventLoop->stop)
+    while (!eventLoop->stop) {
+        if (eventLoop->beforesleep != NULL)
+            eventLoop->beforesleep(eventLoop);
         aeProcessEvents(eventLoop, AE_ALL_EVENTS);
+    }
+}
+
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep) {
+    eventLoop->beforesleep = beforesleep;
 }
 
 char *aeGetApiName(void) {
     return aeApiName();
 }
+
+#ifdef AE_BENCHMARK_MAIN
+/* Time events microbenchmark. Build it with 'make ae-benchmark'.
+ *
+ * A large number of timers far in the future is registered, like it happens
+ * with per-client timeouts, then we measure the cost of every event loop
+ * iteration (nearest timer lookup + time events processing), and the cost
+ * of creating and deleting timers. */
+#include <string.h>
+
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+static int benchTimeProc(aeEventLoop *eventLoop, long long id, void *clientData) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    (*(long long*)clientData)++;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    int numtimers = (argc > 1) ? atoi(argv[1]) : 100000;
+    int iterations = (argc > 2) ? atoi(argv[2]) : 100000;
+    aeEventLoop *el = aeCreateEventLoop(1024);
+    long long *ids = zmalloc(sizeof(long long)*numtimers);
+    long long start, elapsed, fired = 0;
+    int j;
+
+    srand(1234);
+    start = ustime();
+    for (j = 0; j < numtimers; j++)
+        ids[j] = aeCreateTimeEvent(el,60000+rand()%60000,benchTimeProc,
+                                   &fired,NULL);
+    elapsed = ustime()-start;
+    printf("create %d timers: %.3f usec per timer\n",
+        numtimers, (double)elapsed/numtimers);
+
+    /* A single timer firing at every iteration, as serverCron() does. */
+    aeCreateTimeEvent(el,0,benchTimeProc,&fired,NULL);
+    start = ustime();
+    for (j = 0; j < iterations; j++) {
+        aeSearchNearestTimer(el);
+        aeProcessEvents(el, AE_TIME_EVENTS|AE_DONT_WAIT);
+    }
+    elapsed = ustime()-start;
+    printf("%d loop iterations with %d timers: %.3f usec per iteration\n",
+        iterations, numtimers+1, (double)elapsed/iterations);
+
+    start = ustime();
+    for (j = 0; j < numtimers; j++)
+        aeDeleteTimeEvent(el,ids[j]);
+    elapsed = ustime()-start;
+    printf("delete %d timers: %.3f usec per timer\n",
+        numtimers, (double)elapsed/numtimers);
+
+    zfree(ids);
+    aeDeleteEventLoop(el);
+    return 0;
+}
+#endif
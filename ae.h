@@ -33,7 +33,7 @@
 #ifndef __AE_H__
 #define __AE_H__
 
-#define AE_SETSIZE (1024*10)    /* Max number of fd supported */
+#define AE_SETSIZE_MIN 64 /* Minimum size of the file events table */
 
 #define AE_OK 0
 #define AE_ERR -1
@@ -58,6 +58,7 @@ struct aeEventLoop;
 typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask);
 typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *clientData);
 typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
+typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
 
 /* File event structure */
 typedef struct aeFileEvent {
@@ -75,7 +76,8 @@ typedef struct aeTimeEvent {
     aeTimeProc *timeProc;
     aeEventFinalizerProc *finalizerProc;
     void *clientData;
-    struct aeTimeEvent *next;
+    int heapidx; /* index in the timers heap, -1 while the event is firing */
+    int deleted; /* deleted by a handler while firing, free it ASAP */
 } aeTimeEvent;
 
 /* A fired event */
@@ -87,16 +89,29 @@ typedef struct aeFiredEvent {
 /* State of an event based program */
 typedef struct aeEventLoop {
     int maxfd;
+    int edgetriggered; /* Fds are registered in edge triggered mode */
+    int setsize; /* Size of the events/fired tables, max fd tracked + 1 */
     long long timeEventNextId;
-    aeFileEvent events[AE_SETSIZE]; /* Registered events */
-    aeFiredEvent fired[AE_SETSIZE]; /* Fired events */
-    aeTimeEvent *timeEventHead;
+    aeFileEvent *events; /* Registered events, indexed by fd */
+    aeFiredEvent *fired; /* Fired events */
+    /* Time events are kept in a binary min-heap ordered by expire time, so
+     * the nearest timer is always timers[0]. Every event also owns a slot
+     * in the slots table, the low 32 bits of the event ID are the slot
+     * index, so that events can be removed by ID in O(log(N)). */
+    aeTimeEvent **timers;   /* Min-heap of pending time events */
+    int timerslen, timerssize;
+    aeTimeEvent **slots;    /* ID -> time event lookup table */
+    int *freeslots;         /* Stack of unused slots */
+    int slotssize, freeslotslen;
+    aeTimeEvent **firing;   /* Time events being processed right now */
+    int firingsize;
     int stop;
     void *apidata; /* This is used for polling API specific data */
+    aeBeforeSleepProc *beforesleep; /* Called by aeMain() before polling */
 } aeEventLoop;
 
 /* Prototypes */
-aeEventLoop *aeCreateEventLoop(void);
+aeEventLoop *aeCreateEventLoop(int setsize);
 void aeDeleteEventLoop(aeEventLoop *eventLoop);
 void aeStop(aeEventLoop *eventLoop);
 int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask,
@@ -110,5 +125,10 @@ int aeProcessEvents(aeEventLoop *eventLoop, int flags);
 int aeWait(int fd, int mask, long long milliseconds);
 void aeMain(aeEventLoop *eventLoop);
 char *aeGetApiName(void);
+int aeGetSetSize(aeEventLoop *eventLoop);
+int aeResizeSetSize(aeEventLoop *eventLoop, int setsize);
+int aeSetEdgeTriggered(aeEventLoop *eventLoop, int enable);
+void aeRearmFileEvent(aeEventLoop *eventLoop, int fd);
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
 
 #endif
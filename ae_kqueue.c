@@ -8,24 +8,37 @@
 
 typedef struct aeApiState {
     int kqfd;
-    struct kevent events[AE_SETSIZE];
+    struct kevent *events; /* eventLoop->setsize entries */
 } aeApiState;
 
 static int aeApiCreate(aeEventLoop *eventLoop) {
     aeApiState *state = zmalloc(sizeof(aeApiState));
 
     if (!state) return -1;
+    state->events = zmalloc(sizeof(struct kevent)*eventLoop->setsize);
     state->kqfd = kqueue();
-    if (state->kqfd == -1) return -1;
+    if (state->kqfd == -1) {
+        zfree(state->events);
+        zfree(state);
+        return -1;
+    }
     eventLoop->apidata = state;
     
     return 0;    
 }
 
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    aeApiState *state = eventLoop->apidata;
+
+    state->events = zrealloc(state->events,sizeof(struct kevent)*setsize);
+    return 0;
+}
+
 static void aeApiFree(aeEventLoop *eventLoop) {
     aeApiState *state = eventLoop->apidata;
 
     close(state->kqfd);
+    zfree(state->events);
     zfree(state);
 }
 
@@ -58,6 +71,17 @@ static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int mask) {
     }
 }
 
+/* Only level triggered notifications are supported. */
+static int aeApiSetEdgeTriggered(aeEventLoop *eventLoop) {
+    AE_NOTUSED(eventLoop);
+    return -1;
+}
+
+static void aeApiRearm(aeEventLoop *eventLoop, int fd) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(fd);
+}
+
 static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
     aeApiState *state = eventLoop->apidata;
     int retval, numevents = 0;
@@ -66,9 +90,9 @@ static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
         struct timespec timeout;
         timeout.tv_sec = tvp->tv_sec;
         timeout.tv_nsec = tvp->tv_usec * 1000;
-        retval = kevent(state->kqfd, NULL, 0, state->events, AE_SETSIZE, &timeout);
+        retval = kevent(state->kqfd, NULL, 0, state->events, eventLoop->setsize, &timeout);
     } else {
-        retval = kevent(state->kqfd, NULL, 0, state->events, AE_SETSIZE, NULL);
+        retval = kevent(state->kqfd, NULL, 0, state->events, eventLoop->setsize, NULL);
     }    
 
     if (retval > 0) {
@@ -21,6 +21,14 @@ static int aeApiCreate(aeEventLoop *eventLoop) {
     return 0;
 }
 
+/* select() can't handle fds >= FD_SETSIZE, so this is the max size of
+ * the file events table. */
+static int aeApiResize(aeEventLoop *eventLoop, int setsize) {
+    AE_NOTUSED(eventLoop);
+    if (setsize > FD_SETSIZE) return -1;
+    return 0;
+}
+
 static void aeApiFree(aeEventLoop *eventLoop) {
     zfree(eventLoop->apidata);
 }
@@ -28,6 +36,8 @@ static void aeApiFree(aeEventLoop *eventLoop) {
 static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask) {
     aeApiState *state = eventLoop->apidata;
 
+    if (fd >= FD_SETSIZE) return -1;
+
     if (mask & AE_READABLE) FD_SET(fd,&state->rfds);
     if (mask & AE_WRITABLE) FD_SET(fd,&state->wfds);
     return 0;
@@ -40,6 +50,17 @@ static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int mask) {
     if (mask & AE_WRITABLE) FD_CLR(fd,&state->wfds);
 }
 
+/* Only level triggered notifications are supported. */
+static int aeApiSetEdgeTriggered(aeEventLoop *eventLoop) {
+    AE_NOTUSED(eventLoop);
+    return -1;
+}
+
+static void aeApiRearm(aeEventLoop *eventLoop, int fd) {
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(fd);
+}
+
 static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp) {
     aeApiState *state = eventLoop->apidata;
     int retval, j, numevents = 0;
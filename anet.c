@@ -28,6 +28,9 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* accept4() */
+#endif
 #include "fmacros.h"
 
 #include <sys/types.h>
@@ -207,7 +210,7 @@ int anetWrite(int fd, char *buf, int count)
     return totlen;
 }
 
-int anetTcpServer(char *err, int port, char *bindaddr)
+static int anetTcpGenericServer(char *err, int port, char *bindaddr, int reuseport)
 {
     int s, on = 1;
     struct sockaddr_in sa;
@@ -221,6 +224,19 @@ int anetTcpServer(char *err, int port, char *bindaddr)
         close(s);
         return ANET_ERR;
     }
+    if (reuseport) {
+#ifdef SO_REUSEPORT
+        if (setsockopt(s, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+            anetSetError(err, "setsockopt SO_REUSEPORT: %s\n", strerror(errno));
+            close(s);
+            return ANET_ERR;
+        }
+#else
+        anetSetError(err, "SO_REUSEPORT not supported on this platform\n");
+        close(s);
+        return ANET_ERR;
+#endif
+    }
     memset(&sa,0,sizeof(sa));
     sa.sin_family = AF_INET;
     sa.sin_port = htons(port);
@@ -245,6 +261,19 @@ int anetTcpServer(char *err, int port, char *bindaddr)
     return s;
 }
 
+int anetTcpServer(char *err, int port, char *bindaddr)
+{
+    return anetTcpGenericServer(err, port, bindaddr, 0);
+}
+
+/* Like anetTcpServer() but sets SO_REUSEPORT, so that multiple processes
+ * can listen on the same address and port, with the kernel distributing
+ * the incoming connections among them. */
+int anetTcpServerReusePort(char *err, int port, char *bindaddr)
+{
+    return anetTcpGenericServer(err, port, bindaddr, 1);
+}
+
 int anetAccept(char *err, int serversock, char *ip, int *port)
 {
     int fd;
@@ -268,3 +297,44 @@ int anetAccept(char *err, int serversock, char *ip, int *port)
     if (port) *port = ntohs(sa.sin_port);
     return fd;
 }
+
+/* Accept up to 'max' connections from the non blocking socket 'serversock',
+ * stopping earlier when there are no more pending connections. The client
+ * sockets are returned already in non blocking mode, using accept4() where
+ * available to save a syscall per connection.
+ *
+ * Returns the number of accepted connections, or ANET_ERR if not even a
+ * single connection could be accepted because of an error. */
+int anetAcceptBatch(char *err, int serversock, anetAcceptedConn *conns, int max)
+{
+    int fd, count = 0;
+    struct sockaddr_in sa;
+    socklen_t saLen;
+
+    while (count < max) {
+        saLen = sizeof(sa);
+#if defined(__linux__) && defined(SOCK_NONBLOCK)
+        fd = accept4(serversock, (struct sockaddr*)&sa, &saLen, SOCK_NONBLOCK);
+#else
+        fd = accept(serversock, (struct sockaddr*)&sa, &saLen);
+        if (fd != -1 && anetNonBlock(NULL, fd) == ANET_ERR) {
+            close(fd);
+            continue;
+        }
+#endif
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            /* Report the error only if we have nothing to return, it will
+             * show up again in the next call otherwise. */
+            if (count) break;
+            anetSetError(err, "accept: %s\n", strerror(errno));
+            return ANET_ERR;
+        }
+        conns[count].fd = fd;
+        strcpy(conns[count].ip, inet_ntoa(sa.sin_addr));
+        conns[count].port = ntohs(sa.sin_port);
+        count++;
+    }
+    return count;
+}
@@ -35,12 +35,21 @@
 #define ANET_ERR -1
 #define ANET_ERR_LEN 256
 
+/* Connection accepted by anetAcceptBatch() */
+typedef struct anetAcceptedConn {
+    int fd;
+    int port;
+    char ip[16]; /* dotted quad */
+} anetAcceptedConn;
+
 int anetTcpConnect(char *err, char *addr, int port);
 int anetTcpNonBlockConnect(char *err, char *addr, int port);
 int anetRead(int fd, char *buf, int count);
 int anetResolve(char *err, char *host, char *ipbuf);
 int anetTcpServer(char *err, int port, char *bindaddr);
+int anetTcpServerReusePort(char *err, int port, char *bindaddr);
 int anetAccept(char *err, int serversock, char *ip, int *port);
+int anetAcceptBatch(char *err, int serversock, anetAcceptedConn *conns, int max);
 int anetWrite(int fd, char *buf, int count);
 int anetNonBlock(char *err, int fd);
 int anetTcpNoDelay(char *err, int fd);
@@ -0,0 +1,286 @@
+/* Size class allocator for small blocks.
+ *
+ * Allocations up to ARENA_MAX_SIZE bytes are rounded to one of the size
+ * classes and served from "runs" of 64k obtained with mmap(). A run only
+ * holds blocks of a single class, so that the many small objects of the
+ * same kind are packed together instead of being spread in the malloc()
+ * heap, and there is no header per block: the class of a block is stored
+ * at the start of its run, that is aligned to its size. A two levels map of
+ * the address space tells if a pointer belongs to a run.
+ *
+ * Every class keeps the list of its runs with free blocks. Blocks are taken
+ * from the free list of the run, or carved from its never used part, and a
+ * run that gets completely free is released to the kernel (but one per
+ * class is kept, to avoid calling mmap()/munmap() in a loop).
+ *
+ * Copyright (c) 2010, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "fmacros.h"
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+#define ARENA_RUN_BITS 16
+#define ARENA_RUN_SIZE (1<<ARENA_RUN_BITS)
+#define ARENA_RUN_HDR 64        /* Run header, blocks start after it */
+#define ARENA_MAP_BITS 16       /* Runs indexed by each level of the map */
+
+typedef struct arenaRun {
+    struct arenaRun *prev, *next; /* Runs of the class with free blocks */
+    void *free;                 /* Freed blocks, linked by their first word */
+    char *unused;               /* Blocks never allocated start here */
+    unsigned int class;
+    unsigned int used;          /* Allocated blocks */
+} arenaRun;
+
+typedef struct arenaClass {
+    size_t size;
+    unsigned int blocks;        /* Blocks per run */
+    arenaRun *partial;          /* Runs with free blocks */
+    arenaRun *spare;            /* A completely free run, or NULL */
+    size_t runs;
+    size_t used;
+    pthread_mutex_t lock;
+} arenaClass;
+
+/* Spaced by 8 bytes up to 64, then four classes for every power of two */
+static const size_t arenaSizes[] = {
+    8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256,
+    320, 384, 448, 512, 640, 768, 896, 1024
+};
+#define ARENA_CLASSES ((int)(sizeof(arenaSizes)/sizeof(arenaSizes[0])))
+
+static arenaClass arenaClasses[ARENA_CLASSES];
+static unsigned char arenaSizeClass[ARENA_MAX_SIZE/8+1]; /* (size+7)/8 -> class */
+static unsigned char *arenaMap[1<<ARENA_MAP_BITS];
+static pthread_mutex_t arenaMapLock = PTHREAD_MUTEX_INITIALIZER;
+static int arenaInitialized = 0;
+static int arenaThreadSafe = 0;
+
+static void arenaInit(void) {
+    int j, class = 0;
+
+    for (j = 0; j < ARENA_CLASSES; j++) {
+        arenaClasses[j].size = arenaSizes[j];
+        arenaClasses[j].blocks = (ARENA_RUN_SIZE-ARENA_RUN_HDR)/arenaSizes[j];
+        arenaClasses[j].partial = arenaClasses[j].spare = NULL;
+        arenaClasses[j].runs = arenaClasses[j].used = 0;
+        pthread_mutex_init(&arenaClasses[j].lock,NULL);
+    }
+    for (j = 0; j <= ARENA_MAX_SIZE/8; j++) {
+        while (arenaSizes[class] < (size_t)j*8) class++;
+        arenaSizeClass[j] = class;
+    }
+    arenaInitialized = 1;
+}
+
+/* Return the map entry of the run at 'addr', or NULL if the map doesn't
+ * cover it (yet). With 'create' the second level of the map is allocated
+ * if needed. Only addresses below 2^48 are mapped. */
+static unsigned char *arenaMapEntry(uintptr_t addr, int create) {
+    uint64_t run = (uint64_t)addr >> ARENA_RUN_BITS;
+    unsigned long hi = run >> ARENA_MAP_BITS;
+    unsigned char *map;
+
+    if (hi >= (1<<ARENA_MAP_BITS)) return NULL;
+    map = arenaMap[hi];
+    if (map == NULL && create) {
+        if (arenaThreadSafe) pthread_mutex_lock(&arenaMapLock);
+        if ((map = arenaMap[hi]) == NULL) {
+            map = mmap(NULL,1<<ARENA_MAP_BITS,PROT_READ|PROT_WRITE,
+                       MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+            if (map == MAP_FAILED)
+                map = NULL;
+            else
+                arenaMap[hi] = map;
+        }
+        if (arenaThreadSafe) pthread_mutex_unlock(&arenaMapLock);
+    }
+    return map ? map+(run & ((1<<ARENA_MAP_BITS)-1)) : NULL;
+}
+
+/* Map a new run, aligned to its size: more space is mapped, and the parts
+ * before and after the aligned run are unmapped. */
+static arenaRun *arenaNewRun(int class) {
+    char *p, *aligned;
+    unsigned char *entry;
+    uintptr_t skip;
+
+    p = mmap(NULL,ARENA_RUN_SIZE*2,PROT_READ|PROT_WRITE,
+             MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+    if (p == MAP_FAILED) return NULL;
+    skip = (ARENA_RUN_SIZE - ((uintptr_t)p & (ARENA_RUN_SIZE-1))) &
+           (ARENA_RUN_SIZE-1);
+    aligned = p+skip;
+    if (skip) munmap(p,skip);
+    munmap(aligned+ARENA_RUN_SIZE,ARENA_RUN_SIZE-skip);
+    if ((entry = arenaMapEntry((uintptr_t)aligned,1)) == NULL) {
+        munmap(aligned,ARENA_RUN_SIZE);
+        return NULL;
+    }
+    *entry = 1;
+    arenaClasses[class].runs++;
+    return (arenaRun*)aligned;
+}
+
+static void arenaReleaseRun(arenaRun *run) {
+    *arenaMapEntry((uintptr_t)run,0) = 0;
+    arenaClasses[run->class].runs--;
+    munmap(run,ARENA_RUN_SIZE);
+}
+
+static void arenaResetRun(arenaRun *run, int class) {
+    run->prev = run->next = NULL;
+    run->free = NULL;
+    run->unused = (char*)run+ARENA_RUN_HDR;
+    run->class = class;
+    run->used = 0;
+}
+
+static void arenaLinkRun(arenaClass *c, arenaRun *run) {
+    run->prev = NULL;
+    run->next = c->partial;
+    if (c->partial) c->partial->prev = run;
+    c->partial = run;
+}
+
+static void arenaUnlinkRun(arenaClass *c, arenaRun *run) {
+    if (run->prev)
+        run->prev->next = run->next;
+    else
+        c->partial = run->next;
+    if (run->next) run->next->prev = run->prev;
+    run->prev = run->next = NULL;
+}
+
+/* Allocate a block of at least 'size' bytes (up to ARENA_MAX_SIZE), returns
+ * NULL if no memory can be mapped. */
+void *arenaAlloc(size_t size) {
+    int class;
+    arenaClass *c;
+    arenaRun *run;
+    void *p = NULL;
+
+    if (!arenaInitialized) arenaInit();
+    class = arenaSizeClass[(size+7)/8];
+    c = arenaClasses+class;
+    if (arenaThreadSafe) pthread_mutex_lock(&c->lock);
+    if ((run = c->partial) == NULL) {
+        if (c->spare) {
+            run = c->spare;
+            c->spare = NULL;
+        } else if ((run = arenaNewRun(class)) == NULL) {
+            goto out;
+        }
+        arenaResetRun(run,class);
+        arenaLinkRun(c,run);
+    }
+    if (run->free) {
+        p = run->free;
+        run->free = *(void**)p;
+    } else {
+        p = run->unused;
+        run->unused += c->size;
+    }
+    c->used++;
+    if (++run->used == c->blocks) arenaUnlinkRun(c,run);
+out:
+    if (arenaThreadSafe) pthread_mutex_unlock(&c->lock);
+    return p;
+}
+
+void arenaFree(void *ptr) {
+    arenaRun *run = (arenaRun*)((uintptr_t)ptr & ~(uintptr_t)(ARENA_RUN_SIZE-1));
+    arenaClass *c = arenaClasses+run->class;
+
+    if (arenaThreadSafe) pthread_mutex_lock(&c->lock);
+    *(void**)ptr = run->free;
+    run->free = ptr;
+    if (run->used-- == c->blocks) arenaLinkRun(c,run);
+    c->used--;
+    if (run->used == 0) {
+        arenaUnlinkRun(c,run);
+        if (c->spare == NULL)
+            c->spare = run;
+        else
+            arenaReleaseRun(run);
+    }
+    if (arenaThreadSafe) pthread_mutex_unlock(&c->lock);
+}
+
+/* Return non zero if 'ptr' was allocated by arenaAlloc() */
+int arenaOwns(void *ptr) {
+    unsigned char *entry = arenaMapEntry((uintptr_t)ptr,0);
+
+    return entry && *entry;
+}
+
+/* Size of the block at 'ptr', that must belong to the arena */
+size_t arenaBlockSize(void *ptr) {
+    arenaRun *run = (arenaRun*)((uintptr_t)ptr & ~(uintptr_t)(ARENA_RUN_SIZE-1));
+
+    return arenaSizes[run->class];
+}
+
+/* Size of the block allocated for 'size' bytes */
+size_t arenaClassSize(size_t size) {
+    if (!arenaInitialized) arenaInit();
+    return arenaSizes[arenaSizeClass[(size+7)/8]];
+}
+
+void arenaEnableThreadSafeness(void) {
+    if (!arenaInitialized) arenaInit();
+    arenaThreadSafe = 1;
+}
+
+/* Statistics of the size class 'class' (from 0): block size, runs, blocks
+ * allocated and blocks in the runs. Returns 0 if there is no such class. */
+int arenaClassStats(int class, size_t *size, size_t *runs, size_t *used,
+                    size_t *capacity)
+{
+    arenaClass *c;
+
+    if (!arenaInitialized) arenaInit();
+    if (class < 0 || class >= ARENA_CLASSES) return 0;
+    c = arenaClasses+class;
+    if (arenaThreadSafe) pthread_mutex_lock(&c->lock);
+    *size = c->size;
+    *runs = c->runs;
+    *used = c->used;
+    *capacity = c->runs*c->blocks;
+    if (arenaThreadSafe) pthread_mutex_unlock(&c->lock);
+    return 1;
+}
@@ -0,0 +1,352 @@
+/* List of ziplist chunks, used as the encoding of big Redis Lists.
+ *
+ * The elements are stored in ziplists of up to 128 elements (see ziplist.c)
+ * that are kept in order in an array of slots, with free slots on both
+ * sides so that adding a chunk at the head or at the tail is O(1). The
+ * lengths of the chunks are summed in a Fenwick tree, so the chunk holding
+ * the element at a given index is found in O(log(N)), and only a fraction
+ * of a chunk needs to be walked to reach the element. Iterating from a
+ * given element is O(1) per element.
+ *
+ * The memory overhead is a couple of bytes per element, plus two words
+ * for every chunk, against a list node and an object per element for a
+ * linked list.
+ *
+ * Copyright (c) 2010, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "chunklist.h"
+#include "zmalloc.h"
+
+/* A chunk gets new elements until it has this many entries or bytes, so
+ * that pushing at the head and deleting (that move the following entries
+ * of the chunk) stay cheap. An element bigger than the byte limit gets a
+ * chunk of its own. Chunks that get less than a quarter of the entries
+ * are merged with a neighbour when possible. */
+#define CHUNKLIST_CHUNK_ENTRIES 128
+#define CHUNKLIST_CHUNK_BYTES 8192
+#define CHUNKLIST_MIN_SLOTS 4
+
+/* ------------------------ Fenwick tree of the chunk lengths --------------- */
+
+/* tree[i-1] is the sum of the lengths of the chunks in the slots from
+ * i-lowbit(i) to i-1, so both the number of elements before a given chunk
+ * and the chunk holding a given element are found in O(log(slots)). The
+ * free slots are always counted as empty chunks. */
+static void _chunklistTreeAdd(chunklist *cl, unsigned long slot, long delta) {
+    unsigned long i;
+
+    for (i = slot+1; i <= cl->slots; i += i & (~i+1))
+        cl->tree[i-1] += delta;
+}
+
+static void _chunklistTreeBuild(chunklist *cl) {
+    unsigned long i, j;
+
+    memset(cl->tree,0,sizeof(unsigned long)*cl->slots);
+    for (i = cl->head; i < cl->tail; i++)
+        cl->tree[i] = ziplistLen(cl->chunks[i]);
+    for (i = 1; i <= cl->slots; i++) {
+        j = i + (i & (~i+1));
+        if (j <= cl->slots) cl->tree[j-1] += cl->tree[i-1];
+    }
+}
+
+/* Return the slot of the chunk holding the element at 'index', and store
+ * in '*offset' the position of the element inside the chunk. The index
+ * must be in range. */
+static unsigned long _chunklistTreeFind(chunklist *cl, unsigned long index,
+                                        unsigned long *offset)
+{
+    unsigned long pos = 0, bit = 1;
+
+    while (bit*2 <= cl->slots) bit *= 2;
+    for (; bit; bit >>= 1) {
+        if (pos+bit <= cl->slots && cl->tree[pos+bit-1] <= index) {
+            pos += bit;
+            index -= cl->tree[pos-1];
+        }
+    }
+    *offset = index;
+    return pos;
+}
+
+/* ------------------------------ Chunks ------------------------------------ */
+
+/* Make sure there is a free slot before the head (ZIPLIST_HEAD) or after
+ * the tail (ZIPLIST_TAIL), reallocating the slots with the used ones in the
+ * middle if needed. Since the free slots are split among the two sides, a
+ * list used as a queue (pushing on one side and popping from the other) is
+ * only reallocated after its chunks moved by half of their number. */
+static void _chunklistMakeRoom(chunklist *cl, int where) {
+    unsigned long used = cl->tail-cl->head, slots, head;
+    unsigned char **chunks;
+
+    if (where == ZIPLIST_HEAD ? cl->head > 0 : cl->tail < cl->slots) return;
+    slots = used*2+2;
+    if (slots < CHUNKLIST_MIN_SLOTS) slots = CHUNKLIST_MIN_SLOTS;
+    head = (slots-used)/2;
+
+    chunks = zmalloc(sizeof(unsigned char*)*slots);
+    if (used) memcpy(chunks+head,cl->chunks+cl->head,sizeof(unsigned char*)*used);
+    zfree(cl->chunks);
+    cl->chunks = chunks;
+    cl->tree = zrealloc(cl->tree,sizeof(unsigned long)*slots);
+    cl->slots = slots;
+    cl->head = head;
+    cl->tail = head+used;
+    _chunklistTreeBuild(cl);
+}
+
+/* Add an empty chunk at the head or tail, returning its slot */
+static unsigned long _chunklistAddChunk(chunklist *cl, int where) {
+    unsigned long slot;
+
+    _chunklistMakeRoom(cl,where);
+    slot = (where == ZIPLIST_HEAD) ? --cl->head : cl->tail++;
+    cl->chunks[slot] = ziplistNew();
+    return slot;
+}
+
+/* Free the chunk at 'slot', that must be already counted as empty */
+static void _chunklistRemoveChunk(chunklist *cl, unsigned long slot) {
+    zfree(cl->chunks[slot]);
+    if (slot == cl->head) {
+        cl->head++;
+    } else if (slot == cl->tail-1) {
+        cl->tail--;
+    } else {
+        memmove(cl->chunks+slot,cl->chunks+slot+1,
+            sizeof(unsigned char*)*(cl->tail-slot-1));
+        cl->tail--;
+        _chunklistTreeBuild(cl);
+    }
+}
+
+static int _chunklistCanMerge(unsigned char *a, unsigned char *b) {
+    return ziplistLen(a)+ziplistLen(b) <= CHUNKLIST_CHUNK_ENTRIES &&
+           ziplistBlobLen(a)+ziplistBlobLen(b) <= CHUNKLIST_CHUNK_BYTES;
+}
+
+/* Called after elements were removed from the chunk at 'slot': the chunk
+ * is freed if empty, or merged with a neighbour if it became small. */
+static void _chunklistCompact(chunklist *cl, unsigned long slot) {
+    unsigned int len = ziplistLen(cl->chunks[slot]);
+    unsigned long first, second;
+
+    if (len == 0) {
+        _chunklistRemoveChunk(cl,slot);
+        return;
+    }
+    if (len >= CHUNKLIST_CHUNK_ENTRIES/4) return;
+
+    if (slot > cl->head && _chunklistCanMerge(cl->chunks[slot-1],cl->chunks[slot])) {
+        first = slot-1;
+    } else if (slot+1 < cl->tail && _chunklistCanMerge(cl->chunks[slot],cl->chunks[slot+1])) {
+        first = slot;
+    } else {
+        return;
+    }
+    second = first+1;
+    len = ziplistLen(cl->chunks[second]);
+    cl->chunks[first] = ziplistMerge(cl->chunks[first],cl->chunks[second]);
+    _chunklistTreeAdd(cl,first,len);
+    _chunklistTreeAdd(cl,second,-(long)len);
+    _chunklistRemoveChunk(cl,second);
+}
+
+/* ----------------------------- API ---------------------------------------- */
+
+chunklist *chunklistNew(void) {
+    chunklist *cl = zmalloc(sizeof(*cl));
+
+    cl->chunks = NULL;
+    cl->tree = NULL;
+    cl->head = cl->tail = cl->slots = 0;
+    cl->len = 0;
+    return cl;
+}
+
+/* Create a chunk list with the elements of the ziplist 'zl', that is used
+ * as the first chunk when small enough, or freed. */
+chunklist *chunklistFromZiplist(unsigned char *zl) {
+    chunklist *cl = chunklistNew();
+    unsigned char *p, *sval;
+    unsigned int slen;
+    long long lval;
+    char buf[32];
+
+    if (ziplistLen(zl) > 0 && ziplistLen(zl) <= CHUNKLIST_CHUNK_ENTRIES) {
+        unsigned long slot = _chunklistAddChunk(cl,ZIPLIST_TAIL);
+
+        zfree(cl->chunks[slot]);
+        cl->chunks[slot] = zl;
+        cl->len = ziplistLen(zl);
+        _chunklistTreeAdd(cl,slot,cl->len);
+        return cl;
+    }
+    p = ziplistIndex(zl,0);
+    while (ziplistGet(p,&sval,&slen,&lval)) {
+        if (sval == NULL) {
+            slen = snprintf(buf,sizeof(buf),"%lld",lval);
+            sval = (unsigned char*)buf;
+        }
+        chunklistPush(cl,sval,slen,ZIPLIST_TAIL);
+        p = ziplistNext(zl,p);
+    }
+    zfree(zl);
+    return cl;
+}
+
+void chunklistRelease(chunklist *cl) {
+    unsigned long j;
+
+    for (j = cl->head; j < cl->tail; j++)
+        zfree(cl->chunks[j]);
+    zfree(cl->chunks);
+    zfree(cl->tree);
+    zfree(cl);
+}
+
+/* Add an element at the head (ZIPLIST_HEAD) or tail (ZIPLIST_TAIL) */
+void chunklistPush(chunklist *cl, unsigned char *s, unsigned int slen, int where) {
+    unsigned long slot;
+    unsigned char *zl;
+
+    if (cl->head == cl->tail) {
+        slot = _chunklistAddChunk(cl,where);
+    } else {
+        slot = (where == ZIPLIST_HEAD) ? cl->head : cl->tail-1;
+        zl = cl->chunks[slot];
+        if (ziplistLen(zl) >= CHUNKLIST_CHUNK_ENTRIES ||
+            ziplistBlobLen(zl)+slen > CHUNKLIST_CHUNK_BYTES)
+            slot = _chunklistAddChunk(cl,where);
+    }
+    cl->chunks[slot] = ziplistPush(cl->chunks[slot],s,slen,where);
+    _chunklistTreeAdd(cl,slot,1);
+    cl->len++;
+}
+
+/* Set 'e' to the element at 'index', negative indexes start from the tail.
+ * Returns 0 (and sets e->p to NULL) if the index is out of range. */
+int chunklistIndex(chunklist *cl, long index, chunklistEntry *e) {
+    unsigned long offset, len;
+    unsigned char *zl;
+
+    if (index < 0) index += cl->len;
+    if (index < 0 || (unsigned long)index >= cl->len) {
+        e->p = NULL;
+        return 0;
+    }
+    e->slot = _chunklistTreeFind(cl,index,&offset);
+    zl = cl->chunks[e->slot];
+    len = ziplistLen(zl);
+    /* Walk the chunk from the nearest side */
+    if (offset < len/2)
+        e->p = ziplistIndex(zl,offset);
+    else
+        e->p = ziplistIndex(zl,(long)offset-(long)len);
+    return 1;
+}
+
+/* Move 'e' to the next element, returns 0 if it was the last one */
+int chunklistNext(chunklist *cl, chunklistEntry *e) {
+    e->p = ziplistNext(cl->chunks[e->slot],e->p);
+    if (e->p == NULL && ++e->slot < cl->tail)
+        e->p = ziplistIndex(cl->chunks[e->slot],0);
+    return e->p != NULL;
+}
+
+/* Move 'e' to the previous element, returns 0 if it was the first one */
+int chunklistPrev(chunklist *cl, chunklistEntry *e) {
+    e->p = ziplistPrev(cl->chunks[e->slot],e->p);
+    if (e->p == NULL && e->slot > cl->head)
+        e->p = ziplistIndex(cl->chunks[--e->slot],-1);
+    return e->p != NULL;
+}
+
+/* Replace the value of the element 'e', that stays valid */
+void chunklistReplace(chunklist *cl, chunklistEntry *e, unsigned char *s, unsigned int slen) {
+    unsigned char *zl = cl->chunks[e->slot];
+    size_t offset = e->p-zl;
+
+    zl = ziplistReplace(zl,e->p,s,slen);
+    cl->chunks[e->slot] = zl;
+    e->p = zl+offset;
+}
+
+/* Delete the element 'e'. The chunks may be merged or moved, so the
+ * following elements have to be looked up again by index. */
+void chunklistDelete(chunklist *cl, chunklistEntry *e) {
+    cl->chunks[e->slot] = ziplistDelete(cl->chunks[e->slot],&e->p);
+    _chunklistTreeAdd(cl,e->slot,-1);
+    cl->len--;
+    _chunklistCompact(cl,e->slot);
+    e->p = NULL;
+}
+
+/* Delete 'num' elements starting at 'start' */
+void chunklistDeleteRange(chunklist *cl, unsigned long start, unsigned long num) {
+    unsigned long slot, offset, n;
+
+    if (start >= cl->len) return;
+    if (num > cl->len-start) num = cl->len-start;
+    while (num) {
+        /* A prefix of the list is deleted from the first chunk, anything
+         * else from the end of the range, so that trimming the head or the
+         * tail of the list just drops the chunks at the sides. */
+        if (start == 0) {
+            slot = _chunklistTreeFind(cl,0,&offset);
+            n = ziplistLen(cl->chunks[slot]);
+            if (n > num) n = num;
+        } else {
+            slot = _chunklistTreeFind(cl,start+num-1,&offset);
+            n = (offset+1 > num) ? num : offset+1;
+            offset = offset+1-n;
+        }
+        cl->chunks[slot] = ziplistDeleteRange(cl->chunks[slot],offset,n);
+        _chunklistTreeAdd(cl,slot,-(long)n);
+        cl->len -= n;
+        num -= n;
+        _chunklistCompact(cl,slot);
+    }
+}
+
+/* Bytes used by the list, for the VM swappability estimate */
+size_t chunklistBlobLen(chunklist *cl) {
+    size_t bytes = sizeof(*cl);
+    unsigned long j;
+
+    bytes += (sizeof(unsigned char*)+sizeof(unsigned long))*cl->slots;
+    for (j = cl->head; j < cl->tail; j++)
+        bytes += ziplistBlobLen(cl->chunks[j]);
+    return bytes;
+}
@@ -0,0 +1,67 @@
+/* List of ziplist chunks with O(log(N)) access by index, see chunklist.c
+ *
+ * Copyright (c) 2010, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CHUNKLIST_H
+#define __CHUNKLIST_H
+
+#include <stddef.h>
+
+#include "ziplist.h"
+
+typedef struct chunklist {
+    unsigned char **chunks;     /* Ziplists, the used slots are [head,tail) */
+    unsigned long *tree;        /* Fenwick tree of the chunk lengths */
+    unsigned long head, tail;   /* Used slots */
+    unsigned long slots;        /* Allocated slots */
+    unsigned long len;          /* Number of elements */
+} chunklist;
+
+/* Position of an element: the ziplist entry 'p' in the chunk at 'slot'.
+ * Positions are invalidated by any change to the list. */
+typedef struct chunklistEntry {
+    unsigned long slot;
+    unsigned char *p;           /* NULL if not a valid element */
+} chunklistEntry;
+
+#define chunklistLen(cl) ((cl)->len)
+
+chunklist *chunklistNew(void);
+chunklist *chunklistFromZiplist(unsigned char *zl);
+void chunklistRelease(chunklist *cl);
+void chunklistPush(chunklist *cl, unsigned char *s, unsigned int slen, int where);
+int chunklistIndex(chunklist *cl, long index, chunklistEntry *e);
+int chunklistNext(chunklist *cl, chunklistEntry *e);
+int chunklistPrev(chunklist *cl, chunklistEntry *e);
+void chunklistReplace(chunklist *cl, chunklistEntry *e, unsigned char *s, unsigned int slen);
+void chunklistDelete(chunklist *cl, chunklistEntry *e);
+void chunklistDeleteRange(chunklist *cl, unsigned long start, unsigned long num);
+size_t chunklistBlobLen(chunklist *cl);
+
+#endif
@@ -12,6 +12,19 @@
 #define redis_malloc_size(p) malloc_size(p)
 #endif
 
+/* glibc has malloc_usable_size(), that saves the size header */
+#if defined(__GLIBC__) && !defined(HAVE_MALLOC_SIZE)
+#include <malloc.h>
+#define HAVE_MALLOC_SIZE 1
+#define redis_malloc_size(p) malloc_usable_size(p)
+#endif
+
+/* test for atomic builtins (__sync_add_and_fetch() and friends) */
+#if defined(__GNUC__) && \
+    ((__GNUC__ * 100 + __GNUC_MINOR__) >= 401 || defined(__clang__))
+#define HAVE_ATOMIC 1
+#endif
+
 /* define redis_fstat to fstat or fstat64() */
 #if defined(__APPLE__) && !defined(MAC_OS_X_VERSION_10_6)
 #define redis_fstat fstat64
@@ -41,9 +41,11 @@
 #include <stdarg.h>
 #include <assert.h>
 #include <limits.h>
+#include <sys/time.h>
 
 #include "dict.h"
 #include "zmalloc.h"
+#include "siphash.h"
 
 /* ---------------------------- Utility funcitons --------------------------- */
 
@@ -68,16 +70,226 @@ static void *_dictAlloc(size_t size)
     return p;
 }
 
+static void *_dictAllocZeroed(size_t size)
+{
+    void *p = zcalloc(size);
+    if (p == NULL)
+        _dictPanic("Out of memory");
+    return p;
+}
+
 static void _dictFree(void *ptr) {
     zfree(ptr);
 }
 
+/* ---------------------------- Entry slabs --------------------------------- */
+
+/* Once a dictionary holds DICT_SLAB_THRESHOLD entries, the new entries are
+ * allocated from slabs owned by the dict: arrays of entries with no
+ * allocator overhead for every entry. Smaller dicts, like most of the Sets
+ * and Sorted Sets, keep allocating every entry on its own, since a slab
+ * would waste more memory than the allocator overhead it saves. Every
+ * slab is about 1/8 bigger than the previous one (up to DICT_SLAB_MAX
+ * entries) so the unused part of the last slab stays small.
+ *
+ * The entries allocated before the switch stay where they are, and are
+ * told apart from the slab entries only when they must be freed. Deleted
+ * entries are reused by the next insertions, and the slabs are freed all
+ * together: when the dict gets empty or is released, or when dictResize()
+ * compacts the entries. Since the slabs belong to a single dict, they need
+ * no more locking than the dict itself. */
+#define DICT_SLAB_THRESHOLD 32
+#define DICT_SLAB_MIN 8
+#define DICT_SLAB_MAX 1024
+
+typedef struct dictEntrySlab {
+    struct dictEntrySlab *next;
+    unsigned int size;      /* number of entries in the slab */
+    unsigned int used;      /* entries handed out, the others were never used */
+    unsigned long looseentries; /* entries allocated on their own, only
+                                   kept in the newest slab (d->slabs) */
+    dictEntry entries[];
+} dictEntrySlab;
+
+#define _dictLooseEntries(d) ((d)->slabs ? (d)->slabs->looseentries : 0)
+
+static dictEntrySlab *_dictAddSlab(dict *d, unsigned long size)
+{
+    dictEntrySlab *slab = _dictAlloc(sizeof(*slab)+sizeof(dictEntry)*size);
+
+    slab->next = d->slabs;
+    slab->size = size;
+    slab->used = 0;
+    slab->looseentries = _dictLooseEntries(d);
+    d->slabs = slab;
+    return slab;
+}
+
+static dictEntry *_dictAllocEntry(dict *d)
+{
+    dictEntrySlab *slab = d->slabs;
+    dictEntry *he;
+    unsigned long size;
+
+    if ((he = d->freeentries) != NULL) {
+        d->freeentries = he->next;
+        return he;
+    }
+    if (slab == NULL) {
+        if (dictSize(d) < DICT_SLAB_THRESHOLD) return _dictAlloc(sizeof(*he));
+        slab = _dictAddSlab(d, DICT_SLAB_MIN);
+        slab->looseentries = dictSize(d);
+    } else if (slab->used == slab->size) {
+        size = slab->size+slab->size/8+1;
+        slab = _dictAddSlab(d, (size > DICT_SLAB_MAX) ? DICT_SLAB_MAX : size);
+    }
+    return slab->entries+(slab->used++);
+}
+
+static void _dictFreeEntry(dict *d, dictEntry *he)
+{
+    if (d->slabs == NULL) {
+        _dictFree(he);
+        return;
+    }
+    he->next = d->freeentries;
+    d->freeentries = he;
+}
+
+static int _dictSlabCompare(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(dictEntrySlab* const*)a;
+    uintptr_t y = (uintptr_t) *(dictEntrySlab* const*)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Return the slabs sorted by address, to be searched by _dictIsLoose(). Only
+ * called if the dict has loose entries. */
+static dictEntrySlab **_dictSortSlabs(dict *d, unsigned long *count)
+{
+    dictEntrySlab *slab, **sorted;
+    unsigned long j = 0;
+
+    for (slab = d->slabs; slab; slab = slab->next) j++;
+    sorted = _dictAlloc(sizeof(dictEntrySlab*)*j);
+    *count = j;
+    for (j = 0, slab = d->slabs; slab; slab = slab->next) sorted[j++] = slab;
+    qsort(sorted, *count, sizeof(dictEntrySlab*), _dictSlabCompare);
+    return sorted;
+}
+
+/* Return 1 if the entry was allocated on its own, and not from a slab */
+static int _dictIsLoose(dictEntrySlab **sorted, unsigned long count,
+                        dictEntry *he)
+{
+    unsigned long lo = 0, hi = count, mid;
+    dictEntrySlab *slab;
+
+    while(lo < hi) {
+        mid = (lo+hi)/2;
+        if ((uintptr_t)sorted[mid] <= (uintptr_t)he)
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    if (lo == 0) return 1;
+    slab = sorted[lo-1];
+    return (uintptr_t)he >= (uintptr_t)(slab->entries+slab->size);
+}
+
+/* Free the slabs and the loose entries of the free list. All the other
+ * entries must be already unlinked and freed. */
+static void _dictReleaseSlabs(dict *d)
+{
+    dictEntrySlab *slab = d->slabs, *next, **sorted;
+    dictEntry *he, *nexthe;
+    unsigned long count;
+
+    if (_dictLooseEntries(d)) {
+        sorted = _dictSortSlabs(d, &count);
+        for (he = d->freeentries; he && d->slabs->looseentries; he = nexthe) {
+            nexthe = he->next;
+            if (_dictIsLoose(sorted, count, he)) {
+                _dictFree(he);
+                d->slabs->looseentries--;
+            }
+        }
+        _dictFree(sorted);
+    }
+    while(slab) {
+        next = slab->next;
+        _dictFree(slab);
+        slab = next;
+    }
+    d->slabs = NULL;
+    d->freeentries = NULL;
+}
+
+/* Move the entries of a chained dict to new slabs just big enough to hold
+ * them, when less than half of the allocated entries are in use. The
+ * entries change address, so this can't be done while iterating. */
+static void _dictCompactSlabs(dict *d)
+{
+    dictEntrySlab *old = d->slabs, *next, **sorted = NULL;
+    dictEntry *freeentries = d->freeentries, *he, *nexthe;
+    unsigned long capacity = _dictLooseEntries(d), left = dictSize(d), count = 0, j;
+    int table;
+
+    if (d->openaddr || d->iterators || old == NULL) return;
+    for (next = old; next; next = next->next) capacity += next->size;
+    if (capacity <= left*2) return;
+
+    if (_dictLooseEntries(d)) sorted = _dictSortSlabs(d, &count);
+    d->slabs = NULL;
+    d->freeentries = NULL;
+    for (table = 0; table <= 1; table++) {
+        dictht *ht = &d->ht[table];
+
+        for (j = 0; j < ht->size; j++) {
+            dictEntry **link = &ht->table[j];
+
+            while(*link) {
+                if (d->slabs == NULL || d->slabs->used == d->slabs->size)
+                    _dictAddSlab(d, (left > DICT_SLAB_MAX) ? DICT_SLAB_MAX : left);
+                he = d->slabs->entries+(d->slabs->used++);
+                *he = **link;
+                if (sorted && _dictIsLoose(sorted, count, *link))
+                    _dictFree(*link);
+                *link = he;
+                link = &he->next;
+                left--;
+            }
+        }
+    }
+    for (he = freeentries; sorted && he; he = nexthe) {
+        nexthe = he->next;
+        if (_dictIsLoose(sorted, count, he)) _dictFree(he);
+    }
+    if (sorted) _dictFree(sorted);
+    while(old) {
+        next = old->next;
+        _dictFree(old);
+        old = next;
+    }
+}
+
 /* -------------------------- private prototypes ---------------------------- */
 
-static int _dictExpandIfNeeded(dict *ht);
+static int _dictExpandIfNeeded(dict *d);
 static unsigned long _dictNextPower(unsigned long size);
-static int _dictKeyIndex(dict *ht, const void *key);
-static int _dictInit(dict *ht, dictType *type, void *privDataPtr);
+static int _dictKeyIndex(dict *d, const void *key);
+static int _dictInit(dict *d, dictType *type, void *privDataPtr);
+static dictEntry *_dictOaFind(dict *d, const void *key);
+static int _dictOaExpand(dict *d, unsigned long size);
+static int _dictOaAdd(dict *d, void *key, void *val);
+static int _dictOaDelete(dict *d, const void *key, int nofree);
+static void _dictOaClear(dict *d);
+static dictEntry *_dictOaNext(dictIterator *iter);
+static dictEntry *_dictOaGetRandomKey(dict *d);
+static void _dictOaScanSlot(dict *d, unsigned long v, dictScanFunction *fn,
+                            void *privdata);
+static void _dictOaPrintStats(dict *d);
 
 /* -------------------------- hash functions -------------------------------- */
 
@@ -99,21 +311,33 @@ unsigned int dictIdentityHashFunction(unsigned int key)
     return key;
 }
 
-/* Generic hash function (a popular one from Bernstein).
- * I tested a few and this was the best. */
+/* Generic hash function: SipHash keyed with a seed that Redis sets at
+ * random at startup, so that clients can't send keys known to collide in
+ * the same bucket. See siphash.c for more information. */
+static uint8_t dict_hash_function_seed[16];
+
+void dictSetHashFunctionSeed(uint8_t *seed) {
+    memcpy(dict_hash_function_seed,seed,sizeof(dict_hash_function_seed));
+}
+
+uint8_t *dictGetHashFunctionSeed(void) {
+    return dict_hash_function_seed;
+}
+
 unsigned int dictGenHashFunction(const unsigned char *buf, int len) {
-    unsigned int hash = 5381;
+    return (unsigned int) siphash(buf,len,dict_hash_function_seed);
+}
 
-    while (len--)
-        hash = ((hash << 5) + hash) + (*buf++); /* hash * 33 + c */
-    return hash;
+/* And a case insensitive version, used for the command table */
+unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len) {
+    return (unsigned int) siphash_nocase(buf,len,dict_hash_function_seed);
 }
 
 /* ----------------------------- API implementation ------------------------- */
 
-/* Reset an hashtable already initialized with ht_init().
+/* Reset a hash table already initialized with ht_init().
  * NOTE: This function should only called by ht_destroy(). */
-static void _dictReset(dict *ht)
+static void _dictReset(dictht *ht)
 {
     ht->table = NULL;
     ht->size = 0;
@@ -125,103 +349,188 @@ static void _dictReset(dict *ht)
 dict *dictCreate(dictType *type,
         void *privDataPtr)
 {
-    dict *ht = _dictAlloc(sizeof(*ht));
+    dict *d = _dictAlloc(sizeof(*d));
 
-    _dictInit(ht,type,privDataPtr);
-    return ht;
+    _dictInit(d,type,privDataPtr);
+    return d;
 }
 
 /* Initialize the hash table */
-int _dictInit(dict *ht, dictType *type,
+int _dictInit(dict *d, dictType *type,
         void *privDataPtr)
 {
-    _dictReset(ht);
-    ht->type = type;
-    ht->privdata = privDataPtr;
+    _dictReset(&d->ht[0]);
+    _dictReset(&d->ht[1]);
+    d->type = type;
+    d->privdata = privDataPtr;
+    d->rehashidx = -1;
+    d->iterators = 0;
+    d->openaddr = 0;
+    d->tombstones = 0;
+    d->slabs = NULL;
+    d->freeentries = NULL;
     return DICT_OK;
 }
 
 /* Resize the table to the minimal size that contains all the elements,
- * but with the invariant of a USER/BUCKETS ration near to <= 1 */
-int dictResize(dict *ht)
+ * but with the invariant of a USER/BUCKETS ration near to <= 1. The
+ * entries are compacted as well if most of them were deleted. */
+int dictResize(dict *d)
 {
-    int minimal = ht->used;
+    unsigned long minimal;
 
+    if (dictIsRehashing(d)) return DICT_ERR;
+    _dictCompactSlabs(d);
+    minimal = d->ht[0].used;
     if (minimal < DICT_HT_INITIAL_SIZE)
         minimal = DICT_HT_INITIAL_SIZE;
-    return dictExpand(ht, minimal);
+    return dictExpand(d, minimal);
 }
 
-/* Expand or create the hashtable */
-int dictExpand(dict *ht, unsigned long size)
+/* Expand or create the hashtable. The elements are not moved here: the
+ * new table is installed as d->ht[1] and populated incrementally by
+ * dictRehash(), except when the dictionary is still empty. */
+int dictExpand(dict *d, unsigned long size)
 {
-    dict n; /* the new hashtable */
-    unsigned long realsize = _dictNextPower(size), i;
+    dictht n; /* the new hashtable */
+    unsigned long realsize = _dictNextPower(size);
 
     /* the size is invalid if it is smaller than the number of
-     * elements already inside the hashtable */
-    if (ht->used > size)
+     * elements already inside the hashtable, or if we are already
+     * rehashing */
+    if (d->openaddr) return _dictOaExpand(d, size);
+    if (dictIsRehashing(d) || d->ht[0].used > size)
         return DICT_ERR;
 
-    _dictInit(&n, ht->type, ht->privdata);
     n.size = realsize;
     n.sizemask = realsize-1;
-    n.table = _dictAlloc(realsize*sizeof(dictEntry*));
+    /* Allocate the table with all the pointers set to NULL. This is
+     * not a memset() of the whole table, that would take tens of
+     * milliseconds for big tables. */
+    n.table = _dictAllocZeroed(realsize*sizeof(dictEntry*));
+    n.used = 0;
+
+    /* Is this the first initialization? Then it's not really a rehashing,
+     * we just set the first hash table so that it can accept keys. */
+    if (d->ht[0].table == NULL) {
+        d->ht[0] = n;
+        return DICT_OK;
+    }
 
-    /* Initialize all the pointers to NULL */
-    memset(n.table, 0, realsize*sizeof(dictEntry*));
+    /* Prepare a second hash table for incremental rehashing */
+    d->ht[1] = n;
+    d->rehashidx = 0;
+    return DICT_OK;
+}
 
-    /* Copy all the elements from the old to the new table:
-     * note that if the old hash table is empty ht->size is zero,
-     * so dictExpand just creates an hash table. */
-    n.used = ht->used;
-    for (i = 0; i < ht->size && ht->used > 0; i++) {
-        dictEntry *he, *nextHe;
+/* Performs N steps of incremental rehashing. Returns 1 if there are still
+ * keys to move from the old to the new hash table, otherwise 0 is returned.
+ * Every step moves a bucket (that may contain more than one key, as we use
+ * chaining) from the old to the new table. Since the old table may be
+ * almost empty after a shrink, at most N*10 empty buckets are visited,
+ * otherwise a single step could block for a long time. */
+int dictRehash(dict *d, int n)
+{
+    unsigned long emptyvisits = (unsigned long)n*10;
 
-        if (ht->table[i] == NULL) continue;
-        
-        /* For each hash entry on this slot... */
-        he = ht->table[i];
-        while(he) {
+    if (!dictIsRehashing(d)) return 0;
+
+    while(n--) {
+        dictEntry *de, *nextde;
+
+        /* Check if we already rehashed the whole table... */
+        if (d->ht[0].used == 0) {
+            _dictFree(d->ht[0].table);
+            d->ht[0] = d->ht[1];
+            _dictReset(&d->ht[1]);
+            d->rehashidx = -1;
+            return 0;
+        }
+
+        /* Note that rehashidx can't overflow as we are sure there are more
+         * elements because ht[0].used != 0 */
+        assert(d->ht[0].size > (unsigned long)d->rehashidx);
+        while(d->ht[0].table[d->rehashidx] == NULL) {
+            d->rehashidx++;
+            if (--emptyvisits == 0) return 1;
+        }
+        de = d->ht[0].table[d->rehashidx];
+        /* Move all the keys in this bucket from the old to the new hash HT */
+        while(de) {
             unsigned int h;
 
-            nextHe = he->next;
-            /* Get the new element index */
-            h = dictHashKey(ht, he->key) & n.sizemask;
-            he->next = n.table[h];
-            n.table[h] = he;
-            ht->used--;
-            /* Pass to the next element */
-            he = nextHe;
+            nextde = de->next;
+            /* Get the index in the new hash table */
+            h = dictHashKey(d, de->key) & d->ht[1].sizemask;
+            de->next = d->ht[1].table[h];
+            d->ht[1].table[h] = de;
+            d->ht[0].used--;
+            d->ht[1].used++;
+            de = nextde;
         }
+        d->ht[0].table[d->rehashidx] = NULL;
+        d->rehashidx++;
     }
-    assert(ht->used == 0);
-    _dictFree(ht->table);
+    return 1;
+}
 
-    /* Remap the new hashtable in the old */
-    *ht = n;
-    return DICT_OK;
+static long long _dictTimeInMilliseconds(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv,NULL);
+    return (((long long)tv.tv_sec)*1000)+(tv.tv_usec/1000);
+}
+
+/* Rehash in batches of 100 buckets for about 'ms' milliseconds.
+ * Returns the number of batches performed. */
+int dictRehashMilliseconds(dict *d, int ms) {
+    long long start = _dictTimeInMilliseconds();
+    int rehashes = 0;
+
+    while(dictRehash(d,100)) {
+        rehashes++;
+        if (_dictTimeInMilliseconds()-start > ms) break;
+    }
+    return rehashes;
+}
+
+/* This function performs just a step of rehashing, and only if there are
+ * no iterators bound to our hash table. When we have iterators in the
+ * middle of a rehashing we can't mess with the two hash tables otherwise
+ * some element can be missed or duplicated.
+ *
+ * This function is called by common lookup or update operations in the
+ * dictionary so that the hash table automatically migrates from H1 to H2
+ * while it is actively used. */
+static void _dictRehashStep(dict *d) {
+    if (d->iterators == 0) dictRehash(d,1);
 }
 
 /* Add an element to the target hash table */
-int dictAdd(dict *ht, void *key, void *val)
+int dictAdd(dict *d, void *key, void *val)
 {
     int index;
     dictEntry *entry;
+    dictht *ht;
+
+    if (d->openaddr) return _dictOaAdd(d, key, val);
+    if (dictIsRehashing(d)) _dictRehashStep(d);
 
     /* Get the index of the new element, or -1 if
      * the element already exists. */
-    if ((index = _dictKeyIndex(ht, key)) == -1)
+    if ((index = _dictKeyIndex(d, key)) == -1)
         return DICT_ERR;
 
-    /* Allocates the memory and stores key */
-    entry = _dictAlloc(sizeof(*entry));
+    /* Allocates the memory and stores key. While rehashing new keys
+     * always go in the new table. */
+    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
+    entry = _dictAllocEntry(d);
     entry->next = ht->table[index];
     ht->table[index] = entry;
 
     /* Set the hash entry fields. */
-    dictSetHashKey(ht, entry, key);
-    dictSetHashVal(ht, entry, val);
+    dictSetHashKey(d, entry, key);
+    dictSetHashVal(d, entry, val);
     ht->used++;
     return DICT_OK;
 }
@@ -230,82 +539,102 @@ int dictAdd(dict *ht, void *key, void *val)
  * Return 1 if the key was added from scratch, 0 if there was already an
  * element with such key and dictReplace() just performed a value update
  * operation. */
-int dictReplace(dict *ht, void *key, void *val)
+int dictReplace(dict *d, void *key, void *val)
 {
     dictEntry *entry;
 
     /* Try to add the element. If the key
      * does not exists dictAdd will suceed. */
-    if (dictAdd(ht, key, val) == DICT_OK)
+    if (dictAdd(d, key, val) == DICT_OK)
         return 1;
     /* It already exists, get the entry */
-    entry = dictFind(ht, key);
+    entry = dictFind(d, key);
     /* Free the old value and set the new one */
-    dictFreeEntryVal(ht, entry);
-    dictSetHashVal(ht, entry, val);
+    dictFreeEntryVal(d, entry);
+    dictSetHashVal(d, entry, val);
     return 0;
 }
 
 /* Search and remove an element */
-static int dictGenericDelete(dict *ht, const void *key, int nofree)
+static int dictGenericDelete(dict *d, const void *key, int nofree)
 {
-    unsigned int h;
+    unsigned int h, idx;
     dictEntry *he, *prevHe;
+    int table;
 
-    if (ht->size == 0)
-        return DICT_ERR;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    he = ht->table[h];
+    if (d->ht[0].size == 0) return DICT_ERR; /* d->ht[0].table is NULL */
+    if (d->openaddr) return _dictOaDelete(d, key, nofree);
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
 
-    prevHe = NULL;
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key)) {
-            /* Unlink the element from the list */
-            if (prevHe)
-                prevHe->next = he->next;
-            else
-                ht->table[h] = he->next;
-            if (!nofree) {
-                dictFreeEntryKey(ht, he);
-                dictFreeEntryVal(ht, he);
+    for (table = 0; table <= 1; table++) {
+        idx = h & d->ht[table].sizemask;
+        he = d->ht[table].table[idx];
+        prevHe = NULL;
+        while(he) {
+            if (dictCompareHashKeys(d, key, he->key)) {
+                /* Unlink the element from the list */
+                if (prevHe)
+                    prevHe->next = he->next;
+                else
+                    d->ht[table].table[idx] = he->next;
+                if (!nofree) {
+                    dictFreeEntryKey(d, he);
+                    dictFreeEntryVal(d, he);
+                }
+                _dictFreeEntry(d, he);
+                d->ht[table].used--;
+                if (dictSize(d) == 0) _dictReleaseSlabs(d);
+                return DICT_OK;
             }
-            _dictFree(he);
-            ht->used--;
-            return DICT_OK;
+            prevHe = he;
+            he = he->next;
         }
-        prevHe = he;
-        he = he->next;
+        if (!dictIsRehashing(d)) break;
     }
     return DICT_ERR; /* not found */
 }
 
-int dictDelete(dict *ht, const void *key) {
-    return dictGenericDelete(ht,key,0);
+int dictDelete(dict *d, const void *key) {
+    return dictGenericDelete(d,key,0);
 }
 
-int dictDeleteNoFree(dict *ht, const void *key) {
-    return dictGenericDelete(ht,key,1);
+int dictDeleteNoFree(dict *d, const void *key) {
+    return dictGenericDelete(d,key,1);
 }
 
 /* Destroy an entire hash table */
-int _dictClear(dict *ht)
+static int _dictClear(dict *d, dictht *ht)
 {
-    unsigned long i;
-
-    /* Free all the elements */
+    dictEntrySlab **sorted = NULL;
+    unsigned long i, count = 0;
+
+    /* Call the destructors of all the elements, and free the entries not
+     * allocated from a slab. The slab entries are freed with the slabs, so
+     * without destructors a dict that has only slab entries is not even
+     * visited. */
+    if (_dictLooseEntries(d)) sorted = _dictSortSlabs(d, &count);
+    if (d->slabs && !_dictLooseEntries(d) &&
+        !d->type->keyDestructor && !d->type->valDestructor) ht->used = 0;
     for (i = 0; i < ht->size && ht->used > 0; i++) {
         dictEntry *he, *nextHe;
 
         if ((he = ht->table[i]) == NULL) continue;
         while(he) {
             nextHe = he->next;
-            dictFreeEntryKey(ht, he);
-            dictFreeEntryVal(ht, he);
-            _dictFree(he);
+            dictFreeEntryKey(d, he);
+            dictFreeEntryVal(d, he);
+            if (d->slabs == NULL) {
+                _dictFree(he);
+            } else if (sorted && _dictIsLoose(sorted, count, he)) {
+                _dictFree(he);
+                d->slabs->looseentries--;
+            }
             ht->used--;
             he = nextHe;
         }
     }
+    if (sorted) _dictFree(sorted);
     /* Free the table and the allocated cache structure */
     _dictFree(ht->table);
     /* Re-initialize the table */
@@ -314,47 +643,112 @@ int _dictClear(dict *ht)
 }
 
 /* Clear & Release the hash table */
-void dictRelease(dict *ht)
+void dictRelease(dict *d)
 {
-    _dictClear(ht);
-    _dictFree(ht);
+    dictEmpty(d);
+    _dictFree(d);
 }
 
-dictEntry *dictFind(dict *ht, const void *key)
+dictEntry *dictFind(dict *d, const void *key)
 {
     dictEntry *he;
-    unsigned int h;
-
-    if (ht->size == 0) return NULL;
-    h = dictHashKey(ht, key) & ht->sizemask;
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return he;
-        he = he->next;
+    unsigned int h, idx, table;
+
+    if (d->ht[0].size == 0) return NULL; /* We don't have a table at all */
+    if (d->openaddr) return _dictOaFind(d, key);
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        idx = h & d->ht[table].sizemask;
+        he = d->ht[table].table[idx];
+        while(he) {
+            if (dictCompareHashKeys(d, key, he->key))
+                return he;
+            he = he->next;
+        }
+        if (!dictIsRehashing(d)) return NULL;
     }
     return NULL;
 }
 
-dictIterator *dictGetIterator(dict *ht)
+/* A fingerprint is a 64 bit number that represents the state of the
+ * dictionary at a given time, it's just a few dict properties xored
+ * together. When an unsafe iterator is initialized, we get the dict
+ * fingerprint, and check the fingerprint again when the iterator is
+ * released. If the two fingerprints are different it means that the user
+ * of the iterator performed forbidden operations against the dictionary
+ * while iterating, like a lookup that moved entries while rehashing. */
+static long long _dictFingerprint(dict *d) {
+    long long integers[6], hash = 0;
+    int j;
+
+    integers[0] = (long) d->ht[0].table;
+    integers[1] = d->ht[0].size;
+    integers[2] = d->ht[0].used;
+    integers[3] = (long) d->ht[1].table;
+    integers[4] = d->ht[1].size;
+    integers[5] = d->ht[1].used;
+
+    /* Result = hash(hash(hash(int1)+int2)+int3) ... using Tomas Wang's
+     * 64 bit integer hash. */
+    for (j = 0; j < 6; j++) {
+        hash += integers[j];
+        hash = (~hash) + (hash << 21); /* hash = (hash << 21) - hash - 1; */
+        hash = hash ^ (hash >> 24);
+        hash = (hash + (hash << 3)) + (hash << 8); /* hash * 265 */
+        hash = hash ^ (hash >> 14);
+        hash = (hash + (hash << 2)) + (hash << 4); /* hash * 21 */
+        hash = hash ^ (hash >> 28);
+        hash = hash + (hash << 31);
+    }
+    return hash;
+}
+
+dictIterator *dictGetIterator(dict *d)
 {
     dictIterator *iter = _dictAlloc(sizeof(*iter));
 
-    iter->ht = ht;
+    iter->d = d;
+    iter->table = 0;
     iter->index = -1;
+    iter->safe = 0;
     iter->entry = NULL;
     iter->nextEntry = NULL;
     return iter;
 }
 
+dictIterator *dictGetSafeIterator(dict *d) {
+    dictIterator *i = dictGetIterator(d);
+
+    i->safe = 1;
+    return i;
+}
+
 dictEntry *dictNext(dictIterator *iter)
 {
+    if (iter->index == -1 && iter->table == 0) {
+        if (iter->safe)
+            iter->d->iterators++; /* Pause the rehashing */
+        else
+            iter->fingerprint = _dictFingerprint(iter->d);
+    }
+    if (iter->d->openaddr) return _dictOaNext(iter);
+
     while (1) {
         if (iter->entry == NULL) {
+            dictht *ht = &iter->d->ht[iter->table];
+
             iter->index++;
-            if (iter->index >=
-                    (signed)iter->ht->size) break;
-            iter->entry = iter->ht->table[iter->index];
+            if (iter->index >= (signed) ht->size) {
+                if (dictIsRehashing(iter->d) && iter->table == 0) {
+                    iter->table++;
+                    iter->index = 0;
+                    ht = &iter->d->ht[1];
+                } else {
+                    break;
+                }
+            }
+            iter->entry = ht->table[iter->index];
         } else {
             iter->entry = iter->nextEntry;
         }
@@ -370,49 +764,178 @@ dictEntry *dictNext(dictIterator *iter)
 
 void dictReleaseIterator(dictIterator *iter)
 {
+    if (!(iter->index == -1 && iter->table == 0)) {
+        if (iter->safe)
+            iter->d->iterators--;
+        else
+            assert(iter->fingerprint == _dictFingerprint(iter->d));
+    }
     _dictFree(iter);
 }
 
 /* Return a random entry from the hash table. Useful to
  * implement randomized algorithms */
-dictEntry *dictGetRandomKey(dict *ht)
+dictEntry *dictGetRandomKey(dict *d)
 {
-    dictEntry *he;
-    unsigned int h;
+    dictEntry *he, *orighe;
+    unsigned long h;
     int listlen, listele;
 
-    if (ht->used == 0) return NULL;
-    do {
-        h = random() & ht->sizemask;
-        he = ht->table[h];
-    } while(he == NULL);
+    if (dictSize(d) == 0) return NULL;
+    if (d->openaddr) return _dictOaGetRandomKey(d);
+    if (dictIsRehashing(d)) _dictRehashStep(d);
+    if (dictIsRehashing(d)) {
+        /* The buckets of the old table below rehashidx are empty */
+        do {
+            h = d->rehashidx + (random() % (d->ht[0].size +
+                                            d->ht[1].size -
+                                            d->rehashidx));
+            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] :
+                                        d->ht[0].table[h];
+        } while(he == NULL);
+    } else {
+        do {
+            h = random() & d->ht[0].sizemask;
+            he = d->ht[0].table[h];
+        } while(he == NULL);
+    }
 
     /* Now we found a non empty bucket, but it is a linked
      * list and we need to get a random element from the list.
      * The only sane way to do so is to count the element and
      * select a random index. */
     listlen = 0;
+    orighe = he;
     while(he) {
         he = he->next;
         listlen++;
     }
     listele = random() % listlen;
-    he = ht->table[h];
+    he = orighe;
     while(listele--) he = he->next;
     return he;
 }
 
+/* Function to reverse bits. Algorithm from:
+ * http://graphics.stanford.edu/~seander/bithacks.html#ReverseParallel */
+static unsigned long rev(unsigned long v) {
+    unsigned long s = 8 * sizeof(v); /* bit size; must be power of 2 */
+    unsigned long mask = ~0UL;
+
+    while ((s >>= 1) > 0) {
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/* dictScan() is used to iterate over the elements of a dictionary without
+ * keeping any state between calls, so that the caller can return to the
+ * event loop between two calls.
+ *
+ * 1) Initially you call the function using a cursor (v) value of 0.
+ * 2) The function performs one step of the iteration, calling 'fn' for
+ *    every entry of the visited bucket(s), and returns the new cursor
+ *    value to use in the next call.
+ * 3) When the returned cursor is 0, the iteration is complete.
+ *
+ * Every element present in the dictionary from the start to the end of
+ * the iteration is returned at least once, even if the table is resized
+ * or rehashed between two calls. Elements may be returned more than once.
+ *
+ * The trick is to increment the high order bits of the cursor instead of
+ * the low order ones: the cursor is bit-reversed, incremented, and
+ * reversed again. With power of two tables a bucket of a table of size 2^N
+ * is expanded in the buckets sharing the same low N bits in the bigger
+ * table, so the buckets already visited stay "behind" the cursor whether
+ * the table grows or shrinks. While rehashing, the bucket of the smaller
+ * table is visited together with all its expansions in the bigger one. */
+unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn,
+                       void *privdata)
+{
+    dictht *t0, *t1;
+    const dictEntry *de;
+    unsigned long m0, m1;
+
+    if (dictSize(d) == 0) return 0;
+
+    if (!dictIsRehashing(d)) {
+        t0 = &(d->ht[0]);
+        m0 = t0->sizemask;
+
+        /* Emit entries at cursor */
+        if (d->openaddr) {
+            _dictOaScanSlot(d, v, fn, privdata);
+        } else {
+            de = t0->table[v & m0];
+            while (de) {
+                fn(privdata, de);
+                de = de->next;
+            }
+        }
+    } else {
+        t0 = &d->ht[0];
+        t1 = &d->ht[1];
+
+        /* Make sure t0 is the smaller and t1 is the bigger table */
+        if (t0->size > t1->size) {
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+        m0 = t0->sizemask;
+        m1 = t1->sizemask;
+
+        /* Emit entries at cursor */
+        de = t0->table[v & m0];
+        while (de) {
+            fn(privdata, de);
+            de = de->next;
+        }
+
+        /* Iterate over indices in larger table that are the expansion
+         * of the index pointed to by the cursor in the smaller table */
+        do {
+            /* Emit entries at cursor */
+            de = t1->table[v & m1];
+            while (de) {
+                fn(privdata, de);
+                de = de->next;
+            }
+
+            /* Increment bits not covered by the smaller mask */
+            v = (((v | m0) + 1) & ~m0) | (v & m0);
+
+            /* Continue while bits covered by mask difference is non-zero */
+        } while (v & (m0 ^ m1));
+    }
+
+    /* Set unmasked bits so incrementing the reversed cursor
+     * operates on the masked bits of the smaller table */
+    v |= ~m0;
+
+    /* Increment the reverse cursor */
+    v = rev(v);
+    v++;
+    v = rev(v);
+    return v;
+}
+
 /* ------------------------- private functions ------------------------------ */
 
 /* Expand the hash table if needed */
-static int _dictExpandIfNeeded(dict *ht)
+static int _dictExpandIfNeeded(dict *d)
 {
+    /* Incremental rehashing already in progress. Return. */
+    if (dictIsRehashing(d)) return DICT_OK;
+
     /* If the hash table is empty expand it to the intial size,
-     * if the table is "full" dobule its size. */
-    if (ht->size == 0)
-        return dictExpand(ht, DICT_HT_INITIAL_SIZE);
-    if (ht->used == ht->size)
-        return dictExpand(ht, ht->size*2);
+     * if the table is "full" dobule its size. After a shrink the elements
+     * added while rehashing may be many more than the buckets, so the new
+     * size is based on the elements, or dictExpand() would refuse it. */
+    if (d->ht[0].size == 0)
+        return dictExpand(d, DICT_HT_INITIAL_SIZE);
+    if (d->ht[0].used >= d->ht[0].size)
+        return dictExpand(d, d->ht[0].used*2);
     return DICT_OK;
 }
 
@@ -431,33 +954,48 @@ static unsigned long _dictNextPower(unsigned long size)
 
 /* Returns the index of a free slot that can be populated with
  * an hash entry for the given 'key'.
- * If the key already exists, -1 is returned. */
-static int _dictKeyIndex(dict *ht, const void *key)
+ * If the key already exists, -1 is returned.
+ *
+ * Note that if we are in the process of rehashing the hash table, the
+ * index is always returned in the context of the second (new) hash table. */
+static int _dictKeyIndex(dict *d, const void *key)
 {
-    unsigned int h;
+    unsigned int h, idx, table;
     dictEntry *he;
 
     /* Expand the hashtable if needed */
-    if (_dictExpandIfNeeded(ht) == DICT_ERR)
+    if (_dictExpandIfNeeded(d) == DICT_ERR)
         return -1;
     /* Compute the key hash value */
-    h = dictHashKey(ht, key) & ht->sizemask;
-    /* Search if this slot does not already contain the given key */
-    he = ht->table[h];
-    while(he) {
-        if (dictCompareHashKeys(ht, key, he->key))
-            return -1;
-        he = he->next;
+    h = dictHashKey(d, key);
+    for (table = 0; table <= 1; table++) {
+        idx = h & d->ht[table].sizemask;
+        /* Search if this slot does not already contain the given key */
+        he = d->ht[table].table[idx];
+        while(he) {
+            if (dictCompareHashKeys(d, key, he->key))
+                return -1;
+            he = he->next;
+        }
+        if (!dictIsRehashing(d)) break;
     }
-    return h;
+    return idx;
 }
 
-void dictEmpty(dict *ht) {
-    _dictClear(ht);
+void dictEmpty(dict *d) {
+    if (d->openaddr) {
+        _dictOaClear(d);
+    } else {
+        _dictClear(d,&d->ht[0]);
+        _dictClear(d,&d->ht[1]);
+    }
+    _dictReleaseSlabs(d);
+    d->rehashidx = -1;
+    d->iterators = 0;
 }
 
 #define DICT_STATS_VECTLEN 50
-void dictPrintStats(dict *ht) {
+static void _dictPrintStatsHt(dictht *ht) {
     unsigned long i, slots = 0, chainlen, maxchainlen = 0;
     unsigned long totchainlen = 0;
     unsigned long clvector[DICT_STATS_VECTLEN];
@@ -501,6 +1039,332 @@ void dictPrintStats(dict *ht) {
     }
 }
 
+void dictPrintStats(dict *d) {
+    if (d->openaddr) {
+        _dictOaPrintStats(d);
+        return;
+    }
+    _dictPrintStatsHt(&d->ht[0]);
+    if (dictIsRehashing(d)) {
+        printf("-- Rehashing into ht[1]:\n");
+        _dictPrintStatsHt(&d->ht[1]);
+    }
+}
+
+/* ------------------------- Open addressing tables ------------------------- */
+
+/* A dict created with dictCreateOpenAddressing() stores the entries
+ * directly in the table, using linear probing, instead of chaining
+ * dictEntry structures allocated one by one. Next to the slots there is an
+ * array of one byte fingerprints: seven bits of the hash of the key stored
+ * in the slot, so a lookup compares a key only when the fingerprint
+ * matches, and the slots array is scanned without following any pointer.
+ *
+ * Deleted slots are marked with a tombstone, so that the position of the
+ * other entries never changes until the table is rebuilt: the entries can
+ * be deleted while a safe iterator is running. The table is rebuilt in a
+ * single step when it grows, so this is only used for small dicts: when a
+ * dict gets more than dict_oa_max_used elements it is converted to the
+ * chained table, that is then resized incrementally. Open addressing dicts
+ * are never in the rehashing state.
+ *
+ * The home slot of a key is chosen with the hash function of the dictType,
+ * exactly like the bucket of a chained table, so a scan cursor stays valid
+ * across the conversion. Linear probing needs a hash function mixing all
+ * the bits, like the SipHash of dictGenHashFunction(). */
+
+#define DICT_OA_EMPTY 0
+#define DICT_OA_DELETED 1
+#define DICT_OA_MAX_USED 65536
+
+/* The same layout of the first two fields of a dictEntry: slots are
+ * returned to the caller as dictEntry pointers. Only the key and val
+ * fields must be accessed, and the pointer is no longer valid after the
+ * next insertion in the dict. */
+typedef struct dictSlot {
+    void *key;
+    void *val;
+} dictSlot;
+
+#define _dictOaSlots(ht) ((dictSlot*)(ht)->table)
+#define _dictOaFps(ht) ((unsigned char*)(_dictOaSlots(ht)+(ht)->size))
+#define _dictOaFp(h) ((unsigned char)(0x80|((h)>>25)))
+#define _dictOaIsUsed(fp) ((fp) & 0x80)
+
+static unsigned long dict_oa_max_used = DICT_OA_MAX_USED;
+
+dict *dictCreateOpenAddressing(dictType *type, void *privDataPtr)
+{
+    dict *d = dictCreate(type,privDataPtr);
+
+    d->openaddr = 1;
+    return d;
+}
+
+/* Change the number of elements after that an open addressing dict is
+ * converted to a chained one. */
+void dictSetOpenAddressingMaxUsed(unsigned long maxused) {
+    dict_oa_max_used = maxused;
+}
+
+/* Smallest table with a load factor <= 3/4 holding 'used' elements */
+static unsigned long _dictOaSizeFor(unsigned long used) {
+    return _dictNextPower(used+used/3+1);
+}
+
+/* Return the slot index of 'key' or -1 if the key is not there */
+static long _dictOaLookup(dict *d, const void *key, unsigned int h)
+{
+    dictht *ht = &d->ht[0];
+    dictSlot *slots;
+    unsigned char *fps, fp = _dictOaFp(h);
+    unsigned long idx = h & ht->sizemask;
+
+    if (ht->size == 0) return -1;
+    slots = _dictOaSlots(ht);
+    fps = _dictOaFps(ht);
+    while(fps[idx] != DICT_OA_EMPTY) {
+        if (fps[idx] == fp && dictCompareHashKeys(d, key, slots[idx].key))
+            return idx;
+        idx = (idx+1) & ht->sizemask;
+    }
+    return -1;
+}
+
+static dictEntry *_dictOaFind(dict *d, const void *key)
+{
+    long idx = _dictOaLookup(d, key, dictHashKey(d, key));
+
+    return (idx == -1) ? NULL : (dictEntry*) (_dictOaSlots(&d->ht[0])+idx);
+}
+
+/* Insert in a table known not to contain the key, nor tombstones */
+static void _dictOaInsertNew(dictht *ht, void *key, void *val, unsigned int h)
+{
+    dictSlot *slots = _dictOaSlots(ht);
+    unsigned char *fps = _dictOaFps(ht);
+    unsigned long idx = h & ht->sizemask;
+
+    while(fps[idx] != DICT_OA_EMPTY) idx = (idx+1) & ht->sizemask;
+    fps[idx] = _dictOaFp(h);
+    slots[idx].key = key;
+    slots[idx].val = val;
+    ht->used++;
+}
+
+/* Rebuild the table with 'size' slots, dropping the tombstones */
+static void _dictOaRebuild(dict *d, unsigned long size)
+{
+    dictht n, *ht = &d->ht[0];
+    unsigned long j;
+
+    /* Moving the entries would break the running safe iterators */
+    assert(d->iterators == 0);
+    n.size = size;
+    n.sizemask = size-1;
+    n.used = 0;
+    n.table = _dictAllocZeroed(size*(sizeof(dictSlot)+1));
+    for (j = 0; j < ht->size; j++) {
+        dictSlot *s = _dictOaSlots(ht)+j;
+
+        if (!_dictOaIsUsed(_dictOaFps(ht)[j])) continue;
+        _dictOaInsertNew(&n, s->key, s->val, dictHashKey(d, s->key));
+    }
+    if (ht->table) _dictFree(ht->table);
+    *ht = n;
+    d->tombstones = 0;
+}
+
+/* Convert the dict to a chained one with room for at least 'size'
+ * elements, see dict_oa_max_used */
+static void _dictOaToChained(dict *d, unsigned long size)
+{
+    dictht oa = d->ht[0];
+    dictht *ht = &d->ht[0];
+    unsigned long j;
+
+    assert(d->iterators == 0);
+    _dictReset(ht);
+    d->openaddr = 0;
+    d->tombstones = 0;
+    dictExpand(d, (size > oa.used*2) ? size : oa.used*2);
+    for (j = 0; j < oa.size; j++) {
+        dictSlot *s = _dictOaSlots(&oa)+j;
+        dictEntry *he;
+        unsigned int h;
+
+        if (!_dictOaIsUsed(_dictOaFps(&oa)[j])) continue;
+        h = dictHashKey(d, s->key) & ht->sizemask;
+        he = _dictAllocEntry(d);
+        he->key = s->key;
+        he->val = s->val;
+        he->next = ht->table[h];
+        ht->table[h] = he;
+        ht->used++;
+    }
+    _dictFree(oa.table);
+}
+
+static int _dictOaExpand(dict *d, unsigned long size)
+{
+    if (size > dict_oa_max_used) {
+        _dictOaToChained(d, size);
+        return DICT_OK;
+    }
+    if (d->ht[0].used > size) return DICT_ERR;
+    _dictOaRebuild(d, _dictOaSizeFor(size));
+    return DICT_OK;
+}
+
+static int _dictOaAdd(dict *d, void *key, void *val)
+{
+    dictht *ht = &d->ht[0];
+    unsigned int h = dictHashKey(d, key);
+    unsigned long idx, freeidx = 0;
+    int hasfree = 0;
+    dictSlot *slots;
+    unsigned char *fps, fp = _dictOaFp(h);
+
+    /* Grow (or just drop the tombstones) keeping the load <= 3/4 */
+    if ((ht->used+d->tombstones+1)*4 > ht->size*3) {
+        if (ht->used+1 > dict_oa_max_used) {
+            _dictOaToChained(d, 0);
+            return dictAdd(d, key, val);
+        }
+        _dictOaRebuild(d, _dictOaSizeFor(ht->used+1));
+    }
+
+    slots = _dictOaSlots(ht);
+    fps = _dictOaFps(ht);
+    idx = h & ht->sizemask;
+    while(fps[idx] != DICT_OA_EMPTY) {
+        if (fps[idx] == fp && dictCompareHashKeys(d, key, slots[idx].key))
+            return DICT_ERR;
+        if (fps[idx] == DICT_OA_DELETED && !hasfree) {
+            freeidx = idx;
+            hasfree = 1;
+        }
+        idx = (idx+1) & ht->sizemask;
+    }
+    /* Reuse the first tombstone found in the probe sequence, if any */
+    if (hasfree) {
+        idx = freeidx;
+        d->tombstones--;
+    }
+    fps[idx] = fp;
+    dictSetHashKey(d, (slots+idx), key);
+    dictSetHashVal(d, (slots+idx), val);
+    ht->used++;
+    return DICT_OK;
+}
+
+static int _dictOaDelete(dict *d, const void *key, int nofree)
+{
+    dictht *ht = &d->ht[0];
+    long idx = _dictOaLookup(d, key, dictHashKey(d, key));
+    dictSlot *s;
+
+    if (idx == -1) return DICT_ERR;
+    s = _dictOaSlots(ht)+idx;
+    if (!nofree) {
+        dictFreeEntryKey(d, s);
+        dictFreeEntryVal(d, s);
+    }
+    _dictOaFps(ht)[idx] = DICT_OA_DELETED;
+    ht->used--;
+    d->tombstones++;
+    return DICT_OK;
+}
+
+static void _dictOaClear(dict *d)
+{
+    dictht *ht = &d->ht[0];
+    unsigned long j;
+
+    for (j = 0; j < ht->size && ht->used > 0; j++) {
+        dictSlot *s = _dictOaSlots(ht)+j;
+
+        if (!_dictOaIsUsed(_dictOaFps(ht)[j])) continue;
+        dictFreeEntryKey(d, s);
+        dictFreeEntryVal(d, s);
+        ht->used--;
+    }
+    if (ht->table) _dictFree(ht->table);
+    _dictReset(ht);
+    d->tombstones = 0;
+}
+
+static dictEntry *_dictOaNext(dictIterator *iter)
+{
+    dictht *ht = &iter->d->ht[0];
+
+    while(++iter->index < (signed) ht->size) {
+        if (_dictOaIsUsed(_dictOaFps(ht)[iter->index]))
+            return (dictEntry*) (_dictOaSlots(ht)+iter->index);
+    }
+    return NULL;
+}
+
+static dictEntry *_dictOaGetRandomKey(dict *d)
+{
+    dictht *ht = &d->ht[0];
+    unsigned long idx;
+
+    do {
+        idx = random() & ht->sizemask;
+    } while(!_dictOaIsUsed(_dictOaFps(ht)[idx]));
+    return (dictEntry*) (_dictOaSlots(ht)+idx);
+}
+
+/* The scan cursor addresses home slots like it addresses the buckets of a
+ * chained table. Home slots and buckets use the same hash bits, so the
+ * same guarantees hold across resizes, and across the conversion to a
+ * chained table. All the entries with the home slot 'v' are in the run of
+ * non empty slots starting at 'v'. */
+static void _dictOaScanSlot(dict *d, unsigned long v, dictScanFunction *fn,
+                            void *privdata)
+{
+    dictht *ht = &d->ht[0];
+    unsigned char *fps = _dictOaFps(ht);
+    unsigned long home = v & ht->sizemask, idx = home;
+
+    while(fps[idx] != DICT_OA_EMPTY) {
+        dictSlot *s = _dictOaSlots(ht)+idx;
+
+        if (fps[idx] != DICT_OA_DELETED &&
+            (dictHashKey(d, s->key) & ht->sizemask) == home)
+            fn(privdata, (dictEntry*) s);
+        idx = (idx+1) & ht->sizemask;
+    }
+}
+
+static void _dictOaPrintStats(dict *d)
+{
+    dictht *ht = &d->ht[0];
+    unsigned long j, probes = 0, maxprobes = 0;
+
+    if (ht->used == 0) {
+        printf("No stats available for empty dictionaries\n");
+        return;
+    }
+    for (j = 0; j < ht->size; j++) {
+        dictSlot *s = _dictOaSlots(ht)+j;
+        unsigned long home, dist;
+
+        if (!_dictOaIsUsed(_dictOaFps(ht)[j])) continue;
+        home = dictHashKey(d, s->key) & ht->sizemask;
+        dist = (j-home) & ht->sizemask;
+        probes += dist+1;
+        if (dist+1 > maxprobes) maxprobes = dist+1;
+    }
+    printf("Open addressing hash table stats:\n");
+    printf(" table size: %ld\n", ht->size);
+    printf(" number of elements: %ld\n", ht->used);
+    printf(" tombstones: %ld\n", d->tombstones);
+    printf(" avg probes per lookup: %.02f\n", (float)probes/ht->used);
+    printf(" max probes per lookup: %ld\n", maxprobes);
+}
+
 /* ----------------------- StringCopy Hash Table Type ------------------------*/
 
 static unsigned int _dictStringCopyHTHashFunction(const void *key)
@@ -582,3 +1446,218 @@ dictType dictTypeHeapStringCopyKeyValue = {
     _dictStringCopyHTKeyDestructor,       /* key destructor */
     _dictStringKeyValCopyHTValDestructor, /* val destructor */
 };
+
+#ifdef DICT_BENCHMARK_MAIN
+/* Chained vs open addressing microbenchmark. Build it with
+ * 'make dict-benchmark' and run it as './dict-benchmark <count>'.
+ *
+ * The same keys are inserted in a chained and in an open addressing dict
+ * (with the conversion threshold disabled), then we report the memory used
+ * by the table for every element, and the cost of successful and failed
+ * lookups.
+ *
+ * './dict-benchmark hash' compares instead the hash function against the
+ * djb hash used before: speed, distribution of the keys in the buckets,
+ * and insertion of keys crafted to collide with djb. */
+static long long ustime(void) {
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000+tv.tv_usec;
+}
+
+/* The hash function used by Redis up to 1.3 */
+static unsigned int djbHashFunction(const unsigned char *buf, int len) {
+    unsigned int hash = 5381;
+
+    while (len--)
+        hash = ((hash << 5) + hash) + (*buf++); /* hash * 33 + c */
+    return hash;
+}
+
+static unsigned int (*benchHashFunction)(const unsigned char *buf, int len) =
+    dictGenHashFunction;
+
+static unsigned int benchHash(const void *key) {
+    return benchHashFunction(key, strlen(key));
+}
+
+static int benchKeyCompare(void *privdata, const void *key1,
+        const void *key2)
+{
+    DICT_NOTUSED(privdata);
+    return strcmp(key1, key2) == 0;
+}
+
+static dictType benchDictType = {
+    benchHash,                  /* hash function */
+    NULL,                       /* key dup */
+    NULL,                       /* val dup */
+    benchKeyCompare,            /* key compare */
+    NULL,                       /* key destructor */
+    NULL                        /* val destructor */
+};
+
+static void benchDict(const char *name, dict *d, char **keys, char **misses,
+        long count)
+{
+    size_t mem = zmalloc_used_memory();
+    long long start, elapsed;
+    long j, found = 0;
+
+    start = ustime();
+    for (j = 0; j < count; j++) dictAdd(d, keys[j], NULL);
+    elapsed = ustime()-start;
+    /* Let a chained dict finish rehashing before looking up. */
+    while (dictIsRehashing(d)) dictRehash(d, 1000);
+    mem = zmalloc_used_memory()-mem;
+    printf("%-8s %9ld elements: %6.2f bytes/element, add %7.1f ns",
+        name, count, (double)mem/count, (double)elapsed*1000/count);
+
+    start = ustime();
+    for (j = 0; j < count; j++) if (dictFind(d, keys[j])) found++;
+    elapsed = ustime()-start;
+    printf(", hit %7.1f ns", (double)elapsed*1000/count);
+
+    start = ustime();
+    for (j = 0; j < count; j++) if (dictFind(d, misses[j])) found++;
+    elapsed = ustime()-start;
+    printf(", miss %7.1f ns\n", (double)elapsed*1000/count);
+    assert(found == count);
+    dictRelease(d);
+}
+
+static void benchHashSpeed(const char *name,
+        unsigned int (*hash)(const unsigned char *buf, int len))
+{
+    static const int lens[] = {8, 16, 40, 100};
+    unsigned char buf[100];
+    volatile unsigned int sink = 0;
+    long long start, elapsed;
+    int iterations = 10000000, i, j;
+
+    for (j = 0; j < (int) sizeof(buf); j++) buf[j] = 'a'+(j%26);
+    printf("%-8s", name);
+    for (i = 0; i < 4; i++) {
+        start = ustime();
+        for (j = 0; j < iterations; j++) {
+            buf[0] = j;
+            sink ^= hash(buf, lens[i]);
+        }
+        elapsed = ustime()-start;
+        printf("  %3d bytes %5.1f ns", lens[i],
+            (double)elapsed*1000/iterations);
+    }
+    printf("\n");
+}
+
+/* Put 'count' keys "<prefix><number>" in as many buckets, and report the
+ * empty buckets (36.8% with a perfect random function) and the longest
+ * bucket. */
+static void benchHashDistribution(const char *name,
+        unsigned int (*hash)(const unsigned char *buf, int len),
+        const char *prefix, long count)
+{
+    unsigned long size = _dictNextPower(count), j, empty = 0, max = 0;
+    unsigned int *buckets = zcalloc(sizeof(unsigned int)*size);
+    char buf[128];
+
+    for (j = 0; j < (unsigned long) count; j++) {
+        int len = snprintf(buf, sizeof(buf), "%s%lu", prefix, j);
+
+        buckets[hash((unsigned char*)buf, len) & (size-1)]++;
+    }
+    for (j = 0; j < size; j++) {
+        if (buckets[j] == 0) empty++;
+        if (buckets[j] > max) max = buckets[j];
+    }
+    printf("%-8s %-16.16s %ld keys in %lu buckets: %4.1f%% empty, "
+           "longest bucket %lu\n", name, prefix, count, size,
+           (double)empty*100/size, max);
+    zfree(buckets);
+}
+
+/* "Ab" and "BA" have the same djb hash, so all the 2^n strings made of n
+ * of these blocks collide. Every insertion has to compare the key with
+ * all the others in the bucket. */
+static void benchHashFlood(const char *name,
+        unsigned int (*hash)(const unsigned char *buf, int len), int blocks)
+{
+    dict *d = dictCreate(&benchDictType, NULL);
+    long count = 1L << blocks, j;
+    char **keys = zmalloc(sizeof(char*)*count);
+    long long start, elapsed;
+    int b;
+
+    for (j = 0; j < count; j++) {
+        keys[j] = zmalloc(blocks*2+1);
+        for (b = 0; b < blocks; b++)
+            memcpy(keys[j]+b*2, (j & (1L<<b)) ? "Ab" : "BA", 2);
+        keys[j][blocks*2] = '\0';
+    }
+    benchHashFunction = hash;
+    start = ustime();
+    for (j = 0; j < count; j++) dictAdd(d, keys[j], NULL);
+    elapsed = ustime()-start;
+    benchHashFunction = dictGenHashFunction;
+    printf("%-8s %ld colliding keys inserted in %.3f seconds\n",
+        name, count, (double)elapsed/1000000);
+    dictRelease(d);
+    for (j = 0; j < count; j++) zfree(keys[j]);
+    zfree(keys);
+}
+
+static void benchHashFunctions(void) {
+    uint8_t seed[16];
+    int j;
+
+    srand(1234);
+    for (j = 0; j < 16; j++) seed[j] = rand();
+    dictSetHashFunctionSeed(seed);
+    benchHashSpeed("djb", djbHashFunction);
+    benchHashSpeed("siphash", dictGenHashFunction);
+    benchHashDistribution("djb", djbHashFunction, "", 1000000);
+    benchHashDistribution("siphash", dictGenHashFunction, "", 1000000);
+    benchHashDistribution("djb", djbHashFunction, "user:session:", 1000000);
+    benchHashDistribution("siphash", dictGenHashFunction, "user:session:",
+        1000000);
+    benchHashFlood("djb", djbHashFunction, 15);
+    benchHashFlood("siphash", dictGenHashFunction, 15);
+}
+
+int main(int argc, char **argv) {
+    long count;
+    char **keys, **misses;
+    char buf[64];
+    long j;
+
+    if (argc > 1 && !strcmp(argv[1], "hash")) {
+        benchHashFunctions();
+        return 0;
+    }
+    count = (argc > 1) ? atol(argv[1]) : 1000000;
+    keys = zmalloc(sizeof(char*)*count);
+    misses = zmalloc(sizeof(char*)*count);
+    srand(1234);
+    for (j = 0; j < count; j++) {
+        snprintf(buf, sizeof(buf), "element:%ld", j);
+        keys[j] = zstrdup(buf);
+        snprintf(buf, sizeof(buf), "missing:%ld", j);
+        misses[j] = zstrdup(buf);
+    }
+    /* Shuffle the lookup order so that we don't walk the table in the
+     * same order the elements were inserted. */
+    for (j = count-1; j > 0; j--) {
+        long r = rand() % (j+1);
+        char *tmp = keys[j];
+
+        keys[j] = keys[r];
+        keys[r] = tmp;
+    }
+    dictSetOpenAddressingMaxUsed(ULONG_MAX);
+    benchDict("chained", dictCreate(&benchDictType, NULL), keys, misses, count);
+    benchDict("openaddr", dictCreateOpenAddressing(&benchDictType, NULL),
+        keys, misses, count);
+    return 0;
+}
+#endif
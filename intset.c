@@ -0,0 +1,236 @@
+/* Sorted set of integers, used as a memory efficient encoding for Redis
+ * Sets only composed of integers.
+ *
+ * The integers are stored in ascending order in a single allocation, all
+ * with the same size: 16, 32 or 64 bits, the smallest able to hold every
+ * element. When an element that does not fit is added the whole set is
+ * upgraded in place to the bigger encoding. Sets are never downgraded.
+ *
+ * Lookups are O(log(N)) binary searches, insertions and deletions are
+ * O(N) because of the memmove() of the tail and the realloc(), so this is
+ * only used for small sets (see set-max-intset-entries in redis.conf).
+ *
+ * Copyright (c) 2010, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "intset.h"
+#include "zmalloc.h"
+
+#define INTSET_ENC_INT16 (sizeof(int16_t))
+#define INTSET_ENC_INT32 (sizeof(int32_t))
+#define INTSET_ENC_INT64 (sizeof(int64_t))
+
+/* Return the smallest encoding able to hold 'v' */
+static uint8_t _intsetValueEncoding(int64_t v) {
+    if (v < INT32_MIN || v > INT32_MAX)
+        return INTSET_ENC_INT64;
+    else if (v < INT16_MIN || v > INT16_MAX)
+        return INTSET_ENC_INT32;
+    return INTSET_ENC_INT16;
+}
+
+/* Return the element at 'pos' using the encoding 'enc' */
+static int64_t _intsetGetEncoded(intset *is, int pos, uint8_t enc) {
+    if (enc == INTSET_ENC_INT64)
+        return ((int64_t*)is->contents)[pos];
+    else if (enc == INTSET_ENC_INT32)
+        return ((int32_t*)is->contents)[pos];
+    return ((int16_t*)is->contents)[pos];
+}
+
+static int64_t _intsetGet(intset *is, int pos) {
+    return _intsetGetEncoded(is,pos,is->encoding);
+}
+
+static void _intsetSet(intset *is, int pos, int64_t value) {
+    if (is->encoding == INTSET_ENC_INT64)
+        ((int64_t*)is->contents)[pos] = value;
+    else if (is->encoding == INTSET_ENC_INT32)
+        ((int32_t*)is->contents)[pos] = value;
+    else
+        ((int16_t*)is->contents)[pos] = value;
+}
+
+static intset *_intsetResize(intset *is, uint32_t len) {
+    return zrealloc(is,sizeof(intset)+(size_t)len*is->encoding);
+}
+
+/* Search for 'value'. Return 1 if it is found, with *pos set to its
+ * position, otherwise return 0 with *pos set to the position where the
+ * value should be inserted. */
+static int _intsetSearch(intset *is, int64_t value, uint32_t *pos) {
+    int min = 0, max = is->length-1, mid = -1;
+    int64_t cur = -1;
+
+    if (is->length == 0) {
+        if (pos) *pos = 0;
+        return 0;
+    }
+    /* The value can't be found if it's out of the range of the set, and
+     * appending at the end is the common case of growing IDs. */
+    if (value > _intsetGet(is,max)) {
+        if (pos) *pos = is->length;
+        return 0;
+    } else if (value < _intsetGet(is,0)) {
+        if (pos) *pos = 0;
+        return 0;
+    }
+
+    while(max >= min) {
+        mid = (min+max)/2;
+        cur = _intsetGet(is,mid);
+        if (value > cur) {
+            min = mid+1;
+        } else if (value < cur) {
+            max = mid-1;
+        } else {
+            break;
+        }
+    }
+
+    if (value == cur) {
+        if (pos) *pos = mid;
+        return 1;
+    } else {
+        if (pos) *pos = min;
+        return 0;
+    }
+}
+
+/* Upgrade the set to the encoding of 'value', that does not fit the
+ * current one, and add it. The value is either smaller or greater than
+ * every other element so it goes at the head or at the tail. */
+static intset *_intsetUpgradeAndAdd(intset *is, int64_t value) {
+    uint8_t curenc = is->encoding;
+    uint8_t newenc = _intsetValueEncoding(value);
+    int length = is->length;
+    int prepend = value < 0 ? 1 : 0;
+
+    is->encoding = newenc;
+    is = _intsetResize(is,is->length+1);
+
+    /* Convert from the tail, so that we don't overwrite the elements
+     * still to convert. */
+    while(length--)
+        _intsetSet(is,length+prepend,_intsetGetEncoded(is,length,curenc));
+
+    if (prepend)
+        _intsetSet(is,0,value);
+    else
+        _intsetSet(is,is->length,value);
+    is->length++;
+    return is;
+}
+
+/* Move the elements from 'from' to the end one position ahead (or back) */
+static void _intsetMoveTail(intset *is, uint32_t from, uint32_t to) {
+    uint32_t count = is->length-from;
+    size_t size = is->encoding;
+
+    memmove(is->contents+to*size,is->contents+from*size,count*size);
+}
+
+/* Create an empty intset */
+intset *intsetNew(void) {
+    intset *is = zmalloc(sizeof(intset));
+
+    is->encoding = INTSET_ENC_INT16;
+    is->length = 0;
+    return is;
+}
+
+/* Add 'value' to the set. *success is set to 0 if the value was already
+ * a member. The set may be reallocated so the new pointer is returned. */
+intset *intsetAdd(intset *is, int64_t value, int *success) {
+    uint8_t valenc = _intsetValueEncoding(value);
+    uint32_t pos;
+
+    if (success) *success = 1;
+    if (valenc > is->encoding)
+        return _intsetUpgradeAndAdd(is,value);
+
+    if (_intsetSearch(is,value,&pos)) {
+        if (success) *success = 0;
+        return is;
+    }
+    is = _intsetResize(is,is->length+1);
+    if (pos < is->length) _intsetMoveTail(is,pos,pos+1);
+    _intsetSet(is,pos,value);
+    is->length++;
+    return is;
+}
+
+/* Remove 'value' from the set. *success is set to 0 if it was not a
+ * member. The set may be reallocated so the new pointer is returned. */
+intset *intsetRemove(intset *is, int64_t value, int *success) {
+    uint8_t valenc = _intsetValueEncoding(value);
+    uint32_t pos;
+
+    if (success) *success = 0;
+    if (valenc <= is->encoding && _intsetSearch(is,value,&pos)) {
+        if (success) *success = 1;
+        if (pos < is->length-1) _intsetMoveTail(is,pos+1,pos);
+        is = _intsetResize(is,is->length-1);
+        is->length--;
+    }
+    return is;
+}
+
+/* Return 1 if 'value' is a member of the set */
+int intsetFind(intset *is, int64_t value) {
+    uint8_t valenc = _intsetValueEncoding(value);
+
+    return valenc <= is->encoding && _intsetSearch(is,value,NULL);
+}
+
+/* Return a random member. The set must not be empty. */
+int64_t intsetRandom(intset *is) {
+    return _intsetGet(is,rand()%is->length);
+}
+
+/* Set *value to the element at 'pos' and return 1, or return 0 if 'pos'
+ * is out of range. Elements are returned in ascending order. */
+int intsetGet(intset *is, uint32_t pos, int64_t *value) {
+    if (pos < is->length) {
+        *value = _intsetGet(is,pos);
+        return 1;
+    }
+    return 0;
+}
+
+uint32_t intsetLen(intset *is) {
+    return is->length;
+}
+
+/* Bytes used by the set */
+size_t intsetBlobLen(intset *is) {
+    return sizeof(intset)+(size_t)is->length*is->encoding;
+}
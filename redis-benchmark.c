@@ -490,7 +490,7 @@ int main(int argc, char **argv) {
     config.numclients = 50;
     config.requests = 10000;
     config.liveclients = 0;
-    config.el = aeCreateEventLoop();
+    config.el = aeCreateEventLoop(1024);
     config.keepalive = 1;
     config.donerequests = 0;
     config.datasize = 3;
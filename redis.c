@@ -74,6 +74,12 @@
 #include "zmalloc.h" /* total memory usage aware version of malloc/free */
 #include "lzf.h"    /* LZF compression library */
 #include "pqsort.h" /* Partial qsort for SORT+LIMIT */
+#include "intset.h" /* Compact sets of integers */
+#include "ziplist.h" /* Compact lists */
+#include "chunklist.h" /* Lists of ziplists */
+#ifdef USE_ARENA
+#include "arena.h" /* Size class allocator behind zmalloc */
+#endif
 
 /* Error codes */
 #define REDIS_OK                0
@@ -82,17 +88,43 @@
 /* Static server configuration */
 #define REDIS_SERVERPORT        6379    /* TCP port */
 #define REDIS_MAXIDLETIME       (60*5)  /* default client timeout */
-#define REDIS_IOBUF_LEN         1024
+#define REDIS_IOBUF_LEN         (1024*16)
 #define REDIS_LOADBUF_LEN       1024
 #define REDIS_STATIC_ARGS       4
 #define REDIS_DEFAULT_DBNUM     16
 #define REDIS_CONFIGLINE_MAX    1024
 #define REDIS_OBJFREELIST_MAX   1000000 /* Max number of objects to cache */
+#define REDIS_OBJCACHE_SIZE     128     /* Default objects per thread cache */
+#define REDIS_SET_MAX_INTSET_ENTRIES 512 /* Bigger intset sets become dicts */
+#define REDIS_LIST_MAX_ZIPLIST_ENTRIES 128 /* Bigger ziplists become lists */
+#define REDIS_LIST_MAX_ZIPLIST_VALUE 64 /* Max ziplist element length */
+#define REDIS_SHARED_INTEGERS 10000 /* Integers 0..N-1 are shared objects */
 #define REDIS_MAX_SYNC_TIME     60      /* Slave can't take more to sync */
 #define REDIS_EXPIRELOOKUPS_PER_CRON    100 /* try to expire 100 keys/second */
 #define REDIS_MAX_WRITE_PER_EVENT (1024*64)
+#define REDIS_MAX_READ_PER_EVENT (1024*64)
+#define REDIS_ACCEPT_BATCH 64   /* connections accepted per accept loop step */
+#define REDIS_MAX_ACCEPTS_PER_CALL 1000 /* max connections accepted per event */
 #define REDIS_REQUEST_MAX_SIZE (1024*1024*256) /* max bytes in inline command */
-
+/* Bulk arguments of at least this size are read in a query buffer of their
+ * own, that becomes the argument object without copying it */
+#define REDIS_MBULK_BIG_ARG     (1024*32)
+/* The event loop is sized for maxclients plus this number of fds, used for
+ * the listening socket, AOF, swap file, VM pipes, replication and so forth.
+ * Without a maxclients limit REDIS_EVENTLOOP_SETSIZE is used and the tables
+ * will grow as needed. */
+#define REDIS_EVENTLOOP_FDSET_INCR 32
+#define REDIS_EVENTLOOP_SETSIZE 1024
+
+/* Size of the per client static reply buffer (five ethernet frames). Small
+ * replies are copied there, the c->reply list is used when it is full. */
+#define REDIS_REPLY_CHUNK_BYTES     (5*1500)
+/* Integer replies, bulk and multi bulk lengths from 0 to this value minus
+ * one are sent using preformatted shared objects */
+#define REDIS_SHARED_HDR_LEN        256
+/* Reference count of the objects that are never freed: incrRefCount() and
+ * decrRefCount() don't touch it, so they can be used by any thread */
+#define REDIS_SHARED_REFCOUNT       INT_MAX
 /* If more then REDIS_WRITEV_THRESHOLD write packets are pending use writev */
 #define REDIS_WRITEV_THRESHOLD      3
 /* Max number of iovecs used for each writev call */
@@ -122,8 +154,22 @@
 /* Objects encoding */
 #define REDIS_ENCODING_RAW 0    /* Raw representation */
 #define REDIS_ENCODING_INT 1    /* Encoded as integer */
+#define REDIS_ENCODING_HT 2     /* Encoded as hash table */
+#define REDIS_ENCODING_INTSET 3 /* Encoded as intset */
+#define REDIS_ENCODING_CHUNKLIST 4 /* Encoded as list of ziplists */
+#define REDIS_ENCODING_ZIPLIST 5 /* Encoded as ziplist */
+#define REDIS_ENCODING_EMBSTR 6 /* Raw string in the object allocation */
+
+/* Strings up to this length are allocated in a single block with their
+ * object, see createEmbeddedStringObject() */
+#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 39
+
+/* String objects whose ptr is an sds string */
+#define sdsEncodedObject(_o) \
+    ((_o)->encoding == REDIS_ENCODING_RAW || (_o)->encoding == REDIS_ENCODING_EMBSTR)
 
 /* Object types only used for dumping to disk */
+#define REDIS_RESIZEDB 252
 #define REDIS_EXPIRETIME 253
 #define REDIS_SELECTDB 254
 #define REDIS_EOF 255
@@ -173,6 +219,30 @@
  * in order to take effect. */
 #define REDIS_MAX_COMPLETED_JOBS_PROCESSED 1
 
+/* Network I/O threads. Below REDIS_NETIO_MIN_CLIENTS_PER_THREAD pending
+ * clients per thread the main thread handles the sockets alone, as waking
+ * up the threads would cost more than the I/O itself. */
+#define REDIS_NETIO_MAX_THREADS 64
+#define REDIS_NETIO_MIN_CLIENTS_PER_THREAD 2
+#define REDIS_NETIO_OP_READ 0
+#define REDIS_NETIO_OP_WRITE 1
+
+/* Max number of processes sharing the listening port, see listen-workers */
+#define REDIS_MAX_LISTEN_WORKERS 64
+
+/* Return values of parseQueryBuffer() */
+#define REDIS_PARSE_INCOMPLETE 0    /* More data is needed */
+#define REDIS_PARSE_COMMAND 1       /* A full command is in argc/argv */
+#define REDIS_PARSE_ERROR 2         /* Protocol error, see c->parseerr */
+/* Max argv slots allocated in advance for a multi bulk command, and max
+ * argv size kept allocated across commands */
+#define REDIS_ARGV_PREALLOC_MAX 1024
+
+/* Result of the socket I/O performed by a network I/O thread */
+#define REDIS_IOSTATUS_OK 0
+#define REDIS_IOSTATUS_EOF 1
+#define REDIS_IOSTATUS_ERR 2
+
 /* Client flags */
 #define REDIS_CLOSE 1       /* This client connection should be closed ASAP */
 #define REDIS_SLAVE 2       /* This client is a slave server */
@@ -181,6 +251,9 @@
 #define REDIS_MULTI 16      /* This client is in a MULTI context */
 #define REDIS_BLOCKED 32    /* The client is waiting in a blocking operation */
 #define REDIS_IO_WAIT 64    /* The client is waiting for Virtual Memory I/O */
+#define REDIS_PENDING_READ 128  /* Socket to be read by the network I/O threads */
+#define REDIS_PENDING_WRITE 256 /* Replies to be written by the I/O threads */
+#define REDIS_PENDING_COMMAND 512 /* argv was already parsed by an I/O thread */
 
 /* Slave replication state - slave side */
 #define REDIS_REPL_NONE 0   /* No active replication */
@@ -312,9 +385,11 @@ typedef struct redisClient {
 	int dictid;
 	// 客户端请求缓冲区
 	sds querybuf;
+	size_t qbpos;           /* Parse offset, querybuf before it is consumed */
 	// 保存当前解析请求的参数
-	robj **argv, **mbargv;
-	int argc, mbargc;
+	robj **argv;
+	int argc;
+	int argvlen;            /* Allocated slots in argv, reused across commands */
 	int bulklen;            /* bulk read len. -1 if not in bulk read mode */
 	int multibulk;          /* multi bulk command format active */
 	// 待发给客户端的应答
@@ -343,6 +418,17 @@ typedef struct redisClient {
                              * is >= blockingto then the operation timed out. */
 	list *io_keys;          /* Keys this client is waiting to be loaded from the
                              * swap file in order to continue. */
+	/* State exchanged with the network I/O threads */
+	int iostatus;           /* REDIS_IOSTATUS_* of the last threaded read/write */
+	int ioerrno;            /* errno if iostatus is REDIS_IOSTATUS_ERR */
+	int iowrittenobjs;      /* Reply objects fully written by the I/O thread */
+	int parsestatus;        /* parseQueryBuffer() result if REDIS_PENDING_COMMAND */
+	char *parseerr;         /* Error reply for REDIS_PARSE_ERROR, NULL = close */
+	/* Static reply buffer, sent before the c->reply list. c->sentlen is
+	 * the offset of the data already sent of the buffer, while it is not
+	 * empty, otherwise of the first object of the list. */
+	int bufpos;
+	char buf[REDIS_REPLY_CHUNK_BYTES];
 } redisClient;
 
 /*
@@ -364,6 +450,8 @@ struct redisServer {
 	dict *sharingpool;          /* Poll used for object sharing */
 	// 共享对象池的大小
 	unsigned int sharingpoolsize;
+	// 命令表的哈希索引，命令名(不区分大小写) -> redisCommand
+	dict *commands;             /* Command table indexed by name */
 	// 数据变动的次数，当RDB进行持久化后就会置0
 	long long dirty;            /* changes to DB from the last save */
 	// 当前连接的活动客户端
@@ -378,7 +466,18 @@ struct redisServer {
 	// cronServer定时任务执行的次数
 	int cronloops;              /* number of times the cron function run */
 	// 对象内存池，当对象释放的时候会尝试放到该链表中，用于防止多次malloc操作
-	list *objfreelist;          /* A list of freed objects to avoid malloc() */
+	/* Freed objects are kept in a cache of every thread, and exchanged in
+	 * batches with a lock free global pool, see objcacheGet(). The pool
+	 * is made of two stacks of slots, holding a batch or unused, with their
+	 * heads tagged by a counter against the ABA problem. */
+	int objcache_size;          /* Max objects in a thread cache, 0 = no cache */
+	int objcache_batch;         /* Objects per magazine, objcache_size/2 */
+	robj **objpool_batches;     /* Batch of every slot, linked by ptr */
+	uint32_t *objpool_next;     /* Next slot in the stack of every slot */
+	volatile uint64_t objpool_full;  /* Stack of the slots with a batch */
+	volatile uint64_t objpool_empty; /* Stack of the unused slots */
+	volatile long long stat_objcache_hits;   /* Objects taken from a cache */
+	volatile long long stat_objcache_misses; /* Objects allocated */
 	// 最后一次执行RDB持久化的时间
 	time_t lastsave;            /* Unix time of last save succeeede */
 	/* Fields used only for stats */
@@ -388,11 +487,24 @@ struct redisServer {
 	long long stat_numcommands;    /* number of processed commands */
 	// 总连接数，包括之前断开的
 	long long stat_numconnections; /* number of connections received */
+	long long stat_rejected_conn;  /* connections refused (maxclients...) */
+	long long stat_accepts_per_sec; /* accepted connections in the last second */
+	long long stat_accepts_sample;  /* accepted connections at the last sample */
+	time_t stat_accepts_sample_time;
+	long long stat_listen_overflows; /* ListenOverflows counter at startup */
 	/* Configuration */
 	// 日志过滤级别
 	int verbosity;
 	// 标志位，1表示开启，将应答消息组合起来批量发送出去
 	int glueoutputbuf;
+	// 事件循环使用边缘触发模式
+	int edgetriggered;
+	int activerehashing;        /* Incremental rehash in serverCron() */
+	int setsopenaddr;           /* Open addressing dicts for sets/zsets */
+	size_t set_max_intset_entries; /* Max elements of an intset encoded set */
+	size_t list_max_ziplist_entries; /* Max elements of a ziplist encoded list */
+	size_t list_max_ziplist_value; /* Max length of a ziplist list element */
+	long shared_integers;       /* Integers 0..N-1 are shared objects */
 	// 客户端最大空闲时间
 	int maxidletime;
 	// 数据库个数
@@ -475,7 +587,6 @@ struct redisServer {
 	list *io_processed; /* List of VM I/O jobs already processed */
 	list *io_clients; /* All the clients waiting for SWAP I/O operations */
 	pthread_mutex_t io_mutex; /* lock to access io_jobs/io_done/io_thread_job */
-	pthread_mutex_t obj_freelist_mutex; /* safe redis objects creation/free */
 	pthread_mutex_t io_swapfile_mutex; /* So we can lseek + write */
 	pthread_attr_t io_threads_attr; /* attributes for threads creation */
 	int io_active_threads; /* Number of running I/O threads */
@@ -491,6 +602,28 @@ struct redisServer {
 	unsigned long long vm_stats_swapped_objects;
 	unsigned long long vm_stats_swapouts;
 	unsigned long long vm_stats_swapins;
+	/* Network I/O threads. Command execution always happens in the main
+	 * thread: clients ready to be read, or with replies to flush, are
+	 * collected in the pending lists and processed before the next poll
+	 * using up to netio_threads threads (the main thread included). */
+	int netio_threads;         /* Number of network I/O threads, 1 = disabled */
+	int netio_active;          /* Threads were started */
+	list *clients_pending_read;
+	list *clients_pending_write;
+	list **netio_lists;        /* Clients assigned to every thread */
+	int netio_op;              /* REDIS_NETIO_OP_READ or REDIS_NETIO_OP_WRITE */
+	int netio_pending;         /* Threads still working on the current batch */
+	unsigned long netio_batch; /* Incremented to start a new batch */
+	pthread_mutex_t netio_mutex;
+	pthread_cond_t netio_start_cond;
+	pthread_cond_t netio_done_cond;
+	long long stat_netio_reads;   /* Reads performed by I/O threads */
+	long long stat_netio_writes;  /* Writes performed by I/O threads */
+	/* Listen workers: slave processes sharing the port via SO_REUSEPORT */
+	int listenworkers;      /* Number of processes, 1 = disabled */
+	int workerid;           /* 0 in the parent process */
+	pid_t workersppid;      /* Pid of the parent process */
+	pid_t *workerpids;      /* Workers pids, -1 once exited (parent only) */
 	FILE *devnull;
 };
 
@@ -542,15 +675,45 @@ typedef struct zset {
 	zskiplist *zsl;
 } zset;
 
+/* Iterator over the members of a Set, whatever the encoding */
+typedef struct setTypeIterator {
+	robj *subject;
+	uint32_t ii;        /* Intset position */
+	dictIterator *di;
+} setTypeIterator;
+
+/* Iterator over the elements of a List, whatever the encoding */
+typedef struct listTypeIterator {
+	robj *subject;
+	unsigned char encoding;
+	unsigned char direction; /* REDIS_HEAD or REDIS_TAIL */
+	unsigned char *zi;       /* Next element */
+	chunklistEntry ce;       /* Next chunk list element */
+	long index;              /* Index of the next chunk list element */
+} listTypeIterator;
+
+/* Current entry of a listTypeIterator. With both encodings the elements
+ * are ziplist entries, 'zi' is the current one. */
+typedef struct listTypeEntry {
+	listTypeIterator *li;
+	unsigned char *zi;
+	chunklistEntry ce;
+	long index;
+} listTypeEntry;
+
 /* Our shared "common" objects */
 // 共享通用的对象
 struct sharedObjectsStruct {
 	robj *crlf, *ok, *err, *emptybulk, *czero, *cone, *pong, *space,
 	     *colon, *nullbulk, *nullmultibulk, *queued,
 	     *emptymultibulk, *wrongtypeerr, *nokeyerr, *syntaxerr, *sameobjecterr,
-	     *outofrangeerr, *plus,
+	     *outofrangeerr, *plus, *emptyscan,
 	     *select0, *select1, *select2, *select3, *select4,
-	     *select5, *select6, *select7, *select8, *select9;
+	     *select5, *select6, *select7, *select8, *select9,
+	     *intreply[REDIS_SHARED_HDR_LEN],   /* ":<n>\r\n" */
+	     *bulkhdr[REDIS_SHARED_HDR_LEN],    /* "$<n>\r\n" */
+	     *mbulkhdr[REDIS_SHARED_HDR_LEN],   /* "*<n>\r\n" */
+	     **integers;                        /* 0..server.shared_integers-1 */
 } shared;
 
 /* Global vars that are actally used as constants. The following double
@@ -582,6 +745,8 @@ static void freeListObject(robj *o);
 static void freeSetObject(robj *o);
 static void decrRefCount(void *o);
 static robj *createObject(int type, void *ptr);
+static void initObjectPool(void);
+static void flushObjectCache(void);
 static void freeClient(redisClient *c);
 static int rdbLoad(char *filename);
 static void addReply(redisClient *c, robj *obj);
@@ -589,12 +754,13 @@ static void addReplySds(redisClient *c, sds s);
 static void incrRefCount(robj *o);
 static int rdbSaveBackground(char *filename);
 static robj *createStringObject(char *ptr, size_t len);
+static robj *createEmbeddedStringObject(char *ptr, size_t len);
 static robj *dupStringObject(robj *o);
 static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int dictid, robj **argv, int argc);
 static void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc);
 static int syncWithMaster(void);
 static robj *tryObjectSharing(robj *o);
-static int tryObjectEncoding(robj *o);
+static robj *tryObjectEncoding(robj *o);
 static robj *getDecodedObject(robj *o);
 static int removeExpire(redisDb *db, robj *key);
 static int expireIfNeeded(redisDb *db, robj *key);
@@ -611,11 +777,30 @@ static void rdbRemoveTempFile(pid_t childpid);
 static void aofRemoveTempFile(pid_t childpid);
 static size_t stringObjectLen(robj *o);
 static void processInputBuffer(redisClient *c);
+static int clientCanUseNetIOThreads(redisClient *c);
+static void initNetIOThreads(void);
+static void listenWorkerDoneHandler(pid_t pid, int statloc);
+static void checkListenWorkers(void);
+static long long listenOverflowsCounter(void);
 static zskiplist *zslCreate(void);
 static void zslFree(zskiplist *zsl);
 static void zslInsert(zskiplist *zsl, double score, robj *obj);
 static void sendReplyToClientWritev(aeEventLoop *el, int fd, void *privdata, int mask);
 static void initClientMultiState(redisClient *c);
+static int setTypeAdd(robj *subject, robj *value);
+static setTypeIterator *setTypeInitIterator(robj *subject);
+static robj *setTypeNext(setTypeIterator *si);
+static void setTypeReleaseIterator(setTypeIterator *si);
+static void listTypeConvert(robj *subject, int enc);
+static void listTypePush(robj *subject, robj *value, int where);
+static listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char direction);
+static int listTypeNext(listTypeIterator *li, listTypeEntry *entry);
+static robj *listTypeGet(listTypeEntry *entry);
+static void listTypeReleaseIterator(listTypeIterator *li);
+static unsigned long listTypeLength(robj *subject);
+static void addReplyBulkCBuffer(redisClient *c, void *p, size_t len);
+static void addReplyBulkLongLong(redisClient *c, long long ll);
+static void populateCommandTable(void);
 static void freeClientMultiState(redisClient *c);
 static void queueMultiCommand(redisClient *c, struct redisCommand *cmd);
 static void unblockClientWaitingData(redisClient *c);
@@ -657,6 +842,7 @@ static void decrbyCommand(redisClient *c);
 static void selectCommand(redisClient *c);
 static void randomkeyCommand(redisClient *c);
 static void keysCommand(redisClient *c);
+static void scanCommand(redisClient *c);
 static void dbsizeCommand(redisClient *c);
 static void lastsaveCommand(redisClient *c);
 static void saveCommand(redisClient *c);
@@ -684,6 +870,7 @@ static void scardCommand(redisClient *c);
 static void spopCommand(redisClient *c);
 static void srandmemberCommand(redisClient *c);
 static void sinterCommand(redisClient *c);
+static void sscanCommand(redisClient *c);
 static void sinterstoreCommand(redisClient *c);
 static void sunionCommand(redisClient *c);
 static void sunionstoreCommand(redisClient *c);
@@ -712,6 +899,7 @@ static void zrangeCommand(redisClient *c);
 static void zrangebyscoreCommand(redisClient *c);
 static void zrevrangeCommand(redisClient *c);
 static void zcardCommand(redisClient *c);
+static void zscanCommand(redisClient *c);
 static void zremCommand(redisClient *c);
 static void zscoreCommand(redisClient *c);
 static void zremrangebyscoreCommand(redisClient *c);
@@ -760,11 +948,13 @@ static struct redisCommand cmdTable[] = {
 	{"sdiff", sdiffCommand, -2, REDIS_CMD_INLINE | REDIS_CMD_DENYOOM},
 	{"sdiffstore", sdiffstoreCommand, -3, REDIS_CMD_INLINE | REDIS_CMD_DENYOOM},
 	{"smembers", sinterCommand, 2, REDIS_CMD_INLINE},
+	{"sscan", sscanCommand, -3, REDIS_CMD_INLINE},
 	{"zadd", zaddCommand, 4, REDIS_CMD_BULK | REDIS_CMD_DENYOOM},
 	{"zincrby", zincrbyCommand, 4, REDIS_CMD_BULK | REDIS_CMD_DENYOOM},
 	{"zrem", zremCommand, 3, REDIS_CMD_BULK},
 	{"zremrangebyscore", zremrangebyscoreCommand, 4, REDIS_CMD_INLINE},
 	{"zrange", zrangeCommand, -4, REDIS_CMD_INLINE},
+	{"zscan", zscanCommand, -3, REDIS_CMD_INLINE},
 	{"zrangebyscore", zrangebyscoreCommand, -4, REDIS_CMD_INLINE},
 	{"zrevrange", zrevrangeCommand, -4, REDIS_CMD_INLINE},
 	{"zcard", zcardCommand, 2, REDIS_CMD_INLINE},
@@ -782,6 +972,7 @@ static struct redisCommand cmdTable[] = {
 	{"expire", expireCommand, 3, REDIS_CMD_INLINE},
 	{"expireat", expireatCommand, 3, REDIS_CMD_INLINE},
 	{"keys", keysCommand, 2, REDIS_CMD_INLINE},
+	{"scan", scanCommand, -2, REDIS_CMD_INLINE},
 	{"dbsize", dbsizeCommand, 1, REDIS_CMD_INLINE},
 	{"auth", authCommand, 2, REDIS_CMD_INLINE},
 	{"ping", pingCommand, 1, REDIS_CMD_INLINE},
@@ -931,6 +1122,47 @@ int stringmatchlen(const char *pattern, int patternLen,
 	return 0;
 }
 
+/* Convert a long long into a string, two digits a time using a lookup
+ * table, as snprintf() is a lot slower and this is used for every integer
+ * and length sent to clients. Returns the length of the string, or 0 if
+ * the buffer (null term included) is too small. */
+static int ll2string(char *s, size_t len, long long svalue) {
+	static const char digits[201] =
+	    "0001020304050607080910111213141516171819"
+	    "2021222324252627282930313233343536373839"
+	    "4041424344454647484950515253545556575859"
+	    "6061626364656667686970717273747576777879"
+	    "8081828384858687888990919293949596979899";
+	char buf[21], *p = buf + sizeof(buf);
+	unsigned long long value;
+	int l;
+
+	/* -LLONG_MIN can't be represented as a long long */
+	value = (svalue < 0) ? ((unsigned long long) - (svalue + 1)) + 1 :
+	                         (unsigned long long)svalue;
+	while (value >= 100) {
+		int i = (value % 100) * 2;
+
+		value /= 100;
+		*--p = digits[i + 1];
+		*--p = digits[i];
+	}
+	if (value < 10) {
+		*--p = '0' + value;
+	} else {
+		int i = value * 2;
+
+		*--p = digits[i + 1];
+		*--p = digits[i];
+	}
+	if (svalue < 0) *--p = '-';
+	l = buf + sizeof(buf) - p;
+	if ((size_t)l >= len) return 0;
+	memcpy(s, p, l);
+	s[l] = '\0';
+	return l;
+}
+
 static void redisLog(int level, const char *fmt, ...) {
 	va_list ap;
 	FILE *fp;
@@ -1012,6 +1244,9 @@ static int dictEncObjKeyCompare(void *privdata, const void *key1,
 	robj *o1 = (robj*) key1, *o2 = (robj*) key2;
 	int cmp;
 
+	if (o1->encoding == REDIS_ENCODING_INT &&
+	    o2->encoding == REDIS_ENCODING_INT)
+		return o1->ptr == o2->ptr;
 	o1 = getDecodedObject(o1);
 	o2 = getDecodedObject(o2);
 	cmp = sdsDictKeyCompare(privdata, o1->ptr, o2->ptr);
@@ -1023,10 +1258,14 @@ static int dictEncObjKeyCompare(void *privdata, const void *key1,
 static unsigned int dictEncObjHash(const void *key) {
 	robj *o = (robj*) key;
 
-	o = getDecodedObject(o);
-	unsigned int hash = dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
-	decrRefCount(o);
-	return hash;
+	if (o->encoding == REDIS_ENCODING_INT) {
+		/* Hash the string representation without creating an object */
+		char buf[32];
+		int len = ll2string(buf, sizeof(buf), (long) o->ptr);
+
+		return dictGenHashFunction((unsigned char*)buf, len);
+	}
+	return dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
 }
 
 /* Sets type and expires */
@@ -1080,6 +1319,35 @@ static dictType keylistDictType = {
 	dictListDestructor          /* val destructor */
 };
 
+static unsigned int dictSdsCaseHash(const void *key) {
+	return dictGenCaseHashFunction((unsigned char*)key, sdslen((sds)key));
+}
+
+static int dictSdsKeyCaseCompare(void *privdata, const void *key1,
+                                 const void *key2)
+{
+	DICT_NOTUSED(privdata);
+
+	if (sdslen((sds)key1) != sdslen((sds)key2)) return 0;
+	return strcasecmp(key1, key2) == 0;
+}
+
+static void dictSdsDestructor(void *privdata, void *val)
+{
+	DICT_NOTUSED(privdata);
+	sdsfree(val);
+}
+
+/* Command table: sds command name (case insensitive) -> redisCommand */
+static dictType commandTableDictType = {
+	dictSdsCaseHash,           /* hash function */
+	NULL,                      /* key dup */
+	NULL,                      /* val dup */
+	dictSdsKeyCaseCompare,     /* key compare */
+	dictSdsDestructor,         /* key destructor */
+	NULL                       /* val destructor */
+};
+
 /* ========================= Random utility functions ======================= */
 
 /* Redis generally does not try to recover from out of memory conditions
@@ -1095,7 +1363,11 @@ static void oom(const char *msg) {
 
 /* ====================== Redis server networking stuff ===================== */
 // 处理客户端超时的情况（空闲或者阻塞）
-static void closeTimedoutClients(void) {
+/* Called by serverCron() every 10 seconds, or every second if there are
+ * blocked clients: close the timedout clients, reply to the clients whose
+ * blocking operation timed out, and release the query buffer of idle
+ * clients, as reads use REDIS_IOBUF_LEN bytes of free space at its end. */
+static void clientsCron(void) {
 	redisClient *c;
 	listNode *ln;
 	time_t now = time(NULL);
@@ -1120,6 +1392,11 @@ static void closeTimedoutClients(void) {
 				addReply(c, shared.nullmultibulk);
 				unblockClientWaitingData(c);
 			}
+		} else if (sdslen(c->querybuf) == 0 && sdsavail(c->querybuf) > 1024 &&
+		           now - c->lastinteraction > 2)
+		{
+			sdsfree(c->querybuf);
+			c->querybuf = sdsempty();
 		}
 	}
 }
@@ -1149,6 +1426,25 @@ static void tryResizeHashTables(void) {
 	}
 }
 
+/* Our hash table implementation performs rehashing incrementally while
+ * we write/read from the hash table. Still if the server is idle, the hash
+ * table will use two tables for a long time. So we try to use 1 millisecond
+ * of CPU time at every serverCron() loop in order to rehash some key. */
+static void incrementallyRehash(void) {
+	int j;
+
+	for (j = 0; j < server.dbnum; j++) {
+		if (dictIsRehashing(server.db[j].dict)) {
+			dictRehashMilliseconds(server.db[j].dict, 1);
+			break; /* already used our millisecond for this loop... */
+		}
+		if (dictIsRehashing(server.db[j].expires)) {
+			dictRehashMilliseconds(server.db[j].expires, 1);
+			break;
+		}
+	}
+}
+
 /* A background saving child (BGSAVE) terminated its work. Handle this. */
 void backgroundSaveDoneHandler(int statloc) {
 	int exitcode = WEXITSTATUS(statloc);
@@ -1245,6 +1541,16 @@ static int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientD
 	 * To access a global var is faster than calling time(NULL) */
 	server.unixtime = time(NULL);
 
+	/* Sample the connections accepted in the last second */
+	if (server.unixtime != server.stat_accepts_sample_time) {
+		long long accepts = server.stat_numconnections + server.stat_rejected_conn;
+
+		server.stat_accepts_per_sec = (accepts - server.stat_accepts_sample) /
+		                              (server.unixtime - server.stat_accepts_sample_time);
+		server.stat_accepts_sample = accepts;
+		server.stat_accepts_sample_time = server.unixtime;
+	}
+
 	/* Show some info about non-empty databases */
 	for (j = 0; j < server.dbnum; j++) {
 		long long size, used, vkeys;
@@ -1263,8 +1569,11 @@ static int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientD
 	 * implemented with a copy-on-write semantic in most modern systems, so
 	 * if we resize the HT while there is the saving child at work actually
 	 * a lot of memory movements in the parent will cause a lot of pages
-	 * copied. */
-	if (server.bgsavechildpid == -1) tryResizeHashTables();
+	 * copied. The same applies to the incremental rehashing. */
+	if (server.bgsavechildpid == -1 && server.bgrewritechildpid == -1) {
+		tryResizeHashTables();
+		if (server.activerehashing) incrementallyRehash();
+	}
 
 	/* Show information about connected clients */
 	if (!(loops % 5)) {
@@ -1275,9 +1584,12 @@ static int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientD
 		         dictSize(server.sharingpool));
 	}
 
-	/* Close connections of timedout clients */
-	if ((server.maxidletime && !(loops % 10)) || server.blockedclients)
-		closeTimedoutClients();
+	/* Close connections of timedout clients, free idle query buffers */
+	if (!(loops % 10) || server.blockedclients)
+		clientsCron();
+
+	/* Check the listen workers processes */
+	checkListenWorkers();
 
 	/* Check if a background saving or AOF rewrite in progress terminated */
 	if (server.bgsavechildpid != -1 || server.bgrewritechildpid != -1) {
@@ -1287,8 +1599,10 @@ static int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientD
 		if ((pid = wait3(&statloc, WNOHANG, NULL)) != 0) {
 			if (pid == server.bgsavechildpid) {
 				backgroundSaveDoneHandler(statloc);
-			} else {
+			} else if (pid == server.bgrewritechildpid) {
 				backgroundRewriteDoneHandler(statloc);
+			} else {
+				listenWorkerDoneHandler(pid, statloc);
 			}
 		}
 	} else {
@@ -1375,7 +1689,38 @@ static int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientD
 	return 1000;
 }
 
+/* Small integers are very common as values and set members, so they are
+ * created once, with a refcount that makes them immortal, and returned by
+ * createStringObjectFromLongLong() instead of a new object. They are
+ * allocated as a single array, as they are never freed. */
+static void createSharedIntegers(void) {
+	size_t objlen = server.vm_enabled ? sizeof(robj) :
+	                sizeof(robj) - sizeof(struct redisObjectVM);
+	char *p;
+	long j;
+
+	shared.integers = NULL;
+	if (server.shared_integers == 0) return;
+	shared.integers = zmalloc(sizeof(robj*) * server.shared_integers);
+	p = zmalloc(objlen * server.shared_integers);
+	for (j = 0; j < server.shared_integers; j++, p += objlen) {
+		robj *o = (robj*) p;
+
+		o->type = REDIS_STRING;
+		o->encoding = REDIS_ENCODING_INT;
+		o->ptr = (void*) j;
+		o->refcount = REDIS_SHARED_REFCOUNT;
+		if (server.vm_enabled) {
+			o->vm.atime = 0;
+			o->storage = REDIS_VM_MEMORY;
+		}
+		shared.integers[j] = o;
+	}
+}
+
 static void createSharedObjects(void) {
+	int j;
+
 	shared.crlf = createObject(REDIS_STRING, sdsnew("\r\n"));
 	shared.ok = createObject(REDIS_STRING, sdsnew("+OK\r\n"));
 	shared.err = createObject(REDIS_STRING, sdsnew("-ERR\r\n"));
@@ -1385,6 +1730,7 @@ static void createSharedObjects(void) {
 	shared.nullbulk = createObject(REDIS_STRING, sdsnew("$-1\r\n"));
 	shared.nullmultibulk = createObject(REDIS_STRING, sdsnew("*-1\r\n"));
 	shared.emptymultibulk = createObject(REDIS_STRING, sdsnew("*0\r\n"));
+	shared.emptyscan = createObject(REDIS_STRING, sdsnew("*2\r\n$1\r\n0\r\n*0\r\n"));
 	shared.pong = createObject(REDIS_STRING, sdsnew("+PONG\r\n"));
 	shared.queued = createObject(REDIS_STRING, sdsnew("+QUEUED\r\n"));
 	shared.wrongtypeerr = createObject(REDIS_STRING, sdsnew(
@@ -1410,6 +1756,12 @@ static void createSharedObjects(void) {
 	shared.select7 = createStringObject("select 7\r\n", 10);
 	shared.select8 = createStringObject("select 8\r\n", 10);
 	shared.select9 = createStringObject("select 9\r\n", 10);
+	for (j = 0; j < REDIS_SHARED_HDR_LEN; j++) {
+		shared.intreply[j] = createObject(REDIS_STRING, sdscatprintf(sdsempty(), ":%d\r\n", j));
+		shared.bulkhdr[j] = createObject(REDIS_STRING, sdscatprintf(sdsempty(), "$%d\r\n", j));
+		shared.mbulkhdr[j] = createObject(REDIS_STRING, sdscatprintf(sdsempty(), "*%d\r\n", j));
+	}
+	createSharedIntegers();
 }
 
 static void appendServerSaveParams(time_t seconds, int changes) {
@@ -1428,6 +1780,7 @@ static void resetServerSaveParams() {
 
 // 初始化默认配置
 static void initServerConfig() {
+	populateCommandTable();
 	server.dbnum = REDIS_DEFAULT_DBNUM;    //16
 	server.port = REDIS_SERVERPORT;        //6379
 	server.verbosity = REDIS_VERBOSE;
@@ -1436,6 +1789,13 @@ static void initServerConfig() {
 	server.logfile = NULL; /* NULL = log on standard output */
 	server.bindaddr = NULL;
 	server.glueoutputbuf = 1;
+	server.edgetriggered = 0;
+	server.activerehashing = 1;
+	server.setsopenaddr = 0;
+	server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
+	server.list_max_ziplist_entries = REDIS_LIST_MAX_ZIPLIST_ENTRIES;
+	server.list_max_ziplist_value = REDIS_LIST_MAX_ZIPLIST_VALUE;
+	server.shared_integers = REDIS_SHARED_INTEGERS;
 	server.daemonize = 0;
 	server.appendonly = 0;
 	// 在写aof后总是执行fsync,
@@ -1459,6 +1819,11 @@ static void initServerConfig() {
 	server.vm_pages = 1024 * 1024 * 100; /* 104 millions of pages */
 	server.vm_max_memory = 1024LL * 1024 * 1024 * 1; /* 1 GB of RAM */
 	server.vm_max_threads = 4;
+	server.netio_threads = 1;
+	server.objcache_size = REDIS_OBJCACHE_SIZE;
+	server.listenworkers = 1;
+	server.workerid = 0;
+	server.workerpids = NULL;
 
 	resetServerSaveParams();
 
@@ -1484,6 +1849,37 @@ static void initServerConfig() {
 	R_Nan = R_Zero / R_Zero;
 }
 
+/* If maxclients is set make sure the process is able to open enough files
+ * to serve all the clients, raising the soft (and if possible the hard)
+ * limit. Failures are not fatal, new connections will just be refused by
+ * the kernel once we run out of file descriptors. */
+static void adjustOpenFilesLimit(void) {
+	rlim_t maxfiles = (rlim_t)server.maxclients + REDIS_EVENTLOOP_FDSET_INCR;
+	struct rlimit limit;
+
+	if (server.maxclients == 0) return;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == -1) {
+		redisLog(REDIS_WARNING, "Unable to obtain the current NOFILE limit (%s)",
+		         strerror(errno));
+		return;
+	}
+	if (limit.rlim_cur >= maxfiles) return;
+	limit.rlim_cur = maxfiles;
+	if (limit.rlim_max < maxfiles) limit.rlim_max = maxfiles;
+	if (setrlimit(RLIMIT_NOFILE, &limit) == -1) {
+		/* Try again without touching the hard limit */
+		getrlimit(RLIMIT_NOFILE, &limit);
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+		redisLog(REDIS_WARNING, "Unable to set the max number of open files to %llu (%s), current limit is %llu",
+		         (unsigned long long) maxfiles, strerror(errno),
+		         (unsigned long long) limit.rlim_cur);
+	} else {
+		redisLog(REDIS_NOTICE, "Max number of open files set to %llu",
+		         (unsigned long long) maxfiles);
+	}
+}
+
 static void initServer() {
 	int j;
 
@@ -1499,18 +1895,31 @@ static void initServer() {
 	server.clients = listCreate();
 	server.slaves = listCreate();
 	server.monitors = listCreate();
-	server.objfreelist = listCreate();
+	initObjectPool();
 	createSharedObjects();
+	adjustOpenFilesLimit();
 	// 创建事件循环
-	server.el = aeCreateEventLoop();
+	server.el = aeCreateEventLoop(server.maxclients ?
+	                              (int)server.maxclients + REDIS_EVENTLOOP_FDSET_INCR :
+	                              REDIS_EVENTLOOP_SETSIZE);
+	if (server.edgetriggered &&
+	        aeSetEdgeTriggered(server.el, 1) == AE_ERR) {
+		redisLog(REDIS_WARNING, "Edge triggered mode not supported by the %s event loop, using level triggered mode", aeGetApiName());
+		server.edgetriggered = 0;
+	}
 	server.db = zmalloc(sizeof(redisDb) * server.dbnum);
 	server.sharingpool = dictCreate(&setDictType, NULL);
 	// 监听端口
-	server.fd = anetTcpServer(server.neterr, server.port, server.bindaddr);
+	if (server.listenworkers > 1)
+		server.fd = anetTcpServerReusePort(server.neterr, server.port, server.bindaddr);
+	else
+		server.fd = anetTcpServer(server.neterr, server.port, server.bindaddr);
 	if (server.fd == -1) {
 		redisLog(REDIS_WARNING, "Opening TCP port: %s", server.neterr);
 		exit(1);
 	}
+	/* acceptHandler() accepts connections until the queue is drained */
+	anetNonBlock(NULL, server.fd);
 	// 依次创建数据库
 	for (j = 0; j < server.dbnum; j++) {
 		server.db[j].dict = dictCreate(&hashDictType, NULL);
@@ -1526,6 +1935,11 @@ static void initServer() {
 	server.dirty = 0;
 	server.stat_numcommands = 0;
 	server.stat_numconnections = 0;
+	server.stat_rejected_conn = 0;
+	server.stat_accepts_per_sec = 0;
+	server.stat_accepts_sample = 0;
+	server.stat_accepts_sample_time = time(NULL);
+	server.stat_listen_overflows = listenOverflowsCounter();
 	server.stat_starttime = time(NULL);
 	server.unixtime = time(NULL);
 	// 创建定时器，1ms执行一次（不精确）
@@ -1544,6 +1958,7 @@ static void initServer() {
 		}
 	}
 
+	initNetIOThreads();
 	if (server.vm_enabled) vmInit();
 }
 
@@ -1674,6 +2089,29 @@ static void loadServerConfig(char *filename) {
 			if ((server.glueoutputbuf = yesnotoi(argv[1])) == -1) {
 				err = "argument must be 'yes' or 'no'"; goto loaderr;
 			}
+		} else if (!strcasecmp(argv[0], "edge-triggered") && argc == 2) {
+			if ((server.edgetriggered = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0], "activerehashing") && argc == 2) {
+			if ((server.activerehashing = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0], "open-addressing-sets") && argc == 2) {
+			if ((server.setsopenaddr = yesnotoi(argv[1])) == -1) {
+				err = "argument must be 'yes' or 'no'"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0], "set-max-intset-entries") && argc == 2) {
+			server.set_max_intset_entries = strtoul(argv[1], NULL, 10);
+		} else if (!strcasecmp(argv[0], "list-max-ziplist-entries") && argc == 2) {
+			server.list_max_ziplist_entries = strtoul(argv[1], NULL, 10);
+		} else if (!strcasecmp(argv[0], "list-max-ziplist-value") && argc == 2) {
+			server.list_max_ziplist_value = strtoul(argv[1], NULL, 10);
+		} else if (!strcasecmp(argv[0], "shared-integers") && argc == 2) {
+			server.shared_integers = strtol(argv[1], NULL, 10);
+			if (server.shared_integers < 0) {
+				err = "invalid number of shared integers"; goto loaderr;
+			}
 		} else if (!strcasecmp(argv[0], "shareobjects") && argc == 2) {
 			if ((server.shareobjects = yesnotoi(argv[1])) == -1) {
 				err = "argument must be 'yes' or 'no'"; goto loaderr;
@@ -1727,6 +2165,23 @@ static void loadServerConfig(char *filename) {
 			server.vm_pages = strtoll(argv[1], NULL, 10);
 		} else if (!strcasecmp(argv[0], "vm-max-threads") && argc == 2) {
 			server.vm_max_threads = strtoll(argv[1], NULL, 10);
+		} else if (!strcasecmp(argv[0], "listen-workers") && argc == 2) {
+			server.listenworkers = atoi(argv[1]);
+			if (server.listenworkers < 1 ||
+			        server.listenworkers > REDIS_MAX_LISTEN_WORKERS) {
+				err = "Invalid number of listen workers"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0], "object-cache-size") && argc == 2) {
+			server.objcache_size = atoi(argv[1]);
+			if (server.objcache_size < 0) {
+				err = "Invalid object cache size"; goto loaderr;
+			}
+		} else if (!strcasecmp(argv[0], "io-threads") && argc == 2) {
+			server.netio_threads = atoi(argv[1]);
+			if (server.netio_threads < 1 ||
+			        server.netio_threads > REDIS_NETIO_MAX_THREADS) {
+				err = "Invalid number of I/O threads"; goto loaderr;
+			}
 		} else {
 			err = "Bad directive or wrong number of arguments"; goto loaderr;
 		}
@@ -1751,10 +2206,7 @@ static void freeClientArgv(redisClient *c) {
 
 	for (j = 0; j < c->argc; j++)
 		decrRefCount(c->argv[j]);
-	for (j = 0; j < c->mbargc; j++)
-		decrRefCount(c->mbargv[j]);
 	c->argc = 0;
-	c->mbargc = 0;
 }
 
 static void freeClient(redisClient *c) {
@@ -1779,6 +2231,17 @@ static void freeClient(redisClient *c) {
 	ln = listSearchKey(server.clients, c);
 	redisAssert(ln != NULL);
 	listDelNode(server.clients, ln);
+	/* Remove from the lists of clients waiting for the network I/O threads */
+	if (c->flags & REDIS_PENDING_READ) {
+		ln = listSearchKey(server.clients_pending_read, c);
+		redisAssert(ln != NULL);
+		listDelNode(server.clients_pending_read, ln);
+	}
+	if (c->flags & REDIS_PENDING_WRITE) {
+		ln = listSearchKey(server.clients_pending_write, c);
+		redisAssert(ln != NULL);
+		listDelNode(server.clients_pending_write, ln);
+	}
 	/* Remove from the list of clients waiting for VM operations */
 	if (server.vm_enabled && listLength(c->io_keys)) {
 		ln = listSearchKey(server.io_clients, c);
@@ -1800,7 +2263,6 @@ static void freeClient(redisClient *c) {
 		server.replstate = REDIS_REPL_CONNECT;
 	}
 	zfree(c->argv);
-	zfree(c->mbargv);
 	freeClientMultiState(c);
 	zfree(c);
 }
@@ -1846,7 +2308,7 @@ static void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask)
 	*  并且客户端不是Master，则会使用writev批量发送数据
 	*/
 	/* Use writev() if we have enough buffers to send */
-	if (!server.glueoutputbuf &&
+	if (!server.glueoutputbuf && c->bufpos == 0 &&
 	        listLength(c->reply) > REDIS_WRITEV_THRESHOLD &&
 	        !(c->flags & REDIS_MASTER))
 	{
@@ -1854,7 +2316,25 @@ static void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask)
 		return;
 	}
 
-	while (listLength(c->reply)) {
+	while (c->bufpos > 0 || listLength(c->reply)) {
+		if (c->bufpos > 0) {
+			/* The static buffer is always sent first */
+			if (c->flags & REDIS_MASTER) {
+				nwritten = c->bufpos - c->sentlen;
+			} else {
+				nwritten = write(fd, c->buf + c->sentlen, c->bufpos - c->sentlen);
+				if (nwritten <= 0) break;
+			}
+			c->sentlen += nwritten;
+			totwritten += nwritten;
+			if (c->sentlen == c->bufpos) {
+				c->bufpos = 0;
+				c->sentlen = 0;
+			}
+			if (totwritten > REDIS_MAX_WRITE_PER_EVENT) break;
+			continue;
+		}
+
 		// 如果开启了批量发送，并且有超过两个应答消息，则尽可能的将多条短小的消息组合成一条
 		if (server.glueoutputbuf && listLength(c->reply) > 1)
 			glueReplyBuffersIfNeeded(c);
@@ -1894,6 +2374,11 @@ static void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask)
 		// 一次最多发送64K
 		if (totwritten > REDIS_MAX_WRITE_PER_EVENT) break;
 	}
+	/* If we stopped because of the per event limit, and not because the
+	 * socket buffer is full, make sure to be called again. */
+	if (totwritten > REDIS_MAX_WRITE_PER_EVENT &&
+	        (c->bufpos > 0 || listLength(c->reply)))
+		aeRearmFileEvent(server.el, c->fd);
 	if (nwritten == -1) {
 		if (errno == EAGAIN) {
 			nwritten = 0;
@@ -1906,7 +2391,7 @@ static void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask)
 	}
 	// 只有当总发送字节数大于0，才会断定会这是一次有效的会话，设置最后交互时间
 	if (totwritten > 0) c->lastinteraction = time(NULL);
-	if (listLength(c->reply) == 0) {
+	if (c->bufpos == 0 && listLength(c->reply) == 0) {
 		// 所有应答消息已经发送完毕，可以从事件循环中移除写句柄
 		c->sentlen = 0;
 		aeDeleteFileEvent(server.el, c->fd, AE_WRITABLE);
@@ -1919,7 +2404,7 @@ static void sendReplyToClientWritev(aeEventLoop *el, int fd, void *privdata, int
 	int nwritten = 0, totwritten = 0, objlen, willwrite;
 	robj *o;
 	struct iovec iov[REDIS_WRITEV_IOVEC_COUNT];
-	int offset, ion = 0;
+	int offset, ion = 0, again = 0;
 	REDIS_NOTUSED(el);
 	REDIS_NOTUSED(mask);
 
@@ -1939,7 +2424,10 @@ static void sendReplyToClientWritev(aeEventLoop *el, int fd, void *privdata, int
 
 			// 如果当前对象剩余的数据量(objlen-offset)已经大于64K，则不使用writev发送
 			// 或者已经发送的数据加上剩余的大于64K，则退出（控制单次处理发送数量）
-			if (totwritten + objlen - offset > REDIS_MAX_WRITE_PER_EVENT)
+			/* ...but always send at least one object, otherwise
+			 * objects bigger than the limit would never be sent. */
+			if ((totwritten || ion) &&
+			        totwritten + objlen - offset > REDIS_MAX_WRITE_PER_EVENT)
 				break;
 
 			// 一次最多256个
@@ -1964,6 +2452,7 @@ static void sendReplyToClientWritev(aeEventLoop *el, int fd, void *privdata, int
 				freeClient(c);
 				return;
 			}
+			again = 1;
 			break;
 		}
 
@@ -1993,19 +2482,39 @@ static void sendReplyToClientWritev(aeEventLoop *el, int fd, void *privdata, int
 	if (totwritten > 0)
 		c->lastinteraction = time(NULL);
 
+	/* Stopped because of the per event limit? Make sure to be called again */
+	if (!again && listLength(c->reply))
+		aeRearmFileEvent(server.el, c->fd);
+
 	if (listLength(c->reply) == 0) {
 		c->sentlen = 0;
 		aeDeleteFileEvent(server.el, c->fd, AE_WRITABLE);
 	}
 }
 
-static struct redisCommand *lookupCommand(char *name) {
-	int j = 0;
-	while (cmdTable[j].name != NULL) {
-		if (!strcasecmp(name, cmdTable[j].name)) return &cmdTable[j];
-		j++;
+/* Index the command table by name, so that lookupCommand() is a single
+ * hash table lookup instead of a strcasecmp() against every entry of
+ * cmdTable[]. Called once at startup. */
+static void populateCommandTable(void) {
+	int j;
+
+	server.commands = dictCreate(&commandTableDictType, NULL);
+	for (j = 0; cmdTable[j].name != NULL; j++) {
+		int retval = dictAdd(server.commands, sdsnew(cmdTable[j].name),
+		                     &cmdTable[j]);
+		redisAssert(retval == DICT_OK);
 	}
-	return NULL;
+	/* Finish the rehashing now: dictFind() moves buckets while a rehash
+	 * is in progress, and with io-threads the network threads look up
+	 * the inline commands concurrently. */
+	while (dictRehash(server.commands, 100));
+}
+
+// 查找命令，命令名不区分大小写
+static struct redisCommand *lookupCommand(sds name) {
+	dictEntry *de = dictFind(server.commands, name);
+
+	return de ? dictGetEntryVal(de) : NULL;
 }
 
 /* resetClient prepare the client to process the next command */
@@ -2013,6 +2522,12 @@ static void resetClient(redisClient *c) {
 	freeClientArgv(c);
 	c->bulklen = -1;
 	c->multibulk = 0;
+	/* Don't hold the memory of a huge argv array forever */
+	if (c->argvlen > REDIS_ARGV_PREALLOC_MAX) {
+		zfree(c->argv);
+		c->argv = NULL;
+		c->argvlen = 0;
+	}
 }
 
 /* Call() is the core of Redis execution of a command */
@@ -2036,9 +2551,8 @@ static void call(redisClient *c, struct redisCommand *cmd) {
 }
 
 /* If this function gets called we already read a whole
- * command, argments are in the client argv/argc fields.
- * processCommand() execute the command or prepare the
- * server for a bulk read from the client.
+ * command, argments are in the client argv/argc fields
+ * (see parseQueryBuffer()). processCommand() execute the command.
  *
  * If 1 is returned the client is still alive and valid and
  * and other operations can be performed by the caller. Otherwise
@@ -2049,74 +2563,6 @@ static int processCommand(redisClient *c) {
 	/* Free some memory if needed (maxmemory setting) */
 	if (server.maxmemory) freeMemoryIfNeeded();
 
-	/* Handle the multi bulk command type. This is an alternative protocol
-	 * supported by Redis in order to receive commands that are composed of
-	 * multiple binary-safe "bulk" arguments. The latency of processing is
-	 * a bit higher but this allows things like multi-sets, so if this
-	 * protocol is used only for MSET and similar commands this is a big win. */
-	if (c->multibulk == 0 && c->argc == 1 && ((char*)(c->argv[0]->ptr))[0] == '*') {
-		c->multibulk = atoi(((char*)c->argv[0]->ptr) + 1);
-		if (c->multibulk <= 0) {
-			resetClient(c);
-			return 1;
-		} else {
-			decrRefCount(c->argv[c->argc - 1]);
-			c->argc--;
-			return 1;
-		}
-	} else if (c->multibulk) {
-		if (c->bulklen == -1) {
-			if (((char*)c->argv[0]->ptr)[0] != '$') {
-				addReplySds(c, sdsnew("-ERR multi bulk protocol error\r\n"));
-				resetClient(c);
-				return 1;
-			} else {
-				int bulklen = atoi(((char*)c->argv[0]->ptr) + 1);
-				decrRefCount(c->argv[0]);
-				if (bulklen < 0 || bulklen > 1024 * 1024 * 1024) {
-					c->argc--;
-					addReplySds(c, sdsnew("-ERR invalid bulk write count\r\n"));
-					resetClient(c);
-					return 1;
-				}
-				c->argc--;
-				c->bulklen = bulklen + 2; /* add two bytes for CR+LF */
-				return 1;
-			}
-		} else {
-			c->mbargv = zrealloc(c->mbargv, (sizeof(robj*)) * (c->mbargc + 1));
-			c->mbargv[c->mbargc] = c->argv[0];
-			c->mbargc++;
-			c->argc--;
-			c->multibulk--;
-			if (c->multibulk == 0) {
-				robj **auxargv;
-				int auxargc;
-
-				/* Here we need to swap the multi-bulk argc/argv with the
-				 * normal argc/argv of the client structure. */
-				auxargv = c->argv;
-				c->argv = c->mbargv;
-				c->mbargv = auxargv;
-
-				auxargc = c->argc;
-				c->argc = c->mbargc;
-				c->mbargc = auxargc;
-
-				/* We need to set bulklen to something different than -1
-				 * in order for the code below to process the command without
-				 * to try to read the last argument of a bulk command as
-				 * a special argument. */
-				c->bulklen = 0;
-				/* continue below and process the command */
-			} else {
-				c->bulklen = -1;
-				return 1;
-			}
-		}
-	}
-	/* -- end of multi bulk commands processing -- */
-
 	/* The QUIT command is handled as a special case. Normal command
 	 * procs are unable to close the client connection safely */
 	if (!strcasecmp(c->argv[0]->ptr, "quit")) {
@@ -2144,30 +2590,6 @@ static int processCommand(redisClient *c) {
 		addReplySds(c, sdsnew("-ERR command not allowed when used memory > 'maxmemory'\r\n"));
 		resetClient(c);
 		return 1;
-	} else if (cmd->flags & REDIS_CMD_BULK && c->bulklen == -1) {
-		int bulklen = atoi(c->argv[c->argc - 1]->ptr);
-
-		decrRefCount(c->argv[c->argc - 1]);
-		if (bulklen < 0 || bulklen > 1024 * 1024 * 1024) {
-			c->argc--;
-			addReplySds(c, sdsnew("-ERR invalid bulk write count\r\n"));
-			resetClient(c);
-			return 1;
-		}
-		c->argc--;
-		c->bulklen = bulklen + 2; /* add two bytes for CR+LF */
-		/* It is possible that the bulk read is already in the
-		 * buffer. Check this condition and handle it accordingly.
-		 * This is just a fast path, alternative to call processInputBuffer().
-		 * It's a good idea since the code is small and this condition
-		 * happens most of the times. */
-		if ((signed)sdslen(c->querybuf) >= c->bulklen) {
-			c->argv[c->argc] = createStringObject(c->querybuf, c->bulklen - 2);
-			c->argc++;
-			c->querybuf = sdsrange(c->querybuf, c->bulklen, -1);
-		} else {
-			return 1;
-		}
 	}
 	/* Let's try to share objects on the command arguments vector */
 	if (server.shareobjects) {
@@ -2178,7 +2600,7 @@ static int processCommand(redisClient *c) {
 	}
 	/* Let's try to encode the bulk object to save space. */
 	if (cmd->flags & REDIS_CMD_BULK)
-		tryObjectEncoding(c->argv[c->argc - 1]);
+		c->argv[c->argc - 1] = tryObjectEncoding(c->argv[c->argc - 1]);
 
 	/* Check if the user is authenticated */
 	// 密码认证
@@ -2277,157 +2699,605 @@ static void replicationFeedSlaves(list *slaves, struct redisCommand *cmd, int di
 	if (outv != static_outv) zfree(outv);
 }
 
-static void processInputBuffer(redisClient *c) {
-again:
-	/* Before to process the input buffer, make sure the client is not
-	 * waitig for a blocking operation such as BLPOP. Note that the first
-	 * iteration the client is never blocked, otherwise the processInputBuffer
-	 * would not be called at all, but after the execution of the first commands
-	 * in the input buffer the client may be blocked, and the "goto again"
-	 * will try to reiterate. The following line will make it return asap. */
-	// 确保客户端不是处于被阻塞的状态
-	if (c->flags & REDIS_BLOCKED || c->flags & REDIS_IO_WAIT) return;
-
-	/* Redis请求数据封装协议分为两种，
-	*  1.简单字符串（如PING 编码为PING\n或者PING\r\n等）
-	*  2.数组（如"LLEN list"格式则为*2\r\n$4LLEN\r\n$4list\r\n）
-	*/
-	if (c->bulklen == -1) {
-		/* Read the first line of the query */
-		char *p = strchr(c->querybuf, '\n');
-		size_t querylen;
+/* Return the next space separated argument of the inline query line
+ * [p,end), storing its length in *len, or NULL if there are no more. */
+static char *nextInlineToken(char *p, char *end, size_t *len) {
+	char *tok;
 
-		if (p) {
-			sds query, *argv;
-			int argc, j;
+	while (p < end && *p == ' ') p++;
+	if (p == end) return NULL;
+	tok = p;
+	while (p < end && *p != ' ') p++;
+	*len = p - tok;
+	return tok;
+}
 
-			query = c->querybuf;
-			c->querybuf = sdsempty();
-			querylen = 1 + (p - (query));
-			if (sdslen(query) > querylen) {
-				/* leave data after the first line of the query in the buffer */
-				c->querybuf = sdscatlen(c->querybuf, query + querylen, sdslen(query) - querylen);
-			}
-			*p = '\0'; /* remove "\n" */
-			if (*(p - 1) == '\r') *(p - 1) = '\0'; /* and "\r" if any */
-			sdsupdatelen(query);
+/* Make room for at least 'slots' arguments in c->argv. The array is
+ * reused by the next commands, so most of the times this is a no-op. */
+static void reserveClientArgv(redisClient *c, int slots) {
+	if (slots <= c->argvlen) return;
+	if (slots < c->argvlen * 2) slots = c->argvlen * 2;
+	c->argv = zrealloc(c->argv, sizeof(robj*) * slots);
+	c->argvlen = slots;
+}
 
-			/* Now we can split the query in arguments */
-			argv = sdssplitlen(query, sdslen(query), " ", 1, &argc);
-			sdsfree(query);
+/* Discard the part of the query buffer already parsed. This is only done
+ * when more data is needed, so that a pipeline of many commands moves the
+ * unparsed bytes once per read instead of once per command. */
+static void compactQueryBuffer(redisClient *c) {
+	if (c->qbpos == 0) return;
+	c->querybuf = sdsrange(c->querybuf, c->qbpos, -1);
+	c->qbpos = 0;
+}
 
-			if (c->argv) zfree(c->argv);
-			c->argv = zmalloc(sizeof(robj*)*argc);
+/* Try to parse a whole command from the client query buffer. Both the
+ * inline protocol (optionally followed by the bulk argument of a
+ * REDIS_CMD_BULK command) and the multi bulk protocol are handled: partial
+ * state is kept in the client bulklen/multibulk/argv fields so that the
+ * parsing can resume when more data arrives.
+ *
+ * The query buffer is not modified while parsing: c->qbpos is advanced
+ * instead, and the arguments are created directly from slices of the
+ * buffer, see compactQueryBuffer().
+ *
+ * On REDIS_PARSE_COMMAND the command is in c->argc/c->argv, ready for
+ * processCommand(). On REDIS_PARSE_ERROR c->parseerr is the error to reply
+ * with, or NULL if the connection should be closed.
+ *
+ * This function does not touch any global state, so it is safe to call it
+ * from the network I/O threads. */
+static int parseQueryBuffer(redisClient *c) {
+	while (1) {
+		char *query = c->querybuf + c->qbpos;
+		size_t avail = sdslen(c->querybuf) - c->qbpos;
 
-			for (j = 0; j < argc; j++) {
-				if (sdslen(argv[j])) {
-					c->argv[c->argc] = createObject(REDIS_STRING, argv[j]);
-					c->argc++;
-				} else {
-					sdsfree(argv[j]);
+		if (c->bulklen == -1) {
+			/* Read the first line of the query */
+			char *eol = memchr(query, '\n', avail), *end, *p;
+			struct redisCommand *cmd;
+			long long bulklen;
+			size_t toklen;
+			int n = 0, isbulk;
+
+			if (eol == NULL) {
+				if (avail >= REDIS_REQUEST_MAX_SIZE) {
+					c->parseerr = NULL;
+					return REDIS_PARSE_ERROR;
+				}
+				compactQueryBuffer(c);
+				return REDIS_PARSE_INCOMPLETE;
+			}
+			c->qbpos += eol - query + 1;
+			end = eol;
+			if (end > query && *(end - 1) == '\r') end--; /* remove "\r" if any */
+
+			/* Count the arguments, there is nothing to process if the
+			 * line is empty: go ahead with the rest of the buffer */
+			p = query;
+			while ((p = nextInlineToken(p, end, &toklen)) != NULL) {
+				p += toklen;
+				n++;
+			}
+			if (n == 0) continue;
+			query = nextInlineToken(query, end, &toklen);
+
+			/* Handle the multi bulk command type. This is an alternative
+			 * protocol supported by Redis in order to receive commands that
+			 * are composed of multiple binary-safe "bulk" arguments. The
+			 * latency of processing is a bit higher but this allows things
+			 * like multi-sets, so if this protocol is used only for MSET and
+			 * similar commands this is a big win. */
+			if (c->multibulk) {
+				/* Every argument is introduced by a $<count> line */
+				if (*query != '$') {
+					resetClient(c);
+					c->parseerr = "-ERR multi bulk protocol error\r\n";
+					return REDIS_PARSE_ERROR;
+				}
+				bulklen = strtoll(query + 1, NULL, 10);
+			} else if (n == 1 && *query == '*') {
+				c->multibulk = atoi(query + 1);
+				if (c->multibulk < 0) c->multibulk = 0;
+				reserveClientArgv(c, c->multibulk < REDIS_ARGV_PREALLOC_MAX ?
+				    c->multibulk : REDIS_ARGV_PREALLOC_MAX);
+				continue;
+			} else {
+				/* Inline command */
+				reserveClientArgv(c, n);
+				c->argv[0] = createStringObject(query, toklen);
+				c->argc = 1;
+
+				/* Bulk commands have the length of the last argument as
+				 * last inline argument, the data follows the newline.
+				 * Errors about unknown commands and wrong arity are
+				 * reported by processCommand(). */
+				cmd = lookupCommand(c->argv[0]->ptr);
+				isbulk = cmd && (cmd->flags & REDIS_CMD_BULK) && n > 1 &&
+				    !(cmd->arity > 0 && cmd->arity != n) && n >= -cmd->arity;
+				p = query + toklen;
+				while ((p = nextInlineToken(p, end, &toklen)) != NULL) {
+					if (isbulk && c->argc == n - 1) break;
+					c->argv[c->argc++] = createStringObject(p, toklen);
+					p += toklen;
 				}
+				if (!isbulk) return REDIS_PARSE_COMMAND;
+				bulklen = strtoll(p, NULL, 10);
+			}
+			if (bulklen < 0 || bulklen > 1024 * 1024 * 1024) {
+				resetClient(c);
+				c->parseerr = "-ERR invalid bulk write count\r\n";
+				return REDIS_PARSE_ERROR;
+			}
+			c->bulklen = bulklen + 2; /* add two bytes for CR+LF */
+		} else {
+			/* Bulk read handling. Note that if we are at this point
+			   the client already sent a command terminated with a newline,
+			   we are reading the bulk data that is actually the last
+			   argument of the command. */
+			robj *o;
+
+			if ((size_t)c->bulklen > avail) {
+				compactQueryBuffer(c);
+				return REDIS_PARSE_INCOMPLETE;
 			}
-			zfree(argv);
-			if (c->argc) {
-				/* Execute the command. If the client is still valid
-				 * after processCommand() return and there is something
-				 * on the query buffer try to process the next command. */
-				if (processCommand(c) && sdslen(c->querybuf)) goto again;
+			if (c->qbpos == 0 && c->bulklen >= REDIS_MBULK_BIG_ARG &&
+			    sdslen(c->querybuf) == (size_t)c->bulklen)
+			{
+				/* The query buffer holds exactly the argument, as
+				 * readClientSocket() reads just the missing bytes of big
+				 * arguments: use the buffer itself as the object. */
+				c->querybuf = sdsrange(c->querybuf, 0, -3); /* remove CRLF */
+				o = createObject(REDIS_STRING, c->querybuf);
+				c->querybuf = sdsempty();
 			} else {
-				/* Nothing to process, argc == 0. Just process the query
-				 * buffer if it's not empty or return to the caller */
-				if (sdslen(c->querybuf)) goto again;
+				/* Copy everything but the final CRLF as argument */
+				o = createStringObject(query, c->bulklen - 2);
+				c->qbpos += c->bulklen;
 			}
-			return;
-		} else if (sdslen(c->querybuf) >= REDIS_REQUEST_MAX_SIZE) {
-			redisLog(REDIS_VERBOSE, "Client protocol error");
-			freeClient(c);
-			return;
+			c->bulklen = -1;
+			if (!c->multibulk) {
+				/* The slot for the bulk argument is the one of the count */
+				c->argv[c->argc++] = o;
+				return REDIS_PARSE_COMMAND;
+			}
+			reserveClientArgv(c, c->argc + 1);
+			c->argv[c->argc++] = o;
+			if (--c->multibulk == 0) return REDIS_PARSE_COMMAND;
 		}
-	} else {
-		/* Bulk read handling. Note that if we are at this point
-		   the client already sent a command terminated with a newline,
-		   we are reading the bulk data that is actually the last
-		   argument of the command. */
-		int qbl = sdslen(c->querybuf);
-
-		if (c->bulklen <= qbl) {
-			/* Copy everything but the final CRLF as final argument */
-			c->argv[c->argc] = createStringObject(c->querybuf, c->bulklen - 2);
-			c->argc++;
-			c->querybuf = sdsrange(c->querybuf, c->bulklen, -1);
-			/* Process the command. If the client is still valid after
-			 * the processing and there is more data in the buffer
-			 * try to parse it. */
-			if (processCommand(c) && sdslen(c->querybuf)) goto again;
-			return;
+	}
+}
+
+static void processInputBuffer(redisClient *c) {
+	int status;
+
+	while (1) {
+		/* Before to process the input buffer, make sure the client is not
+		 * waitig for a blocking operation such as BLPOP. Note that the first
+		 * iteration the client is never blocked, otherwise the
+		 * processInputBuffer would not be called at all, but after the
+		 * execution of the first commands in the input buffer the client may
+		 * be blocked. The following line will make it return asap. */
+		// 确保客户端不是处于被阻塞的状态
+		if (c->flags & REDIS_BLOCKED || c->flags & REDIS_IO_WAIT) return;
+
+		/* The first command may already be parsed by an I/O thread */
+		if (c->flags & REDIS_PENDING_COMMAND) {
+			c->flags &= ~REDIS_PENDING_COMMAND;
+			status = c->parsestatus;
+		} else {
+			status = parseQueryBuffer(c);
+		}
+		if (status == REDIS_PARSE_INCOMPLETE) return;
+		if (status == REDIS_PARSE_ERROR) {
+			if (c->parseerr == NULL) {
+				redisLog(REDIS_VERBOSE, "Client protocol error");
+				freeClient(c);
+				return;
+			}
+			addReplySds(c, sdsnew(c->parseerr));
+			continue;
+		}
+		/* Execute the command. If the client is still valid after
+		 * processCommand() return try to process the next command. */
+		if (!processCommand(c)) return;
+	}
+}
+
+/* Read from the client socket into the query buffer until the socket is
+ * drained, that is, a short read or EAGAIN, so that a big pipeline is
+ * consumed in a single event. In edge triggered mode this is required, as
+ * we'll not be notified again until new data arrives. Up to
+ * REDIS_MAX_READ_PER_EVENT bytes are read in a single call in order to
+ * serve other clients as well.
+ *
+ * Data is read directly in the free space at the end of the query buffer.
+ * While a big bulk argument is pending only the missing bytes are read,
+ * and the buffer is grown to the exact argument size, so that the parser
+ * can turn the buffer into the argument object as it is.
+ *
+ * The function may run in a network I/O thread, so errors are just
+ * reported in c->iostatus, the caller is in charge of freeing the client.
+ * The number of bytes read is returned. */
+static int readClientSocket(redisClient *c) {
+	size_t qblen, readlen, pending;
+	int nread, totread = 0;
+
+	c->iostatus = REDIS_IOSTATUS_OK;
+	while (1) {
+		qblen = sdslen(c->querybuf);
+		pending = qblen - c->qbpos;
+		readlen = REDIS_IOBUF_LEN;
+		if (c->bulklen >= REDIS_MBULK_BIG_ARG && (size_t)c->bulklen > pending) {
+			/* Don't trust the announced length blindly, grow the buffer
+			 * at most by its current size plus REDIS_IOBUF_LEN a time. */
+			readlen = c->bulklen - pending;
+			if (readlen > qblen + REDIS_IOBUF_LEN)
+				readlen = qblen + REDIS_IOBUF_LEN;
+			c->querybuf = sdsMakeRoomForNonGreedy(c->querybuf, readlen);
+		} else if (qblen == 0) {
+			/* Common case of a client sending a command and waiting for
+			 * the reply: don't double the buffer for nothing */
+			c->querybuf = sdsMakeRoomForNonGreedy(c->querybuf, readlen);
+		} else {
+			c->querybuf = sdsMakeRoomFor(c->querybuf, readlen);
+		}
+		nread = read(c->fd, c->querybuf + qblen, readlen);
+		if (nread == -1) {
+			if (errno == EAGAIN) break;
+			c->iostatus = REDIS_IOSTATUS_ERR;
+			c->ioerrno = errno;
+			break;
+		} else if (nread == 0) {
+			if (totread) {
+				/* Process what we already read first, we'll get the EOF
+				 * again in the next event. */
+				aeRearmFileEvent(server.el, c->fd);
+				break;
+			}
+			c->iostatus = REDIS_IOSTATUS_EOF;
+			break;
+		}
+		// 将读取到的数据追加到querybuf缓冲区中
+		sdsIncrLen(c->querybuf, nread);
+		totread += nread;
+		if ((size_t)nread < readlen) break;
+		if (totread >= REDIS_MAX_READ_PER_EVENT ||
+		    (c->bulklen >= REDIS_MBULK_BIG_ARG &&
+		     (size_t)c->bulklen == sdslen(c->querybuf) - c->qbpos))
+		{
+			/* Also stop when a big argument is complete, before more
+			 * data gets appended to its buffer. */
+			aeRearmFileEvent(server.el, c->fd);
+			break;
 		}
 	}
+	// 设置最后一次交互时间为当前（防止超时被关闭）
+	if (totread) c->lastinteraction = time(NULL);
+	return totread;
+}
+
+/* Free the client if the last socket operation failed. Returns REDIS_ERR
+ * if the client was freed. */
+static int handleClientIOStatus(redisClient *c, char *op) {
+	if (c->iostatus == REDIS_IOSTATUS_OK) return REDIS_OK;
+	if (c->iostatus == REDIS_IOSTATUS_EOF)
+		redisLog(REDIS_VERBOSE, "Client closed connection");
+	else
+		redisLog(REDIS_VERBOSE, "%s client: %s", op, strerror(c->ioerrno));
+	freeClient(c);
+	return REDIS_ERR;
 }
 
 static void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
 	redisClient *c = (redisClient*) privdata;
-	char buf[REDIS_IOBUF_LEN];
 	int nread;
 	REDIS_NOTUSED(el);
+	REDIS_NOTUSED(fd);
 	REDIS_NOTUSED(mask);
 
-	// 每次只读1K数据，也就是每次只处理1K数据（如果一次请求超过1K，则需要分次读取处理）
-	nread = read(fd, buf, REDIS_IOBUF_LEN);
-	if (nread == -1) {
-		if (errno == EAGAIN) {
-			nread = 0;
-		} else {
-			redisLog(REDIS_VERBOSE, "Reading from client: %s", strerror(errno));
-			freeClient(c);
-			return;
-		}
-	} else if (nread == 0) {
-		redisLog(REDIS_VERBOSE, "Client closed connection");
-		freeClient(c);
-		return;
-	}
-	if (nread) {
-		// 将读取到的数据拼接到querybuf缓冲区中
-		c->querybuf = sdscatlen(c->querybuf, buf, nread);
-		// 设置最后一次交互时间为当前（防止超时被关闭）
-		c->lastinteraction = time(NULL);
-	} else {
+	/* Let the network I/O threads read and parse the query if possible */
+	if (server.netio_active && !(c->flags & REDIS_PENDING_READ) &&
+	        clientCanUseNetIOThreads(c))
+	{
+		c->flags |= REDIS_PENDING_READ;
+		listAddNodeTail(server.clients_pending_read, c);
 		return;
 	}
-	processInputBuffer(c);
+	nread = readClientSocket(c);
+	if (handleClientIOStatus(c, "Reading from") == REDIS_ERR) return;
+	if (nread) processInputBuffer(c);
 }
 
-static int selectDb(redisClient *c, int id) {
-	if (id < 0 || id >= server.dbnum)
-		return REDIS_ERR;
-	c->db = &server.db[id];
-	return REDIS_OK;
+/* ========================= Network I/O threads ============================ */
+
+/* Clients whose socket I/O can be performed by the network I/O threads.
+ * Masters, slaves and monitors use their own handlers, and blocked clients
+ * must not have their next command parsed. */
+static int clientCanUseNetIOThreads(redisClient *c) {
+	return !(c->flags & (REDIS_MASTER | REDIS_SLAVE | REDIS_MONITOR |
+	                     REDIS_BLOCKED | REDIS_IO_WAIT)) &&
+	       c->replstate == REDIS_REPL_NONE;
 }
 
-static void *dupClientReplyValue(void *o) {
-	incrRefCount((robj*)o);
-	return 0;
+/* Write the client replies using writev() until everything is sent or the
+ * socket would block. The static reply buffer is emptied as usual, but reply
+ * objects are not removed from the list, as the
+ * same object may be referenced by other clients (think at shared.ok) and
+ * refcounting is not thread safe: the first c->iowrittenobjs objects were
+ * fully written and c->sentlen bytes of the next one, the main thread will
+ * release them. Errors are reported in c->iostatus.
+ *
+ * Called by the network I/O threads. */
+static int writeClientSocket(redisClient *c) {
+	struct iovec iov[REDIS_WRITEV_IOVEC_COUNT];
+	listNode *node = listFirst(c->reply), *next;
+	int ion, offset, partial, totwritten = 0;
+	ssize_t nwritten, willwrite;
+
+	c->iostatus = REDIS_IOSTATUS_OK;
+	c->iowrittenobjs = 0;
+	while (c->bufpos > 0 || node) {
+		robj *o;
+
+		/* fill-in the iov[] array, the static buffer goes first */
+		ion = 0;
+		offset = c->sentlen;
+		willwrite = 0;
+		if (c->bufpos > 0) {
+			iov[0].iov_base = c->buf + c->sentlen;
+			iov[0].iov_len = c->bufpos - c->sentlen;
+			willwrite = iov[0].iov_len;
+			offset = 0;
+			ion = 1;
+		}
+		for (next = node; next && ion < REDIS_WRITEV_IOVEC_COUNT;
+		        next = listNextNode(next), ion++) {
+			o = listNodeValue(next);
+			iov[ion].iov_base = ((char*)o->ptr) + offset;
+			iov[ion].iov_len = sdslen(o->ptr) - offset;
+			willwrite += iov[ion].iov_len;
+			offset = 0; /* just for the first item */
+		}
+
+		if ((nwritten = writev(c->fd, iov, ion)) == -1) {
+			if (errno != EAGAIN) {
+				c->iostatus = REDIS_IOSTATUS_ERR;
+				c->ioerrno = errno;
+			}
+			break;
+		}
+		totwritten += nwritten;
+		partial = (nwritten < willwrite);
+
+		/* Skip the buffer and the objects we fully sent */
+		if (c->bufpos > 0) {
+			if (nwritten < c->bufpos - c->sentlen) {
+				c->sentlen += nwritten;
+				break;
+			}
+			nwritten -= c->bufpos - c->sentlen;
+			c->bufpos = 0;
+			c->sentlen = 0;
+		}
+		while (node) {
+			size_t left;
+
+			o = listNodeValue(node);
+			left = sdslen(o->ptr) - c->sentlen;
+			if ((size_t)nwritten < left) {
+				c->sentlen += nwritten;
+				break;
+			}
+			nwritten -= left;
+			c->sentlen = 0;
+			c->iowrittenobjs++;
+			node = listNextNode(node);
+		}
+		/* Short write: the socket buffer is full */
+		if (partial) break;
+	}
+	if (totwritten) c->lastinteraction = time(NULL);
+	return totwritten;
 }
 
-static redisClient *createClient(int fd) {
-	redisClient *c = zmalloc(sizeof(*c));
+/* Serve the clients assigned to the I/O thread 'id' (0 is the main thread)
+ * for the current batch. */
+static void processNetIOList(int id) {
+	listIter li;
+	listNode *ln;
 
-	// 设置为非阻塞
-	anetNonBlock(NULL, fd);
-	// 关闭掉Nagel算法
-	anetTcpNoDelay(NULL, fd);
+	listRewind(server.netio_lists[id], &li);
+	while ((ln = listNext(&li))) {
+		redisClient *c = ln->value;
+
+		if (server.netio_op == REDIS_NETIO_OP_WRITE) {
+			writeClientSocket(c);
+		} else if (readClientSocket(c) && c->iostatus == REDIS_IOSTATUS_OK) {
+			/* Parse the first command as well, the main thread will
+			 * execute it and parse the rest of the buffer, if any. */
+			c->parsestatus = parseQueryBuffer(c);
+			if (c->parsestatus != REDIS_PARSE_INCOMPLETE)
+				c->flags |= REDIS_PENDING_COMMAND;
+		}
+	}
+}
+
+static void *netIOThreadEntryPoint(void *arg) {
+	int id = (int)(long) arg;
+	unsigned long batch = 0;
+
+	while (1) {
+		/* Wait for the main thread to start a new batch */
+		pthread_mutex_lock(&server.netio_mutex);
+		while (server.netio_batch == batch)
+			pthread_cond_wait(&server.netio_start_cond, &server.netio_mutex);
+		batch = server.netio_batch;
+		pthread_mutex_unlock(&server.netio_mutex);
+
+		processNetIOList(id);
+
+		pthread_mutex_lock(&server.netio_mutex);
+		if (--server.netio_pending == 0)
+			pthread_cond_signal(&server.netio_done_cond);
+		pthread_mutex_unlock(&server.netio_mutex);
+	}
+	return NULL;
+}
+
+/* Perform the socket I/O of all the clients in the 'clients' list, spreading
+ * them among the I/O threads and the main thread, and wait for all the
+ * threads to finish. With just a few clients everything is done by the
+ * main thread. */
+static void processClientsWithNetIOThreads(list *clients, int op) {
+	int j = 0, nthreads = server.netio_threads;
+	listIter li;
+	listNode *ln;
+
+	if (listLength(clients) <
+	        (unsigned long) nthreads * REDIS_NETIO_MIN_CLIENTS_PER_THREAD)
+		nthreads = 1;
+	listRewind(clients, &li);
+	while ((ln = listNext(&li))) {
+		listAddNodeTail(server.netio_lists[j], ln->value);
+		j = (j + 1) % nthreads;
+	}
+	server.netio_op = op;
+	if (nthreads > 1) {
+		pthread_mutex_lock(&server.netio_mutex);
+		server.netio_pending = server.netio_threads - 1;
+		server.netio_batch++;
+		pthread_cond_broadcast(&server.netio_start_cond);
+		pthread_mutex_unlock(&server.netio_mutex);
+	}
+	processNetIOList(0);
+	if (nthreads > 1) {
+		pthread_mutex_lock(&server.netio_mutex);
+		while (server.netio_pending)
+			pthread_cond_wait(&server.netio_done_cond, &server.netio_mutex);
+		pthread_mutex_unlock(&server.netio_mutex);
+		if (op == REDIS_NETIO_OP_READ)
+			server.stat_netio_reads += listLength(clients);
+		else
+			server.stat_netio_writes += listLength(clients);
+	}
+	for (j = 0; j < nthreads; j++) {
+		list *l = server.netio_lists[j];
+
+		while (listLength(l)) listDelNode(l, listFirst(l));
+	}
+}
+
+static void handleClientsWithPendingReads(void) {
+	if (listLength(server.clients_pending_read) == 0) return;
+	processClientsWithNetIOThreads(server.clients_pending_read,
+	                               REDIS_NETIO_OP_READ);
+	/* Execute the commands, in the main thread */
+	while (listLength(server.clients_pending_read)) {
+		listNode *ln = listFirst(server.clients_pending_read);
+		redisClient *c = ln->value;
+
+		listDelNode(server.clients_pending_read, ln);
+		c->flags &= ~REDIS_PENDING_READ;
+		if (handleClientIOStatus(c, "Reading from") == REDIS_ERR) continue;
+		processInputBuffer(c);
+	}
+}
+
+static void handleClientsWithPendingWrites(void) {
+	if (listLength(server.clients_pending_write) == 0) return;
+	processClientsWithNetIOThreads(server.clients_pending_write,
+	                               REDIS_NETIO_OP_WRITE);
+	while (listLength(server.clients_pending_write)) {
+		listNode *ln = listFirst(server.clients_pending_write);
+		redisClient *c = ln->value;
+
+		listDelNode(server.clients_pending_write, ln);
+		c->flags &= ~REDIS_PENDING_WRITE;
+		if (handleClientIOStatus(c, "Writing to") == REDIS_ERR) continue;
+		/* Release the objects the I/O thread was able to send */
+		while (c->iowrittenobjs) {
+			listDelNode(c->reply, listFirst(c->reply));
+			c->iowrittenobjs--;
+		}
+		/* Let the usual handler send the rest when the socket is writable */
+		if ((c->bufpos > 0 || listLength(c->reply)) &&
+		        aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+		                          sendReplyToClient, c) == AE_ERR)
+			freeClient(c);
+	}
+}
+
+/* Called by the event loop before to sleep waiting for new events */
+static void beforeSleep(struct aeEventLoop *eventLoop) {
+	REDIS_NOTUSED(eventLoop);
+	handleClientsWithPendingReads();
+	handleClientsWithPendingWrites();
+}
+
+static void initNetIOThreads(void) {
+	pthread_t thread;
+	int j, err;
+
+	server.clients_pending_read = listCreate();
+	server.clients_pending_write = listCreate();
+	server.netio_active = 0;
+	server.stat_netio_reads = 0;
+	server.stat_netio_writes = 0;
+	if (server.netio_threads <= 1) return;
+
+	zmalloc_enable_thread_safeness(); /* we need thread safe zmalloc() */
+	server.netio_lists = zmalloc(sizeof(list*)*server.netio_threads);
+	for (j = 0; j < server.netio_threads; j++)
+		server.netio_lists[j] = listCreate();
+	server.netio_pending = 0;
+	server.netio_batch = 0;
+	pthread_mutex_init(&server.netio_mutex, NULL);
+	pthread_cond_init(&server.netio_start_cond, NULL);
+	pthread_cond_init(&server.netio_done_cond, NULL);
+	/* Thread 0 is the main thread */
+	for (j = 1; j < server.netio_threads; j++) {
+		err = pthread_create(&thread, NULL, netIOThreadEntryPoint, (void*)(long) j);
+		if (err != 0) {
+			redisLog(REDIS_WARNING, "Unable to start the network I/O threads: %s",
+			         strerror(err));
+			exit(1);
+		}
+	}
+	aeSetBeforeSleepProc(server.el, beforeSleep);
+	server.netio_active = 1;
+	redisLog(REDIS_NOTICE, "Network I/O performed by %d threads",
+	         server.netio_threads);
+}
+
+static int selectDb(redisClient *c, int id) {
+	if (id < 0 || id >= server.dbnum)
+		return REDIS_ERR;
+	c->db = &server.db[id];
+	return REDIS_OK;
+}
+
+static void *dupClientReplyValue(void *o) {
+	incrRefCount((robj*)o);
+	return 0;
+}
+
+static redisClient *createClient(int fd) {
+	redisClient *c = zmalloc(sizeof(*c));
+
+	/* The socket is expected to be already in non blocking mode */
+	// 关闭掉Nagel算法
+	anetTcpNoDelay(NULL, fd);
 	if (!c) return NULL;
 	// 默认使用0号数据库
 	selectDb(c, 0);
 	c->fd = fd;
 	c->querybuf = sdsempty();
+	c->qbpos = 0;
 	c->argc = 0;
 	c->argv = NULL;
+	c->argvlen = 0;
 	c->bulklen = -1;
 	c->multibulk = 0;
-	c->mbargc = 0;
-	c->mbargv = NULL;
 	c->sentlen = 0;
 	c->flags = 0;
 	c->lastinteraction = time(NULL);
@@ -2442,6 +3312,12 @@ static redisClient *createClient(int fd) {
 	c->blockingkeysnum = 0;
 	c->io_keys = listCreate();
 	listSetFreeMethod(c->io_keys, decrRefCount);
+	c->iostatus = REDIS_IOSTATUS_OK;
+	c->ioerrno = 0;
+	c->iowrittenobjs = 0;
+	c->parsestatus = REDIS_PARSE_INCOMPLETE;
+	c->parseerr = NULL;
+	c->bufpos = 0;
 	// 设置客户端请求数据的处理方法
 	if (aeCreateFileEvent(server.el, c->fd, AE_READABLE,
 	                      readQueryFromClient, c) == AE_ERR) {
@@ -2455,17 +3331,48 @@ static redisClient *createClient(int fd) {
 	return c;
 }
 
-// 添加客户端应答消息
-static void addReply(redisClient *c, robj *obj) {
+/* Copy a reply in the client static buffer. Fails if the reply doesn't fit
+ * or if there are already objects in the reply list, to preserve the
+ * order of the replies. */
+static int addReplyToBuffer(redisClient *c, char *s, size_t len) {
+	if (listLength(c->reply) > 0) return REDIS_ERR;
+	if (len > sizeof(c->buf) - c->bufpos) return REDIS_ERR;
+	memcpy(c->buf + c->bufpos, s, len);
+	c->bufpos += len;
+	return REDIS_OK;
+}
 
-	// 如果当前没有应答消息（说明没有创建发送应答处理句柄）
-	// 并且当前客户端不是Master，或者是Slave且处于在线状态，才创建发送应答方法
-	if (listLength(c->reply) == 0 &&
-	        (c->replstate == REDIS_REPL_NONE ||
-	         c->replstate == REDIS_REPL_ONLINE) &&
-	        aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
-	                          sendReplyToClient, c) == AE_ERR) return;
+/* Append a small reply to the reply list. It is appended to the last object
+ * of the list if it is not referenced by anything else and has room for
+ * it, otherwise copied in a new object of REDIS_REPLY_CHUNK_BYTES that the
+ * next small replies will fill, so that a long list of small replies does
+ * not use a list node (and a shared object reference) for each of them. */
+static void addReplyStringToList(redisClient *c, char *s, size_t len) {
+	listNode *ln = listLast(c->reply);
+	robj *tail = ln ? listNodeValue(ln) : NULL;
 
+	if (tail && tail->refcount == 1 &&
+	        tail->encoding == REDIS_ENCODING_RAW &&
+	        sdslen(tail->ptr) + len <= REDIS_REPLY_CHUNK_BYTES)
+	{
+		tail->ptr = sdscatlen(tail->ptr, s, len);
+	} else {
+		sds chunk = sdsMakeRoomForNonGreedy(sdsempty(), REDIS_REPLY_CHUNK_BYTES);
+
+		chunk = sdscatlen(chunk, s, len);
+		listAddNodeTail(c->reply, createObject(REDIS_STRING, chunk));
+	}
+}
+
+/* Append an object to the reply list: small replies are copied, see
+ * addReplyStringToList(), big objects are just referenced. */
+static void addReplyObjectToList(redisClient *c, robj *obj) {
+	if (sdsEncodedObject(obj) &&
+	        sdslen(obj->ptr) <= GLUEREPLY_UP_TO)
+	{
+		addReplyStringToList(c, obj->ptr, sdslen(obj->ptr));
+		return;
+	}
 	if (server.vm_enabled && obj->storage != REDIS_VM_MEMORY) {
 		obj = dupStringObject(obj);
 		obj->refcount = 0; /* getDecodedObject() will increment the refcount */
@@ -2473,24 +3380,161 @@ static void addReply(redisClient *c, robj *obj) {
 	listAddNodeTail(c->reply, getDecodedObject(obj));
 }
 
+/* Called before to add a reply: when the first reply is added the client
+ * is registered in order for the replies to be sent. REDIS_ERR is returned
+ * if the reply can't be delivered and should not be added. */
+static int prepareClientToWrite(redisClient *c) {
+	// 如果当前没有应答消息（说明没有创建发送应答处理句柄）
+	// 并且当前客户端不是Master，或者是Slave且处于在线状态，才创建发送应答方法
+	if (c->bufpos == 0 && listLength(c->reply) == 0 &&
+	        (c->replstate == REDIS_REPL_NONE ||
+	         c->replstate == REDIS_REPL_ONLINE))
+	{
+		/* With network I/O threads the reply is flushed before the next
+		 * poll, and the write handler is only installed if the socket
+		 * can't take all the data. */
+		if (server.netio_active && clientCanUseNetIOThreads(c)) {
+			if (!(c->flags & REDIS_PENDING_WRITE)) {
+				c->flags |= REDIS_PENDING_WRITE;
+				listAddNodeTail(server.clients_pending_write, c);
+			}
+		} else if (aeCreateFileEvent(server.el, c->fd, AE_WRITABLE,
+		                             sendReplyToClient, c) == AE_ERR) {
+			return REDIS_ERR;
+		}
+	}
+	return REDIS_OK;
+}
+
+// 添加客户端应答消息
+static void addReply(redisClient *c, robj *obj) {
+	if (prepareClientToWrite(c) != REDIS_OK) return;
+
+	/* Small replies are copied in the static buffer, big ones are just
+	 * referenced by the reply list */
+	if (sdsEncodedObject(obj)) {
+		if (addReplyToBuffer(c, obj->ptr, sdslen(obj->ptr)) == REDIS_OK)
+			return;
+	} else if (obj->type == REDIS_STRING && obj->encoding == REDIS_ENCODING_INT) {
+		char buf[32];
+		int len = ll2string(buf, sizeof(buf), (long)obj->ptr);
+
+		if (addReplyToBuffer(c, buf, len) == REDIS_OK) return;
+	}
+	addReplyObjectToList(c, obj);
+}
+
+/* Add a reply copying it from a C buffer */
+static void addReplyString(redisClient *c, char *s, size_t len) {
+	if (prepareClientToWrite(c) != REDIS_OK) return;
+	if (addReplyToBuffer(c, s, len) == REDIS_OK) return;
+	if (len <= GLUEREPLY_UP_TO)
+		addReplyStringToList(c, s, len);
+	else
+		listAddNodeTail(c->reply, createStringObject(s, len));
+}
+
 static void addReplySds(redisClient *c, sds s) {
-	robj *o = createObject(REDIS_STRING, s);
-	addReply(c, o);
+	robj *o;
+
+	if (prepareClientToWrite(c) != REDIS_OK ||
+	        addReplyToBuffer(c, s, sdslen(s)) == REDIS_OK) {
+		sdsfree(s);
+		return;
+	}
+	o = createObject(REDIS_STRING, s);
+	addReplyObjectToList(c, o);
+	decrRefCount(o);
+}
+
+/* Format "<prefix><ll>\r\n" in buf, that must be at least 32 bytes.
+ * Returns the length of the header. */
+static int formatReplyHeader(char *buf, char prefix, long long ll) {
+	int len;
+
+	buf[0] = prefix;
+	len = 1 + ll2string(buf + 1, 30, ll);
+	buf[len++] = '\r';
+	buf[len++] = '\n';
+	return len;
+}
+
+/* Add an integer reply (prefix ':'), a bulk length ('$') or a multi bulk
+ * length ('*'). Small values use the preformatted shared objects. */
+static void addReplyLongLongWithPrefix(redisClient *c, long long ll, char prefix) {
+	char buf[32];
+
+	if (ll >= 0 && ll < REDIS_SHARED_HDR_LEN) {
+		if (prefix == ':')
+			addReply(c, shared.intreply[ll]);
+		else if (prefix == '$')
+			addReply(c, shared.bulkhdr[ll]);
+		else
+			addReply(c, shared.mbulkhdr[ll]);
+		return;
+	}
+	addReplyString(c, buf, formatReplyHeader(buf, prefix, ll));
+}
+
+static void addReplyLongLong(redisClient *c, long long ll) {
+	addReplyLongLongWithPrefix(c, ll, ':');
+}
+
+static void addReplyMultiBulkLen(redisClient *c, long long length) {
+	addReplyLongLongWithPrefix(c, length, '*');
+}
+
+/* Add a placeholder for a reply only known after the next ones are added,
+ * like the length of a multi bulk reply with an unknown number of elements.
+ * The replies added after it go in the reply list as well, and the
+ * placeholder must be filled with setDeferredReplyLength() by the same
+ * command. */
+static robj *addDeferredReply(redisClient *c) {
+	robj *o = createObject(REDIS_STRING, NULL);
+
+	if (prepareClientToWrite(c) == REDIS_OK) {
+		listAddNodeTail(c->reply, o);
+		incrRefCount(o);
+	}
+	return o;
+}
+
+/* Set the deferred reply 'o' to "<prefix><length>\r\n" */
+static void setDeferredReplyLength(robj *o, char prefix, long long length) {
+	char buf[32];
+
+	o->ptr = sdsnewlen(buf, formatReplyHeader(buf, prefix, length));
 	decrRefCount(o);
 }
 
 static void addReplyDouble(redisClient *c, double d) {
 	char buf[128];
+	int len;
 
-	snprintf(buf, sizeof(buf), "%.17g", d);
-	addReplySds(c, sdscatprintf(sdsempty(), "$%lu\r\n%s\r\n",
-	                            (unsigned long) strlen(buf), buf));
+	len = snprintf(buf, sizeof(buf), "%.17g", d);
+	addReplyLongLongWithPrefix(c, len, '$');
+	addReplyString(c, buf, len);
+	addReply(c, shared.crlf);
+}
+
+/* Add a bulk reply copying it from a C buffer */
+static void addReplyBulkCBuffer(redisClient *c, void *p, size_t len) {
+	addReplyLongLongWithPrefix(c, len, '$');
+	addReplyString(c, p, len);
+	addReply(c, shared.crlf);
+}
+
+/* Add an integer as a bulk reply */
+static void addReplyBulkLongLong(redisClient *c, long long ll) {
+	char buf[32];
+
+	addReplyBulkCBuffer(c, buf, ll2string(buf, sizeof(buf), ll));
 }
 
 static void addReplyBulkLen(redisClient *c, robj *obj) {
 	size_t len;
 
-	if (obj->encoding == REDIS_ENCODING_RAW) {
+	if (sdsEncodedObject(obj)) {
 		len = sdslen(obj->ptr);
 	} else {
 		long n = (long)obj->ptr;
@@ -2505,29 +3549,18 @@ static void addReplyBulkLen(redisClient *c, robj *obj) {
 			len++;
 		}
 	}
-	addReplySds(c, sdscatprintf(sdsempty(), "$%lu\r\n", (unsigned long)len));
+	addReplyLongLongWithPrefix(c, len, '$');
 }
 
-// 客户端接入的时候处理句柄
-static void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
-	int cport, cfd;
-	char cip[128];
+static void acceptCommonHandler(int cfd, char *cip, int cport) {
 	redisClient *c;
-	REDIS_NOTUSED(el);
-	REDIS_NOTUSED(mask);
-	REDIS_NOTUSED(privdata);
 
-	// 接收连接
-	cfd = anetAccept(server.neterr, fd, cip, &cport);
-	if (cfd == AE_ERR) {
-		redisLog(REDIS_VERBOSE, "Accepting client connection: %s", server.neterr);
-		return;
-	}
 	redisLog(REDIS_VERBOSE, "Accepted %s:%d", cip, cport);
 	// 初始化客户端所需的信息
 	if ((c = createClient(cfd)) == NULL) {
 		redisLog(REDIS_WARNING, "Error allocating resoures for the client");
 		close(cfd); /* May be already closed, just ingore errors */
+		server.stat_rejected_conn++;
 		return;
 	}
 	/* If maxclient directive is set and this is one client more... close the
@@ -2543,28 +3576,197 @@ static void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
 			/* Nothing to do, Just to avoid the warning... */
 		}
 		freeClient(c);
+		server.stat_rejected_conn++;
 		return;
 	}
 	// 增加连接数
 	server.stat_numconnections++;
 }
 
+// 客户端接入的时候处理句柄
+static void acceptHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+	anetAcceptedConn conns[REDIS_ACCEPT_BATCH];
+	int j, n, accepted = 0;
+	REDIS_NOTUSED(mask);
+	REDIS_NOTUSED(privdata);
+
+	/* Drain the accept queue, so that a burst of connections is served
+	 * with a single event, up to REDIS_MAX_ACCEPTS_PER_CALL connections in
+	 * order to serve the already connected clients as well. */
+	do {
+		// 接收连接
+		n = anetAcceptBatch(server.neterr, fd, conns, REDIS_ACCEPT_BATCH);
+		if (n == ANET_ERR) {
+			redisLog(REDIS_VERBOSE, "Accepting client connection: %s", server.neterr);
+			return;
+		}
+		for (j = 0; j < n; j++)
+			acceptCommonHandler(conns[j].fd, conns[j].ip, conns[j].port);
+		accepted += n;
+	} while (n == REDIS_ACCEPT_BATCH && accepted < REDIS_MAX_ACCEPTS_PER_CALL);
+	/* Stopped because of the limit: in edge triggered mode make sure
+	 * we are notified again. */
+	if (n == REDIS_ACCEPT_BATCH) aeRearmFileEvent(el, fd);
+}
+
 /* ======================= Redis objects implementation ===================== */
 
+/* Freed objects are recycled without locks: every thread (the main thread,
+ * the VM and network I/O threads) caches them in two "magazines" of up to
+ * server.objcache_batch objects, linked by their ptr field. Objects are
+ * taken from and released to the current magazine, and full magazines are
+ * exchanged with the global pool, so the pool is only touched once every
+ * server.objcache_batch operations at most. */
+static __thread robj *objcache = NULL;     /* Current magazine */
+static __thread int objcache_len = 0;
+static __thread robj *objcache_prev = NULL; /* A full magazine or NULL */
+static __thread long long objcache_hits = 0; /* Not yet added to the stats */
+
+static void initObjectPool(void) {
+	unsigned long slots, j;
+
+	server.stat_objcache_hits = 0;
+	server.stat_objcache_misses = 0;
+	server.objpool_full = server.objpool_empty = 0;
+	server.objcache_batch = server.objcache_size / 2;
+	if (server.objcache_batch == 0) return;
+	slots = REDIS_OBJFREELIST_MAX / server.objcache_batch + 1;
+	server.objpool_batches = zmalloc(sizeof(robj*) * slots);
+	server.objpool_next = zmalloc(sizeof(uint32_t) * slots);
+	/* Slots are numbered from 1 in the stacks, 0 is the empty stack */
+	for (j = 0; j < slots; j++)
+		server.objpool_next[j] = (j + 1 < slots) ? j + 2 : 0;
+	server.objpool_empty = 1;
+}
+
+/* Pop a slot from the stack, returns 0 if empty */
+static uint32_t objpoolPop(volatile uint64_t *stack) {
+	uint64_t head, newhead;
+	uint32_t slot;
+
+	do {
+		head = *stack;
+		slot = (uint32_t) head;
+		if (slot == 0) return 0;
+		/* The slot may be taken and pushed again by another thread after
+		 * reading its next slot, but then the tag in the head changed. */
+		newhead = (((head >> 32) + 1) << 32) | server.objpool_next[slot - 1];
+	} while (!__sync_bool_compare_and_swap(stack, head, newhead));
+	return slot;
+}
+
+static void objpoolPush(volatile uint64_t *stack, uint32_t slot) {
+	uint64_t head, newhead;
+
+	do {
+		head = *stack;
+		server.objpool_next[slot - 1] = (uint32_t) head;
+		newhead = (((head >> 32) + 1) << 32) | slot;
+	} while (!__sync_bool_compare_and_swap(stack, head, newhead));
+}
+
+static void objcacheFlushStats(void) {
+	if (objcache_hits) {
+		__sync_fetch_and_add(&server.stat_objcache_hits, objcache_hits);
+		objcache_hits = 0;
+	}
+}
+
+static void freeObjectChain(robj *o) {
+	robj *next;
+
+	while (o) {
+		next = o->ptr;
+		zfree(o);
+		o = next;
+	}
+}
+
+/* Move a full magazine to the global pool, or free its objects if the
+ * pool is full */
+static void objpoolPutBatch(robj *batch) {
+	uint32_t slot = objpoolPop(&server.objpool_empty);
+
+	objcacheFlushStats();
+	if (slot == 0) {
+		freeObjectChain(batch);
+		return;
+	}
+	server.objpool_batches[slot - 1] = batch;
+	objpoolPush(&server.objpool_full, slot);
+}
+
+/* Take a full magazine from the global pool, returns NULL if empty */
+static robj *objpoolGetBatch(void) {
+	uint32_t slot = objpoolPop(&server.objpool_full);
+	robj *batch;
+
+	objcacheFlushStats();
+	if (slot == 0) return NULL;
+	batch = server.objpool_batches[slot - 1];
+	objpoolPush(&server.objpool_empty, slot);
+	return batch;
+}
+
+/* Get a free object from the cache of the calling thread, returns NULL if
+ * there are no free objects */
+static robj *objcacheGet(void) {
+	robj *o;
+
+	if (objcache == NULL) {
+		if (objcache_prev) {
+			objcache = objcache_prev;
+			objcache_prev = NULL;
+		} else if (server.objcache_batch == 0 ||
+		           (objcache = objpoolGetBatch()) == NULL) {
+			__sync_fetch_and_add(&server.stat_objcache_misses, 1);
+			return NULL;
+		}
+		objcache_len = server.objcache_batch;
+	}
+	o = objcache;
+	objcache = o->ptr;
+	objcache_len--;
+	objcache_hits++;
+	return o;
+}
+
+/* Put a freed object in the cache of the calling thread */
+static void objcacheRelease(robj *o) {
+	if (server.objcache_batch == 0) {
+		zfree(o);
+		return;
+	}
+	if (objcache_len == server.objcache_batch) {
+		if (objcache_prev) objpoolPutBatch(objcache_prev);
+		objcache_prev = objcache;
+		objcache = NULL;
+		objcache_len = 0;
+	}
+	o->ptr = objcache;
+	objcache = o;
+	objcache_len++;
+}
+
+/* Release the objects cached by the calling thread, that is going to exit */
+static void flushObjectCache(void) {
+	if (objcache_prev) objpoolPutBatch(objcache_prev);
+	if (objcache_len == server.objcache_batch && objcache)
+		objpoolPutBatch(objcache);
+	else
+		freeObjectChain(objcache);
+	objcache = objcache_prev = NULL;
+	objcache_len = 0;
+	objcacheFlushStats();
+}
+
 // 创建对象
 static robj *createObject(int type, void *ptr) {
 	robj *o;
 
-	if (server.vm_enabled) pthread_mutex_lock(&server.obj_freelist_mutex);
-	if (listLength(server.objfreelist)) {
-		// 如果对象池中有对象，则直接取来用
-		listNode *head = listFirst(server.objfreelist);
-		o = listNodeValue(head);
-		listDelNode(server.objfreelist, head);
-		if (server.vm_enabled) pthread_mutex_unlock(&server.obj_freelist_mutex);
-	} else {
+	// 如果对象池中有对象，则直接取来用
+	if ((o = objcacheGet()) == NULL) {
 		if (server.vm_enabled) {
-			pthread_mutex_unlock(&server.obj_freelist_mutex);
 			o = zmalloc(sizeof(*o));
 		} else {
 			// 没有才分配一个新的对象
@@ -2590,35 +3792,109 @@ static robj *createObject(int type, void *ptr) {
 	return o;
 }
 
+/* Create a string object with the object header and the sds string in
+ * the same allocation: this saves an allocation (and its malloc overhead)
+ * per short string, and a cache miss when accessing the value. The sds
+ * string can't be reallocated, so it must never be modified in place. */
+static robj *createEmbeddedStringObject(char *ptr, size_t len) {
+	size_t objlen = server.vm_enabled ? sizeof(robj) :
+	                sizeof(robj) - sizeof(struct redisObjectVM);
+	robj *o = zmalloc(objlen + sizeof(struct sdshdr) + len + 1);
+	struct sdshdr *sh = (void*)((char*)o + objlen);
+
+	sh->len = len;
+	sh->free = 0;
+	if (ptr)
+		memcpy(sh->buf, ptr, len);
+	else
+		memset(sh->buf, 0, len);
+	sh->buf[len] = '\0';
+	o->type = REDIS_STRING;
+	o->encoding = REDIS_ENCODING_EMBSTR;
+	o->ptr = sh->buf;
+	o->refcount = 1;
+	if (server.vm_enabled) {
+		o->vm.atime = server.unixtime;
+		o->storage = REDIS_VM_MEMORY;
+	}
+	return o;
+}
+
 // 创建String对象
 static robj *createStringObject(char *ptr, size_t len) {
+	if (len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT)
+		return createEmbeddedStringObject(ptr, len);
 	return createObject(REDIS_STRING, sdsnewlen(ptr, len));
 }
 
+/* Create a string object holding 'value', integer encoded if possible */
+static robj *createStringObjectFromLongLong(long long value) {
+	robj *o;
+
+	if (value >= 0 && value < server.shared_integers)
+		return shared.integers[value];
+	if (value >= LONG_MIN && value <= LONG_MAX) {
+		o = createObject(REDIS_STRING, (void*)((long)value));
+		o->encoding = REDIS_ENCODING_INT;
+	} else {
+		char buf[32];
+
+		o = createStringObject(buf, ll2string(buf, sizeof(buf), value));
+	}
+	return o;
+}
+
 // 复制一个String对象（只复制元数据，浅复制，对应的值只复制"引用"（指针））
 static robj *dupStringObject(robj *o) {
-	assert(o->encoding == REDIS_ENCODING_RAW);
+	assert(sdsEncodedObject(o));
 	return createStringObject(o->ptr, sdslen(o->ptr));
 }
 
 // 创建List对象
+/* Big lists are chunk lists, see chunklist.c */
 static robj *createListObject(void) {
-	list *l = listCreate();
+	robj *o = createObject(REDIS_LIST, chunklistNew());
 
-	// List内释放节点的值方法为decrRefCount
-	listSetFreeMethod(l, decrRefCount);
-	return createObject(REDIS_LIST, l);
+	o->encoding = REDIS_ENCODING_CHUNKLIST;
+	return o;
+}
+
+/* Create a small List packed in a single allocation, see ziplist.c */
+static robj *createZiplistObject(void) {
+	robj *o = createObject(REDIS_LIST, ziplistNew());
+
+	o->encoding = REDIS_ENCODING_ZIPLIST;
+	return o;
+}
+
+/* Create the hash table of a Set or Sorted Set, see open-addressing-sets
+ * in redis.conf */
+static dict *createSetDict(dictType *type) {
+	if (server.setsopenaddr)
+		return dictCreateOpenAddressing(type, NULL);
+	return dictCreate(type, NULL);
 }
 
 static robj *createSetObject(void) {
-	dict *d = dictCreate(&setDictType, NULL);
-	return createObject(REDIS_SET, d);
+	dict *d = createSetDict(&setDictType);
+	robj *o = createObject(REDIS_SET, d);
+
+	o->encoding = REDIS_ENCODING_HT;
+	return o;
+}
+
+/* Create a Set of integers, see intset.c */
+static robj *createIntsetObject(void) {
+	robj *o = createObject(REDIS_SET, intsetNew());
+
+	o->encoding = REDIS_ENCODING_INTSET;
+	return o;
 }
 
 static robj *createZsetObject(void) {
 	zset *zs = zmalloc(sizeof(*zs));
 
-	zs->dict = dictCreate(&zsetDictType, NULL);
+	zs->dict = createSetDict(&zsetDictType);
 	zs->zsl = zslCreate();
 	return createObject(REDIS_ZSET, zs);
 }
@@ -2632,11 +3908,17 @@ static void freeStringObject(robj *o) {
 
 // 释放链表对象
 static void freeListObject(robj *o) {
-	listRelease((list*) o->ptr);
+	if (o->encoding == REDIS_ENCODING_ZIPLIST)
+		zfree(o->ptr);
+	else
+		chunklistRelease(o->ptr);
 }
 
 static void freeSetObject(robj *o) {
-	dictRelease((dict*) o->ptr);
+	if (o->encoding == REDIS_ENCODING_INTSET)
+		zfree(o->ptr);
+	else
+		dictRelease((dict*) o->ptr);
 }
 
 static void freeZsetObject(robj *o) {
@@ -2654,7 +3936,7 @@ static void freeHashObject(robj *o) {
 // 增加对象的引用
 static void incrRefCount(robj *o) {
 	redisAssert(!server.vm_enabled || o->storage == REDIS_VM_MEMORY);
-	o->refcount++;
+	if (o->refcount != REDIS_SHARED_REFCOUNT) o->refcount++;
 }
 
 // 降低对象的引用，只有当引用个数为0时才真正释放内存
@@ -2673,15 +3955,16 @@ static void decrRefCount(void *obj) {
 		redisAssert(o->type == REDIS_STRING);
 		freeStringObject(o);
 		vmMarkPagesFree(o->vm.page, o->vm.usedpages);
-		pthread_mutex_lock(&server.obj_freelist_mutex);
-		if (listLength(server.objfreelist) > REDIS_OBJFREELIST_MAX ||
-		        !listAddNodeHead(server.objfreelist, o))
+		/* Embedded strings have their own size, they can't be recycled */
+		if (o->encoding == REDIS_ENCODING_EMBSTR)
 			zfree(o);
-		pthread_mutex_unlock(&server.obj_freelist_mutex);
+		else
+			objcacheRelease(o);
 		server.vm_stats_swapped_objects--;
 		return;
 	}
 	/* Object is in memory, or in the process of being swapped out. */
+	if (o->refcount == REDIS_SHARED_REFCOUNT) return;
 	if (--(o->refcount) == 0) {
 		if (server.vm_enabled && o->storage == REDIS_VM_SWAPPING)
 			vmCancelThreadedIOJob(obj);
@@ -2694,12 +3977,11 @@ static void decrRefCount(void *obj) {
 		case REDIS_HASH: freeHashObject(o); break;
 		default: redisAssert(0 != 0); break;
 		}
-		if (server.vm_enabled) pthread_mutex_lock(&server.obj_freelist_mutex);
 		// 如果对象池中的对象个数没有大于设定的阈值，则将该对象先缓存起来，减少创建和释放的次数
-		if (listLength(server.objfreelist) > REDIS_OBJFREELIST_MAX ||
-		        !listAddNodeHead(server.objfreelist, o))
+		if (o->encoding == REDIS_ENCODING_EMBSTR)
 			zfree(o);
-		if (server.vm_enabled) pthread_mutex_unlock(&server.obj_freelist_mutex);
+		else
+			objcacheRelease(o);
 	}
 }
 
@@ -2829,7 +4111,7 @@ static int isStringRepresentableAsLong(sds s, long *longval) {
 
 	value = strtol(s, &endptr, 10);
 	if (endptr[0] != '\0') return REDIS_ERR;
-	slen = snprintf(buf, 32, "%ld", value);
+	slen = ll2string(buf, 32, value);
 
 	/* If the number converted back into a string is not identical
 	 * then it's not possible to encode the string as integer */
@@ -2838,30 +4120,72 @@ static int isStringRepresentableAsLong(sds s, long *longval) {
 	return REDIS_OK;
 }
 
-/* Try to encode a string object in order to save space */
-static int tryObjectEncoding(robj *o) {
+/* Like isStringRepresentableAsLong() but for string objects, that may be
+ * already integer encoded, and with a long long range. */
+static int isObjectRepresentableAsLongLong(robj *o, long long *llval) {
+	char buf[32], *endptr;
+	long long value;
+	sds s;
+
+	if (o->encoding == REDIS_ENCODING_INT) {
+		if (llval) *llval = (long) o->ptr;
+		return REDIS_OK;
+	}
+	s = o->ptr;
+	if (sdslen(s) == 0 || sdslen(s) > 20) return REDIS_ERR;
+	errno = 0;
+	value = strtoll(s, &endptr, 10);
+	if (endptr[0] != '\0' || errno == ERANGE) return REDIS_ERR;
+	/* "010" or "+1" can't be represented, the string would change */
+	if ((size_t)ll2string(buf, sizeof(buf), value) != sdslen(s) ||
+	        memcmp(buf, s, sdslen(s))) return REDIS_ERR;
+	if (llval) *llval = value;
+	return REDIS_OK;
+}
+
+/* Try to encode a string object in order to save space. The object may be
+ * replaced by a new one, so the returned object must be used instead of
+ * the argument. */
+static robj *tryObjectEncoding(robj *o) {
 	long value;
 	sds s = o->ptr;
+	robj *emb;
 
-	if (o->encoding != REDIS_ENCODING_RAW)
-		return REDIS_ERR; /* Already encoded */
+	if (!sdsEncodedObject(o))
+		return o; /* Already encoded */
 
 	/* It's not save to encode shared objects: shared objects can be shared
 	 * everywhere in the "object space" of Redis. Encoded objects can only
 	 * appear as "values" (and not, for instance, as keys) */
-	if (o->refcount > 1) return REDIS_ERR;
+	if (o->refcount > 1) return o;
 
 	/* Currently we try to encode only strings */
 	redisAssert(o->type == REDIS_STRING);
 
 	/* Check if we can represent this string as a long integer */
-	if (isStringRepresentableAsLong(s, &value) == REDIS_ERR) return REDIS_ERR;
+	if (isStringRepresentableAsLong(s, &value) == REDIS_OK) {
+		/* Ok, this object can be encoded. Small integers, and embedded
+		 * strings that can't be converted in place, are replaced */
+		if (o->encoding == REDIS_ENCODING_EMBSTR ||
+		        (value >= 0 && value < server.shared_integers)) {
+			decrRefCount(o);
+			return createStringObjectFromLongLong(value);
+		}
+		o->encoding = REDIS_ENCODING_INT;
+		sdsfree(o->ptr);
+		o->ptr = (void*) value;
+		return o;
+	}
 
-	/* Ok, this object can be encoded */
-	o->encoding = REDIS_ENCODING_INT;
-	sdsfree(o->ptr);
-	o->ptr = (void*) value;
-	return REDIS_OK;
+	/* Move short raw strings in the object allocation */
+	if (o->encoding == REDIS_ENCODING_RAW &&
+	        sdslen(s) <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT)
+	{
+		emb = createEmbeddedStringObject(s, sdslen(s));
+		decrRefCount(o);
+		return emb;
+	}
+	return o;
 }
 
 /* Get a decoded version of an encoded object (returned as a new object).
@@ -2870,15 +4194,14 @@ static int tryObjectEncoding(robj *o) {
 static robj *getDecodedObject(robj *o) {
 	robj *dec;
 
-	if (o->encoding == REDIS_ENCODING_RAW) {
+	if (sdsEncodedObject(o)) {
 		incrRefCount(o);
 		return o;
 	}
 	if (o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_INT) {
 		char buf[32];
 
-		snprintf(buf, 32, "%ld", (long)o->ptr);
-		dec = createStringObject(buf, strlen(buf));
+		dec = createStringObject(buf, ll2string(buf, 32, (long)o->ptr));
 		return dec;
 	} else {
 		redisAssert(1 != 1);
@@ -2899,15 +4222,15 @@ static int compareStringObjects(robj *a, robj *b) {
 	int bothsds = 1;
 
 	if (a == b) return 0;
-	if (a->encoding != REDIS_ENCODING_RAW) {
-		snprintf(bufa, sizeof(bufa), "%ld", (long) a->ptr);
+	if (!sdsEncodedObject(a)) {
+		ll2string(bufa, sizeof(bufa), (long) a->ptr);
 		astr = bufa;
 		bothsds = 0;
 	} else {
 		astr = a->ptr;
 	}
-	if (b->encoding != REDIS_ENCODING_RAW) {
-		snprintf(bufb, sizeof(bufb), "%ld", (long) b->ptr);
+	if (!sdsEncodedObject(b)) {
+		ll2string(bufb, sizeof(bufb), (long) b->ptr);
 		bstr = bufb;
 		bothsds = 0;
 	} else {
@@ -2916,14 +4239,28 @@ static int compareStringObjects(robj *a, robj *b) {
 	return bothsds ? sdscmp(astr, bstr) : strcmp(astr, bstr);
 }
 
+/* Like compareStringObjects() == 0 but faster: strings of different
+ * length are never compared, and integers are compared as integers. */
+static int equalStringObjects(robj *a, robj *b) {
+	if (sdsEncodedObject(a) && sdsEncodedObject(b)) {
+		size_t alen = sdslen(a->ptr);
+
+		return alen == sdslen(b->ptr) && memcmp(a->ptr, b->ptr, alen) == 0;
+	}
+	if (a->encoding == REDIS_ENCODING_INT &&
+	    b->encoding == REDIS_ENCODING_INT)
+		return a->ptr == b->ptr;
+	return compareStringObjects(a, b) == 0;
+}
+
 static size_t stringObjectLen(robj *o) {
 	redisAssert(o->type == REDIS_STRING);
-	if (o->encoding == REDIS_ENCODING_RAW) {
+	if (sdsEncodedObject(o)) {
 		return sdslen(o->ptr);
 	} else {
 		char buf[32];
 
-		return snprintf(buf, 32, "%ld", (long)o->ptr);
+		return ll2string(buf, 32, (long)o->ptr);
 	}
 }
 
@@ -2975,6 +4312,8 @@ static int rdbSaveLen(FILE *fp, uint32_t len) {
 /* String objects in the form "2391" "-100" without any space and with a
  * range of values that can fit in an 8, 16 or 32 bit signed value can be
  * encoded as integers to save space */
+static int rdbEncodeInteger(long long value, unsigned char *enc);
+
 // 尝试将String类型转换为整型，用于节省空间
 static int rdbTryIntegerEncoding(sds s, unsigned char *enc) {
 	long long value;
@@ -2988,13 +4327,16 @@ static int rdbTryIntegerEncoding(sds s, unsigned char *enc) {
 	* 用于比较是否相同（即使存在0100.00字符串，转换为100，但是字符串不再相同了，也不允许转换，
 	* 因为这样可能会导致客户端存进去的数据和取出来的数据不一致）
 	*/
-	snprintf(buf, 32, "%lld", value);
-
 	/* If the number converted back into a string is not identical
 	 * then it's not possible to encode the string as integer */
-	if (strlen(buf) != sdslen(s) || memcmp(buf, s, sdslen(s))) return 0;
+	if ((size_t)ll2string(buf, 32, value) != sdslen(s) ||
+	        memcmp(buf, s, sdslen(s))) return 0;
+	return rdbEncodeInteger(value, enc);
+}
 
-	/* Finally check if it fits in our ranges */
+/* Encode 'value' in 'enc' as an 8, 16 or 32 bit integer and return the
+ * number of bytes used, or 0 if the value is out of range. */
+static int rdbEncodeInteger(long long value, unsigned char *enc) {
 	if (value >= -(1 << 7) && value <= (1 << 7) - 1) {
 		// 使用的是11自定义编码（见长度编码）
 		enc[0] = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_INT8;
@@ -3018,16 +4360,16 @@ static int rdbTryIntegerEncoding(sds s, unsigned char *enc) {
 }
 
 // 使用LZF压缩算法压缩
-static int rdbSaveLzfStringObject(FILE *fp, robj *obj) {
+static int rdbSaveLzfStringObject(FILE *fp, unsigned char *s, size_t len) {
 	unsigned int comprlen, outlen;
 	unsigned char byte;
 	void *out;
 
 	/* We require at least four bytes compression for this to be worth it */
-	outlen = sdslen(obj->ptr) - 4;
+	outlen = len - 4;
 	if (outlen <= 0) return 0;
 	if ((out = zmalloc(outlen + 1)) == NULL) return 0;
-	comprlen = lzf_compress(obj->ptr, sdslen(obj->ptr), out, outlen);
+	comprlen = lzf_compress(s, len, out, outlen);
 	if (comprlen == 0) {
 		zfree(out);
 		return 0;
@@ -3039,7 +4381,7 @@ static int rdbSaveLzfStringObject(FILE *fp, robj *obj) {
 	byte = (REDIS_RDB_ENCVAL << 6) | REDIS_RDB_ENC_LZF;
 	if (fwrite(&byte, 1, 1, fp) == 0) goto writeerr;
 	if (rdbSaveLen(fp, comprlen) == -1) goto writeerr;
-	if (rdbSaveLen(fp, sdslen(obj->ptr)) == -1) goto writeerr;
+	if (rdbSaveLen(fp, len) == -1) goto writeerr;
 	if (fwrite(out, comprlen, 1, fp) == 0) goto writeerr;
 	zfree(out);
 	return comprlen;
@@ -3049,6 +4391,26 @@ writeerr:
 	return -1;
 }
 
+/* Save a string that is known not to be an integer, like the string
+ * elements of a ziplist, trying LZF compression or verbatim. */
+static int rdbSaveRawString(FILE *fp, unsigned char *s, size_t len) {
+	/* Try LZF compression - under 20 bytes it's unable to compress even
+	 * aaaaaaaaaaaaaaaaaa so skip it */
+	if (server.rdbcompression && len > 20) {
+		int retval;
+
+		retval = rdbSaveLzfStringObject(fp, s, len);
+		if (retval == -1) return -1;
+		if (retval > 0) return 0;
+		/* retval == 0 means data can't be compressed, save the old way */
+	}
+
+	/* Store verbatim */
+	if (rdbSaveLen(fp, len) == -1) return -1;
+	if (len && fwrite(s, len, 1, fp) == 0) return -1;
+	return 0;
+}
+
 /* Save a string objet as [len][data] on disk. If the object is a string
  * representation of an integer value we try to safe it in a special form */
 /* 保存原始字符串
@@ -3070,24 +4432,37 @@ static int rdbSaveStringObjectRaw(FILE *fp, robj *obj) {
 			return 0;
 		}
 	}
+	return rdbSaveRawString(fp, obj->ptr, len);
+}
 
-	/* Try LZF compression - under 20 bytes it's unable to compress even
-	 * aaaaaaaaaaaaaaaaaa so skip it */
-	if (server.rdbcompression && len > 20) {
-		int retval;
+/* Save an integer as a string object, in the same format
+ * rdbSaveStringObject() would use for its string representation. */
+static int rdbSaveLongLongAsStringObject(FILE *fp, long long value) {
+	unsigned char buf[32];
+	int enclen;
 
-		retval = rdbSaveLzfStringObject(fp, obj);
-		if (retval == -1) return -1;
-		if (retval > 0) return 0;
-		/* retval == 0 means data can't be compressed, save the old way */
+	if ((enclen = rdbEncodeInteger(value, buf)) > 0) {
+		if (fwrite(buf, enclen, 1, fp) == 0) return -1;
+	} else {
+		enclen = ll2string((char*)buf, sizeof(buf), value);
+		if (rdbSaveLen(fp, enclen) == -1) return -1;
+		if (fwrite(buf, enclen, 1, fp) == 0) return -1;
 	}
-
-	/* Store verbatim */
-	if (rdbSaveLen(fp, len) == -1) return -1;
-	if (len && fwrite(obj->ptr, len, 1, fp) == 0) return -1;
 	return 0;
 }
 
+/* Save the value of a ziplist entry as a string object */
+static int rdbSaveZiplistEntry(FILE *fp, unsigned char *p) {
+	unsigned char *sval;
+	unsigned int slen;
+	long long lval;
+
+	ziplistGet(p, &sval, &slen, &lval);
+	if (sval)
+		return rdbSaveRawString(fp, sval, slen);
+	return rdbSaveLongLongAsStringObject(fp, lval);
+}
+
 /* Like rdbSaveStringObjectRaw() but handle encoded objects */
 // 和上面的RAW类似，但是会处理编码过的对象（先解码再保存）
 static int rdbSaveStringObject(FILE *fp, robj *obj) {
@@ -3098,7 +4473,7 @@ static int rdbSaveStringObject(FILE *fp, robj *obj) {
 	 * in a child process (BGSAVE). Also this makes sure key objects
 	 * of swapped objects are not incRefCount-ed (an assert does not allow
 	 * this in order to avoid bugs) */
-	if (obj->encoding != REDIS_ENCODING_RAW) {
+	if (!sdsEncodedObject(obj)) {
 		obj = getDecodedObject(obj);
 		retval = rdbSaveStringObjectRaw(fp, obj);
 		decrRefCount(obj);
@@ -3142,32 +4517,48 @@ static int rdbSaveDoubleValue(FILE *fp, double val) {
 // 只是数据结构不一样，所以需要遍历该数据结构，再依次保存）
 static int rdbSaveObject(FILE *fp, robj *o) {
 	if (o->type == REDIS_STRING) {
-		/* Save a string value */
-		if (rdbSaveStringObject(fp, o) == -1) return -1;
-	} else if (o->type == REDIS_LIST) {
-		/* Save a list value */
-		list *list = o->ptr;
-		listIter li;
-		listNode *ln;
-
-		if (rdbSaveLen(fp, listLength(list)) == -1) return -1;
-		listRewind(list, &li);
-		while ((ln = listNext(&li))) {
-			robj *eleobj = listNodeValue(ln);
-
-			if (rdbSaveStringObject(fp, eleobj) == -1) return -1;
+		/* Save a string value */
+		if (rdbSaveStringObject(fp, o) == -1) return -1;
+	} else if (o->type == REDIS_LIST) {
+		/* Save a list value, without creating the element objects */
+		listTypeIterator *li;
+		listTypeEntry entry;
+
+		if (rdbSaveLen(fp, listTypeLength(o)) == -1) return -1;
+		li = listTypeInitIterator(o, 0, REDIS_TAIL);
+		while (listTypeNext(li, &entry)) {
+			if (rdbSaveZiplistEntry(fp, entry.zi) == -1) {
+				listTypeReleaseIterator(li);
+				return -1;
+			}
 		}
+		listTypeReleaseIterator(li);
+	} else if (o->type == REDIS_SET && o->encoding == REDIS_ENCODING_INTSET) {
+		/* Save an intset as a normal set, without creating the objects */
+		intset *is = o->ptr;
+		int64_t value;
+		uint32_t j;
+
+		if (rdbSaveLen(fp, intsetLen(is)) == -1) return -1;
+		for (j = 0; intsetGet(is, j, &value); j++)
+			if (rdbSaveLongLongAsStringObject(fp, value) == -1) return -1;
 	} else if (o->type == REDIS_SET) {
 		/* Save a set value */
 		dict *set = o->ptr;
 		dictIterator *di = dictGetIterator(set);
 		dictEntry *de;
 
-		if (rdbSaveLen(fp, dictSize(set)) == -1) return -1;
+		if (rdbSaveLen(fp, dictSize(set)) == -1) {
+			dictReleaseIterator(di);
+			return -1;
+		}
 		while ((de = dictNext(di)) != NULL) {
 			robj *eleobj = dictGetEntryKey(de);
 
-			if (rdbSaveStringObject(fp, eleobj) == -1) return -1;
+			if (rdbSaveStringObject(fp, eleobj) == -1) {
+				dictReleaseIterator(di);
+				return -1;
+			}
 		}
 		dictReleaseIterator(di);
 	} else if (o->type == REDIS_ZSET) {
@@ -3176,13 +4567,19 @@ static int rdbSaveObject(FILE *fp, robj *o) {
 		dictIterator *di = dictGetIterator(zs->dict);
 		dictEntry *de;
 
-		if (rdbSaveLen(fp, dictSize(zs->dict)) == -1) return -1;
+		if (rdbSaveLen(fp, dictSize(zs->dict)) == -1) {
+			dictReleaseIterator(di);
+			return -1;
+		}
 		while ((de = dictNext(di)) != NULL) {
 			robj *eleobj = dictGetEntryKey(de);
 			double *score = dictGetEntryVal(de);
 
-			if (rdbSaveStringObject(fp, eleobj) == -1) return -1;
-			if (rdbSaveDoubleValue(fp, *score) == -1) return -1;
+			if (rdbSaveStringObject(fp, eleobj) == -1 ||
+			    rdbSaveDoubleValue(fp, *score) == -1) {
+				dictReleaseIterator(di);
+				return -1;
+			}
 		}
 		dictReleaseIterator(di);
 	} else {
@@ -3234,13 +4631,13 @@ static int rdbSave(char *filename) {
 		redisLog(REDIS_WARNING, "Failed saving the DB: %s", strerror(errno));
 		return REDIS_ERR;
 	}
-	// 写入REDIS魔数用于快速判断一个文件是否是RDB文件，后面跟着4位版本号 0001
-	if (fwrite("REDIS0001", 9, 1, fp) == 0) goto werr;
+	// 写入REDIS魔数用于快速判断一个文件是否是RDB文件，后面跟着4位版本号 0002
+	if (fwrite("REDIS0002", 9, 1, fp) == 0) goto werr;
 	for (j = 0; j < server.dbnum; j++) {
 		redisDb *db = server.db + j;
 		dict *d = db->dict;
 		if (dictSize(d) == 0) continue;
-		di = dictGetIterator(d);
+		di = dictGetSafeIterator(d);
 		if (!di) {
 			fclose(fp);
 			return REDIS_ERR;
@@ -3250,6 +4647,13 @@ static int rdbSave(char *filename) {
 		if (rdbSaveType(fp, REDIS_SELECTDB) == -1) goto werr;
 		if (rdbSaveLen(fp, j) == -1) goto werr;
 
+		/* Write the number of keys and expires of this DB, so that the
+		 * hash tables can be created with the right size when loading.
+		 * This is just a hint: already expired keys are not saved. */
+		if (rdbSaveType(fp, REDIS_RESIZEDB) == -1) goto werr;
+		if (rdbSaveLen(fp, dictSize(d)) == -1) goto werr;
+		if (rdbSaveLen(fp, dictSize(db->expires)) == -1) goto werr;
+
 		// 接着就是所有的key-value键值对
 		//（如果含有过期时间，并且大于当前时间，则先写入过期时间，再写入key-value）
 		/* Iterate this DB writing every entry */
@@ -3401,9 +4805,27 @@ static uint32_t rdbLoadLen(FILE *fp, int *isencoded) {
 	}
 }
 
-static robj *rdbLoadIntegerObject(FILE *fp, int enctype) {
+/* The sizes read from the file are only used to presize hash tables, so a
+ * corrupted file must not make us allocate a huge table before reading a
+ * single element. Every element takes at least 'minbytes' bytes in the
+ * file: return 'len' capped to what the rest of the file can hold. */
+static uint32_t rdbLoadSizeHint(FILE *fp, uint32_t len, int minbytes) {
+	struct redis_stat sb;
+	off_t pos = ftello(fp);
+
+	if (pos == -1 || redis_fstat(fileno(fp), &sb) == -1) return 0;
+	if (sb.st_size <= pos) return 0;
+	if ((off_t) len > (sb.st_size - pos) / minbytes)
+		len = (sb.st_size - pos) / minbytes;
+	return len;
+}
+
+/* Load an integer encoded string. When 'encode' is true an integer encoded
+ * object is returned, that is a shared one for small integers. */
+static robj *rdbLoadIntegerObject(FILE *fp, int enctype, int encode) {
 	unsigned char enc[4];
 	long long val;
+	char buf[32];
 
 	if (enctype == REDIS_RDB_ENC_INT8) {
 		if (fread(enc, 1, 1, fp) == 0) return NULL;
@@ -3422,32 +4844,43 @@ static robj *rdbLoadIntegerObject(FILE *fp, int enctype) {
 		val = 0; /* anti-warning */
 		redisAssert(0 != 0);
 	}
-	return createObject(REDIS_STRING, sdscatprintf(sdsempty(), "%lld", val));
+	if (encode)
+		return createStringObjectFromLongLong(val);
+	return createStringObject(buf, ll2string(buf, sizeof(buf), val));
+}
+
+/* Create a string object of 'len' bytes to read a string into, embedded
+ * in the object allocation if short enough */
+static robj *rdbCreateStringObject(size_t len) {
+	if (len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT)
+		return createEmbeddedStringObject(NULL, len);
+	return createObject(REDIS_STRING, sdsnewlen(NULL, len));
 }
 
 static robj *rdbLoadLzfStringObject(FILE*fp) {
 	unsigned int len, clen;
 	unsigned char *c = NULL;
-	sds val = NULL;
+	robj *o = NULL;
 
 	if ((clen = rdbLoadLen(fp, NULL)) == REDIS_RDB_LENERR) return NULL;
 	if ((len = rdbLoadLen(fp, NULL)) == REDIS_RDB_LENERR) return NULL;
 	if ((c = zmalloc(clen)) == NULL) goto err;
-	if ((val = sdsnewlen(NULL, len)) == NULL) goto err;
+	o = rdbCreateStringObject(len);
 	if (fread(c, clen, 1, fp) == 0) goto err;
-	if (lzf_decompress(c, clen, val, len) == 0) goto err;
+	if (lzf_decompress(c, clen, o->ptr, len) == 0) goto err;
 	zfree(c);
-	return createObject(REDIS_STRING, val);
+	return o;
 err:
 	zfree(c);
-	sdsfree(val);
+	if (o) decrRefCount(o);
 	return NULL;
 }
 
-static robj *rdbLoadStringObject(FILE*fp) {
+/* Values are loaded with 'encode' set, keys must not be encoded */
+static robj *rdbGenericLoadStringObject(FILE*fp, int encode) {
 	int isencoded;
 	uint32_t len;
-	sds val;
+	robj *o;
 
 	len = rdbLoadLen(fp, &isencoded);
 	if (isencoded) {
@@ -3455,7 +4888,9 @@ static robj *rdbLoadStringObject(FILE*fp) {
 		case REDIS_RDB_ENC_INT8:
 		case REDIS_RDB_ENC_INT16:
 		case REDIS_RDB_ENC_INT32:
-			return tryObjectSharing(rdbLoadIntegerObject(fp, len));
+			if (encode)
+				return rdbLoadIntegerObject(fp, len, 1);
+			return tryObjectSharing(rdbLoadIntegerObject(fp, len, 0));
 		case REDIS_RDB_ENC_LZF:
 			return tryObjectSharing(rdbLoadLzfStringObject(fp));
 		default:
@@ -3464,12 +4899,20 @@ static robj *rdbLoadStringObject(FILE*fp) {
 	}
 
 	if (len == REDIS_RDB_LENERR) return NULL;
-	val = sdsnewlen(NULL, len);
-	if (len && fread(val, len, 1, fp) == 0) {
-		sdsfree(val);
+	o = rdbCreateStringObject(len);
+	if (len && fread(o->ptr, len, 1, fp) == 0) {
+		decrRefCount(o);
 		return NULL;
 	}
-	return tryObjectSharing(createObject(REDIS_STRING, val));
+	return tryObjectSharing(o);
+}
+
+static robj *rdbLoadStringObject(FILE*fp) {
+	return rdbGenericLoadStringObject(fp, 0);
+}
+
+static robj *rdbLoadEncodedStringObject(FILE*fp) {
+	return rdbGenericLoadStringObject(fp, 1);
 }
 
 /* For information about double serialization check rdbSaveDoubleValue() */
@@ -3497,22 +4940,40 @@ static robj *rdbLoadObject(int type, FILE *fp) {
 
 	if (type == REDIS_STRING) {
 		/* Read string value */
-		if ((o = rdbLoadStringObject(fp)) == NULL) return NULL;
-		tryObjectEncoding(o);
+		if ((o = rdbLoadEncodedStringObject(fp)) == NULL) return NULL;
+		o = tryObjectEncoding(o);
 	} else if (type == REDIS_LIST || type == REDIS_SET) {
 		/* Read list/set value */
 		uint32_t listlen;
 
 		if ((listlen = rdbLoadLen(fp, NULL)) == REDIS_RDB_LENERR) return NULL;
-		o = (type == REDIS_LIST) ? createListObject() : createSetObject();
+		if (type == REDIS_LIST) {
+			/* Converted to a chunk list by listTypePush() if needed */
+			if (listlen <= server.list_max_ziplist_entries)
+				o = createZiplistObject();
+			else
+				o = createListObject();
+		} else if (listlen <= server.set_max_intset_entries) {
+			/* Converted to a dict by setTypeAdd() if needed */
+			o = createIntsetObject();
+		} else {
+			o = createSetObject();
+			/* Size the set hash table once instead of growing it. An
+			 * element takes at least the byte of its length. */
+			dictExpand((dict*)o->ptr, rdbLoadSizeHint(fp, listlen, 1));
+		}
 		/* Load every single element of the list/set */
 		while (listlen--) {
 			robj *ele;
 
-			if ((ele = rdbLoadStringObject(fp)) == NULL) return NULL;
-			tryObjectEncoding(ele);
+			if ((ele = rdbLoadEncodedStringObject(fp)) == NULL) return NULL;
+			ele = tryObjectEncoding(ele);
 			if (type == REDIS_LIST) {
-				listAddNodeTail((list*)o->ptr, ele);
+				listTypePush(o, ele, REDIS_TAIL);
+				decrRefCount(ele);
+			} else if (o->encoding == REDIS_ENCODING_INTSET) {
+				setTypeAdd(o, ele);
+				decrRefCount(ele);
 			} else {
 				dictAdd((dict*)o->ptr, ele, NULL);
 			}
@@ -3525,13 +4986,15 @@ static robj *rdbLoadObject(int type, FILE *fp) {
 		if ((zsetlen = rdbLoadLen(fp, NULL)) == REDIS_RDB_LENERR) return NULL;
 		o = createZsetObject();
 		zs = o->ptr;
+		/* At least one byte for the element and one for the score */
+		if (zsetlen) dictExpand(zs->dict, rdbLoadSizeHint(fp, zsetlen, 2));
 		/* Load every single element of the list/set */
 		while (zsetlen--) {
 			robj *ele;
 			double *score = zmalloc(sizeof(double));
 
-			if ((ele = rdbLoadStringObject(fp)) == NULL) return NULL;
-			tryObjectEncoding(ele);
+			if ((ele = rdbLoadEncodedStringObject(fp)) == NULL) return NULL;
+			ele = tryObjectEncoding(ele);
 			if (rdbLoadDoubleValue(fp, score) == -1) return NULL;
 			dictAdd(zs->dict, ele, score);
 			zslInsert(zs->zsl, *score, ele);
@@ -3564,7 +5027,7 @@ static int rdbLoad(char *filename) {
 		return REDIS_ERR;
 	}
 	rdbver = atoi(buf + 5);
-	if (rdbver != 1) {
+	if (rdbver != 1 && rdbver != 2) {
 		fclose(fp);
 		redisLog(REDIS_WARNING, "Can't handle RDB format version %d", rdbver);
 		return REDIS_ERR;
@@ -3592,6 +5055,23 @@ static int rdbLoad(char *filename) {
 			d = db->dict;
 			continue;
 		}
+		/* RESIZEDB: the number of keys and expires of the current DB */
+		if (type == REDIS_RESIZEDB) {
+			uint32_t dbsize, expiressize;
+
+			if ((dbsize = rdbLoadLen(fp, NULL)) == REDIS_RDB_LENERR)
+				goto eoferr;
+			if ((expiressize = rdbLoadLen(fp, NULL)) == REDIS_RDB_LENERR)
+				goto eoferr;
+			/* A key takes at least a type, a key and a value byte, an
+			 * expire also the opcode and the 4 bytes of the time */
+			dbsize = rdbLoadSizeHint(fp, dbsize, 3);
+			expiressize = rdbLoadSizeHint(fp, expiressize, 8);
+			if (dbsize > dictSize(d)) dictExpand(d, dbsize);
+			if (expiressize > dictSize(db->expires))
+				dictExpand(db->expires, expiressize);
+			continue;
+		}
 		/* Read key */
 		if ((keyobj = rdbLoadStringObject(fp)) == NULL) goto eoferr;
 		/* Read value */
@@ -3732,7 +5212,7 @@ static void getsetCommand(redisClient *c) {
 static void mgetCommand(redisClient *c) {
 	int j;
 
-	addReplySds(c, sdscatprintf(sdsempty(), "*%d\r\n", c->argc - 1));
+	addReplyMultiBulkLen(c, c->argc - 1);
 	for (j = 1; j < c->argc; j++) {
 		robj *o = lookupKeyRead(c->db, c->argv[j]);
 		if (o == NULL) {
@@ -3773,7 +5253,7 @@ static void msetGenericCommand(redisClient *c, int nx) {
 	for (j = 1; j < c->argc; j += 2) {
 		int retval;
 
-		tryObjectEncoding(c->argv[j + 1]);
+		c->argv[j + 1] = tryObjectEncoding(c->argv[j + 1]);
 		retval = dictAdd(c->db->dict, c->argv[j], c->argv[j + 1]);
 		if (retval == DICT_ERR) {
 			dictReplace(c->db->dict, c->argv[j], c->argv[j + 1]);
@@ -3810,7 +5290,7 @@ static void incrDecrCommand(redisClient *c, long long incr) {
 		} else {
 			char *eptr;
 
-			if (o->encoding == REDIS_ENCODING_RAW)
+			if (sdsEncodedObject(o))
 				value = strtoll(o->ptr, &eptr, 10);
 			else if (o->encoding == REDIS_ENCODING_INT)
 				value = (long)o->ptr;
@@ -3820,8 +5300,7 @@ static void incrDecrCommand(redisClient *c, long long incr) {
 	}
 
 	value += incr;
-	o = createObject(REDIS_STRING, sdscatprintf(sdsempty(), "%lld", value));
-	tryObjectEncoding(o);
+	o = createStringObjectFromLongLong(value);
 	retval = dictAdd(c->db->dict, c->argv[1], o);
 	if (retval == DICT_ERR) {
 		dictReplace(c->db->dict, c->argv[1], o);
@@ -3830,9 +5309,7 @@ static void incrDecrCommand(redisClient *c, long long incr) {
 		incrRefCount(c->argv[1]);
 	}
 	server.dirty++;
-	addReply(c, shared.colon);
-	addReply(c, o);
-	addReply(c, shared.crlf);
+	addReplyLongLong(c, value);
 }
 
 static void incrCommand(redisClient *c) {
@@ -3875,7 +5352,7 @@ static void delCommand(redisClient *c) {
 		addReply(c, shared.cone);
 		break;
 	default:
-		addReplySds(c, sdscatprintf(sdsempty(), ":%d\r\n", deleted));
+		addReplyLongLong(c, deleted);
 		break;
 	}
 }
@@ -3918,11 +5395,10 @@ static void keysCommand(redisClient *c) {
 	sds pattern = c->argv[1]->ptr;
 	int plen = sdslen(pattern);
 	unsigned long numkeys = 0, keyslen = 0;
-	robj *lenobj = createObject(REDIS_STRING, NULL);
+	robj *lenobj;
 
-	di = dictGetIterator(c->db->dict);
-	addReply(c, lenobj);
-	decrRefCount(lenobj);
+	di = dictGetSafeIterator(c->db->dict);
+	lenobj = addDeferredReply(c);
 	while ((de = dictNext(di)) != NULL) {
 		robj *keyobj = dictGetEntryKey(de);
 
@@ -3939,19 +5415,173 @@ static void keysCommand(redisClient *c) {
 		}
 	}
 	dictReleaseIterator(di);
-	lenobj->ptr = sdscatprintf(sdsempty(), "$%lu\r\n", keyslen + (numkeys ? (numkeys - 1) : 0));
+	setDeferredReplyLength(lenobj, '$', keyslen + (numkeys ? (numkeys - 1) : 0));
+	addReply(c, shared.crlf);
+}
+
+/* Cursor based iteration of the keyspace (SCAN), of sets (SSCAN) and of
+ * sorted sets (ZSCAN), built on dictScan(). Every call visits only a few
+ * buckets, so big collections can be walked without blocking the server
+ * and without a giant reply. The cursor returned to the client is all the
+ * state of the iteration, and the scan is complete when it is 0 again.
+ *
+ * SCAN cursor [MATCH pattern] [COUNT count]
+ * SSCAN/ZSCAN key cursor [MATCH pattern] [COUNT count]
+ *
+ * The reply is a two elements multi bulk: the next cursor and the list of
+ * elements (member and score pairs for ZSCAN). */
+
+/* Collect the entries returned by dictScan(). privdata is an array with
+ * the list to fill and the scanned object (NULL for the keyspace). */
+static void scanCallback(void *privdata, const dictEntry *de) {
+	void **pd = (void**) privdata;
+	list *keys = pd[0];
+	robj *o = pd[1];
+	robj *key = dictGetEntryKey(de);
+
+	incrRefCount(key);
+	listAddNodeTail(keys, key);
+	/* Sorted sets: the score pointer follows the member */
+	if (o && o->type == REDIS_ZSET) listAddNodeTail(keys, dictGetEntryVal(de));
+}
+
+static void scanGenericCommand(redisClient *c, robj *o, int cursorarg) {
+	char *cursorstr = c->argv[cursorarg]->ptr, *eptr;
+	int i, iszset = o && o->type == REDIS_ZSET;
+	long count = 10, maxiterations;
+	unsigned long cursor;
+	sds pat = NULL;
+	int patlen = 0;
+	list *keys;
+	listNode *ln, *next;
+	void *privdata[2];
+	dict *d;
+	char buf[32];
+	int len;
+
+	/* Parse the cursor, an opaque unsigned integer for the client */
+	errno = 0;
+	cursor = strtoul(cursorstr, &eptr, 10);
+	if (!isdigit((unsigned char)cursorstr[0]) || eptr[0] != '\0' ||
+	        errno == ERANGE) {
+		addReplySds(c, sdsnew("-ERR invalid cursor\r\n"));
+		return;
+	}
+
+	/* Parse the options */
+	for (i = cursorarg + 1; i < c->argc; i += 2) {
+		if (i + 1 == c->argc) {
+			addReply(c, shared.syntaxerr);
+			return;
+		} else if (!strcasecmp(c->argv[i]->ptr, "count")) {
+			char *countstr = c->argv[i + 1]->ptr;
+
+			errno = 0;
+			count = strtol(countstr, &eptr, 10);
+			if (countstr[0] == '\0' || eptr[0] != '\0' ||
+			        errno == ERANGE || count < 1) {
+				addReply(c, shared.syntaxerr);
+				return;
+			}
+		} else if (!strcasecmp(c->argv[i]->ptr, "match")) {
+			pat = c->argv[i + 1]->ptr;
+			patlen = sdslen(pat);
+			/* The pattern may be '*' that matches everything */
+			if (patlen == 1 && pat[0] == '*') pat = NULL;
+		} else {
+			addReply(c, shared.syntaxerr);
+			return;
+		}
+	}
+
+	/* Visit buckets until we have at least 'count' elements. COUNT is
+	 * just a hint: a bucket is never split between two calls, and we also
+	 * stop after count*10 buckets so that a sparse table can't block. */
+	keys = listCreate();
+	if (o && o->encoding == REDIS_ENCODING_INTSET) {
+		/* Small compact sets are returned in a single call */
+		setTypeIterator *si = setTypeInitIterator(o);
+		robj *ele;
+
+		while ((ele = setTypeNext(si)) != NULL) listAddNodeTail(keys, ele);
+		setTypeReleaseIterator(si);
+		cursor = 0;
+	} else {
+		if (o == NULL)
+			d = c->db->dict;
+		else if (iszset)
+			d = ((zset*)o->ptr)->dict;
+		else
+			d = o->ptr;
+		privdata[0] = keys;
+		privdata[1] = o;
+		maxiterations = (count > LONG_MAX / 10) ? LONG_MAX : count * 10;
+		do {
+			cursor = dictScan(d, cursor, scanCallback, privdata);
+		} while (cursor && --maxiterations &&
+		         listLength(keys) < (unsigned long)count * (iszset ? 2 : 1));
+	}
+
+	/* Filter the elements not matching the pattern and the expired keys.
+	 * The keys were retained by scanCallback() as expireIfNeeded() may
+	 * delete them from the DB. */
+	ln = listFirst(keys);
+	while (ln) {
+		robj *key = listNodeValue(ln);
+		int filter = 0;
+
+		next = iszset ? ln->next->next : ln->next;
+		if (pat) {
+			robj *dec = getDecodedObject(key);
+
+			if (!stringmatchlen(pat, patlen, dec->ptr, sdslen(dec->ptr), 0))
+				filter = 1;
+			decrRefCount(dec);
+		}
+		if (!filter && o == NULL && expireIfNeeded(c->db, key)) filter = 1;
+		if (filter) {
+			decrRefCount(key);
+			if (iszset) listDelNode(keys, ln->next);
+			listDelNode(keys, ln);
+		}
+		ln = next;
+	}
+
+	/* Reply with the new cursor and the elements */
+	addReplyMultiBulkLen(c, 2);
+	len = snprintf(buf, sizeof(buf), "%lu", cursor);
+	addReplyLongLongWithPrefix(c, len, '$');
+	addReplyString(c, buf, len);
 	addReply(c, shared.crlf);
+	addReplyMultiBulkLen(c, listLength(keys));
+	ln = listFirst(keys);
+	while (ln) {
+		robj *key = listNodeValue(ln);
+
+		addReplyBulkLen(c, key);
+		addReply(c, key);
+		addReply(c, shared.crlf);
+		decrRefCount(key);
+		if (iszset) {
+			ln = ln->next;
+			addReplyDouble(c, *(double*)listNodeValue(ln));
+		}
+		ln = ln->next;
+	}
+	listRelease(keys);
+}
+
+static void scanCommand(redisClient *c) {
+	scanGenericCommand(c, NULL, 1);
 }
 
 static void dbsizeCommand(redisClient *c) {
-	addReplySds(c,
-	            sdscatprintf(sdsempty(), ":%lu\r\n", dictSize(c->db->dict)));
+	addReplyLongLong(c, dictSize(c->db->dict));
 }
 
 // 获取最近一次RDB持久化成功的时间
 static void lastsaveCommand(redisClient *c) {
-	addReplySds(c,
-	            sdscatprintf(sdsempty(), ":%lu\r\n", server.lastsave));
+	addReplyLongLong(c, server.lastsave);
 }
 
 // 获取值的数据类型
@@ -4119,10 +5749,220 @@ static void moveCommand(redisClient *c) {
 }
 
 /* =================================== Lists ================================ */
+/* Small lists are created with the ziplist encoding (the elements packed
+ * in a single allocation, see ziplist.c), and are converted to a chunk list
+ * (a list of ziplists with fast access by index, see chunklist.c) when they
+ * get more than list-max-ziplist-entries elements or an element longer than
+ * list-max-ziplist-value bytes is added. The listType*() functions hide the
+ * encoding to the commands implementation. */
+
+/* Return the string representation of 'value' as a buffer and length,
+ * using 'buf' (at least 32 bytes) for integer encoded objects. */
+static unsigned char *listTypeValueBuffer(robj *value, char *buf, unsigned int *len) {
+	if (value->encoding == REDIS_ENCODING_INT) {
+		*len = ll2string(buf, 32, (long)value->ptr);
+		return (unsigned char*)buf;
+	}
+	*len = sdslen(value->ptr);
+	return value->ptr;
+}
+
+/* Convert a ziplist encoded list to a chunk list if 'value' is too big
+ * to be stored in the ziplist */
+static void listTypeTryConversion(robj *subject, robj *value) {
+	if (subject->encoding != REDIS_ENCODING_ZIPLIST) return;
+	if (sdsEncodedObject(value) &&
+	        sdslen(value->ptr) > server.list_max_ziplist_value)
+		listTypeConvert(subject, REDIS_ENCODING_CHUNKLIST);
+}
+
+static void listTypePush(robj *subject, robj *value, int where) {
+	int pos = (where == REDIS_HEAD) ? ZIPLIST_HEAD : ZIPLIST_TAIL;
+	unsigned char *s;
+	unsigned int len;
+	char buf[32];
+
+	/* Check if we need to convert the ziplist */
+	listTypeTryConversion(subject, value);
+	if (subject->encoding == REDIS_ENCODING_ZIPLIST &&
+	        ziplistLen(subject->ptr) >= server.list_max_ziplist_entries)
+		listTypeConvert(subject, REDIS_ENCODING_CHUNKLIST);
+
+	s = listTypeValueBuffer(value, buf, &len);
+	if (subject->encoding == REDIS_ENCODING_ZIPLIST)
+		subject->ptr = ziplistPush(subject->ptr, s, len, pos);
+	else
+		chunklistPush(subject->ptr, s, len, pos);
+}
+
+/* Create an object with the value of the ziplist entry at 'p' */
+static robj *listTypeZiplistObject(unsigned char *p) {
+	unsigned char *sval;
+	unsigned int slen;
+	long long lval;
+
+	redisAssert(ziplistGet(p, &sval, &slen, &lval));
+	if (sval)
+		return createStringObject((char*)sval, slen);
+	return createStringObjectFromLongLong(lval);
+}
+
+/* Remove and return the element at the head or tail of the list, or NULL
+ * if the list is empty. The caller must decrement the reference count of
+ * the returned object. */
+static robj *listTypePop(robj *subject, int where) {
+	robj *value = NULL;
+
+	if (subject->encoding == REDIS_ENCODING_ZIPLIST) {
+		unsigned char *p;
+
+		p = ziplistIndex(subject->ptr, (where == REDIS_HEAD) ? 0 : -1);
+		if (p) {
+			value = listTypeZiplistObject(p);
+			subject->ptr = ziplistDelete(subject->ptr, &p);
+		}
+	} else {
+		chunklistEntry e;
+
+		if (chunklistIndex(subject->ptr, (where == REDIS_HEAD) ? 0 : -1, &e)) {
+			value = listTypeZiplistObject(e.p);
+			chunklistDelete(subject->ptr, &e);
+		}
+	}
+	return value;
+}
+
+static unsigned long listTypeLength(robj *subject) {
+	if (subject->encoding == REDIS_ENCODING_ZIPLIST)
+		return ziplistLen(subject->ptr);
+	return chunklistLen((chunklist*)subject->ptr);
+}
+
+/* Initialize an iterator at the specified index, moving to the tail
+ * (REDIS_TAIL) or to the head (REDIS_HEAD) of the list */
+static listTypeIterator *listTypeInitIterator(robj *subject, long index, unsigned char direction) {
+	listTypeIterator *li = zmalloc(sizeof(listTypeIterator));
+
+	li->subject = subject;
+	li->encoding = subject->encoding;
+	li->direction = direction;
+	if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+		li->zi = ziplistIndex(subject->ptr, index);
+	} else {
+		chunklist *cl = subject->ptr;
+
+		/* The index is needed to find the next element after a delete */
+		li->index = (index < 0) ? (long)chunklistLen(cl) + index : index;
+		chunklistIndex(cl, index, &li->ce);
+		li->zi = li->ce.p;
+	}
+	return li;
+}
+
+static void listTypeReleaseIterator(listTypeIterator *li) {
+	zfree(li);
+}
+
+/* Store the current entry in 'entry' and advance the iterator. Returns 0
+ * when there are no more entries. */
+static int listTypeNext(listTypeIterator *li, listTypeEntry *entry) {
+	/* Protect from converting when iterating */
+	redisAssert(li->subject->encoding == li->encoding);
+
+	entry->li = li;
+	entry->zi = li->zi;
+	if (entry->zi == NULL) return 0;
+	if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+		if (li->direction == REDIS_TAIL)
+			li->zi = ziplistNext(li->subject->ptr, li->zi);
+		else
+			li->zi = ziplistPrev(li->subject->ptr, li->zi);
+	} else {
+		entry->ce = li->ce;
+		entry->index = li->index;
+		if (li->direction == REDIS_TAIL) {
+			chunklistNext(li->subject->ptr, &li->ce);
+			li->index++;
+		} else {
+			chunklistPrev(li->subject->ptr, &li->ce);
+			li->index--;
+		}
+		li->zi = li->ce.p;
+	}
+	return 1;
+}
+
+/* Return the value of the entry. The caller must decrement the reference
+ * count of the returned object. */
+static robj *listTypeGet(listTypeEntry *entry) {
+	return listTypeZiplistObject(entry->zi);
+}
+
+/* Compare the entry with a string object */
+static int listTypeEqual(listTypeEntry *entry, robj *o) {
+	unsigned char *s;
+	unsigned int len;
+	char buf[32];
+
+	s = listTypeValueBuffer(o, buf, &len);
+	return ziplistCompare(entry->zi, s, len);
+}
+
+/* Delete the entry, the iterator can still be used to get the next one */
+static void listTypeDelete(listTypeEntry *entry) {
+	listTypeIterator *li = entry->li;
+
+	if (li->encoding == REDIS_ENCODING_ZIPLIST) {
+		unsigned char *p = entry->zi, *sval;
+		unsigned int slen;
+		long long lval;
+
+		/* The entries are moved by the deletion: 'p' is updated to point
+		 * to the one that followed the deleted entry, if any. */
+		li->subject->ptr = ziplistDelete(li->subject->ptr, &p);
+		if (li->direction == REDIS_TAIL)
+			li->zi = ziplistGet(p, &sval, &slen, &lval) ? p : NULL;
+		else
+			li->zi = ziplistPrev(li->subject->ptr, p);
+	} else {
+		chunklist *cl = li->subject->ptr;
+
+		/* Chunks may be merged or moved by the deletion, so the next
+		 * element is looked up again by index */
+		chunklistDelete(cl, &entry->ce);
+		li->index = entry->index - (li->direction == REDIS_TAIL ? 0 : 1);
+		if (li->index >= 0)
+			chunklistIndex(cl, li->index, &li->ce);
+		else
+			li->ce.p = NULL;
+		li->zi = li->ce.p;
+	}
+}
+
+/* Convert a ziplist encoded list to the 'enc' encoding */
+static void listTypeConvert(robj *subject, int enc) {
+	redisAssert(subject->encoding == REDIS_ENCODING_ZIPLIST &&
+	            enc == REDIS_ENCODING_CHUNKLIST);
+	subject->ptr = chunklistFromZiplist(subject->ptr);
+	subject->encoding = REDIS_ENCODING_CHUNKLIST;
+}
+
+/* Add the ziplist entry at 'p' to the reply as a bulk */
+static void addReplyZiplistEntry(redisClient *c, unsigned char *p) {
+	unsigned char *sval;
+	unsigned int slen;
+	long long lval;
+
+	redisAssert(ziplistGet(p, &sval, &slen, &lval));
+	if (sval)
+		addReplyBulkCBuffer(c, sval, slen);
+	else
+		addReplyBulkLongLong(c, lval);
+}
+
 // 向列表增加元素，其中where控制在左边还是右边
 static void pushGenericCommand(redisClient *c, int where) {
 	robj *lobj;
-	list *list;
 
 	// 查询写入键对应的值
 	lobj = lookupKeyWrite(c->db, c->argv[1]);
@@ -4133,16 +5973,10 @@ static void pushGenericCommand(redisClient *c, int where) {
 			return;
 		}
 		// 创建List对象，并将数据放入List中
-		lobj = createListObject();
-		list = lobj->ptr;
-		if (where == REDIS_HEAD) {
-			listAddNodeHead(list, c->argv[2]);
-		} else {
-			listAddNodeTail(list, c->argv[2]);
-		}
+		lobj = createZiplistObject();
+		listTypePush(lobj, c->argv[2], where);
 		dictAdd(c->db->dict, c->argv[1], lobj);
 		incrRefCount(c->argv[1]);
-		incrRefCount(c->argv[2]);
 	} else {
 		// 和上面代码差不多，只是多了类型检查以及少了对象值的创建和键的添加
 		if (lobj->type != REDIS_LIST) {
@@ -4153,13 +5987,7 @@ static void pushGenericCommand(redisClient *c, int where) {
 			addReply(c, shared.ok);
 			return;
 		}
-		list = lobj->ptr;
-		if (where == REDIS_HEAD) {
-			listAddNodeHead(list, c->argv[2]);
-		} else {
-			listAddNodeTail(list, c->argv[2]);
-		}
-		incrRefCount(c->argv[2]);
+		listTypePush(lobj, c->argv[2], where);
 	}
 	server.dirty++;
 	addReply(c, shared.ok);
@@ -4178,7 +6006,6 @@ static void rpushCommand(redisClient *c) {
 // 获取链表长度
 static void llenCommand(redisClient *c) {
 	robj *o;
-	list *l;
 
 	o = lookupKeyRead(c->db, c->argv[1]);
 	if (o == NULL) {
@@ -4188,8 +6015,7 @@ static void llenCommand(redisClient *c) {
 		if (o->type != REDIS_LIST) {
 			addReply(c, shared.wrongtypeerr);
 		} else {
-			l = o->ptr;
-			addReplySds(c, sdscatprintf(sdsempty(), ":%d\r\n", listLength(l)));
+			addReplyLongLong(c, listTypeLength(o));
 		}
 	}
 }
@@ -4207,18 +6033,20 @@ static void lindexCommand(redisClient *c) {
 		if (o->type != REDIS_LIST) {
 			addReply(c, shared.wrongtypeerr);
 		} else {
-			list *list = o->ptr;
-			listNode *ln;
+			unsigned char *p;
 
-			ln = listIndex(list, index);
-			if (ln == NULL) {
-				addReply(c, shared.nullbulk);
+			if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+				p = ziplistIndex(o->ptr, index);
 			} else {
-				robj *ele = listNodeValue(ln);
-				addReplyBulkLen(c, ele);
-				addReply(c, ele);
-				addReply(c, shared.crlf);
+				chunklistEntry e;
+
+				chunklistIndex(o->ptr, index, &e);
+				p = e.p;
 			}
+			if (p == NULL)
+				addReply(c, shared.nullbulk);
+			else
+				addReplyZiplistEntry(c, p);
 		}
 	}
 }
@@ -4234,23 +6062,30 @@ static void lsetCommand(redisClient *c) {
 	} else {
 		if (o->type != REDIS_LIST) {
 			addReply(c, shared.wrongtypeerr);
-		} else {
-			list *list = o->ptr;
-			listNode *ln;
+			return;
+		}
+		unsigned char *p, *s;
+		unsigned int len;
+		char buf[32];
 
-			ln = listIndex(list, index);
-			if (ln == NULL) {
-				// 空，超出范围
-				addReply(c, shared.outofrangeerr);
-			} else {
-				robj *ele = listNodeValue(ln);
+		listTypeTryConversion(o, c->argv[3]);
+		s = listTypeValueBuffer(c->argv[3], buf, &len);
+		if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+			p = ziplistIndex(o->ptr, index);
+			if (p) o->ptr = ziplistReplace(o->ptr, p, s, len);
+		} else {
+			chunklistEntry e;
 
-				decrRefCount(ele);
-				listNodeValue(ln) = c->argv[3];
-				incrRefCount(c->argv[3]);
-				addReply(c, shared.ok);
-				server.dirty++;
-			}
+			if (chunklistIndex(o->ptr, index, &e))
+				chunklistReplace(o->ptr, &e, s, len);
+			p = e.p;
+		}
+		if (p == NULL) {
+			// 空，超出范围
+			addReply(c, shared.outofrangeerr);
+		} else {
+			addReply(c, shared.ok);
+			server.dirty++;
 		}
 	}
 }
@@ -4266,22 +6101,15 @@ static void popGenericCommand(redisClient *c, int where) {
 		if (o->type != REDIS_LIST) {
 			addReply(c, shared.wrongtypeerr);
 		} else {
-			list *list = o->ptr;
-			listNode *ln;
+			robj *ele = listTypePop(o, where);
 
-			if (where == REDIS_HEAD)
-				ln = listFirst(list);
-			else
-				ln = listLast(list);
-
-			if (ln == NULL) {
+			if (ele == NULL) {
 				addReply(c, shared.nullbulk);
 			} else {
-				robj *ele = listNodeValue(ln);
 				addReplyBulkLen(c, ele);
 				addReply(c, ele);
 				addReply(c, shared.crlf);
-				listDelNode(list, ln);
+				decrRefCount(ele);
 				server.dirty++;
 			}
 		}
@@ -4311,11 +6139,10 @@ static void lrangeCommand(redisClient *c) {
 		if (o->type != REDIS_LIST) {
 			addReply(c, shared.wrongtypeerr);
 		} else {
-			list *list = o->ptr;
-			listNode *ln;
-			int llen = listLength(list);
+			listTypeIterator *li;
+			listTypeEntry entry;
+			int llen = listTypeLength(o);
 			int rangelen, j;
-			robj *ele;
 
 			/* convert negative indexes */
 			if (start < 0) start = llen + start;
@@ -4332,16 +6159,14 @@ static void lrangeCommand(redisClient *c) {
 			if (end >= llen) end = llen - 1;
 			rangelen = (end - start) + 1;
 
-			/* Return the result in form of a multi-bulk reply */
-			ln = listIndex(list, start);
-			addReplySds(c, sdscatprintf(sdsempty(), "*%d\r\n", rangelen));
+			/* Return the result in form of a multi bulk reply */
+			li = listTypeInitIterator(o, start, REDIS_TAIL);
+			addReplyMultiBulkLen(c, rangelen);
 			for (j = 0; j < rangelen; j++) {
-				ele = listNodeValue(ln);
-				addReplyBulkLen(c, ele);
-				addReply(c, ele);
-				addReply(c, shared.crlf);
-				ln = ln->next;
+				redisAssert(listTypeNext(li, &entry));
+				addReplyZiplistEntry(c, entry.zi);
 			}
+			listTypeReleaseIterator(li);
 		}
 	}
 }
@@ -4359,10 +6184,8 @@ static void ltrimCommand(redisClient *c) {
 		if (o->type != REDIS_LIST) {
 			addReply(c, shared.wrongtypeerr);
 		} else {
-			list *list = o->ptr;
-			listNode *ln;
-			int llen = listLength(list);
-			int j, ltrim, rtrim;
+			int llen = listTypeLength(o);
+			int ltrim, rtrim;
 
 			/* convert negative indexes */
 			if (start < 0) start = llen + start;
@@ -4382,13 +6205,12 @@ static void ltrimCommand(redisClient *c) {
 			}
 
 			/* Remove list elements to perform the trim */
-			for (j = 0; j < ltrim; j++) {
-				ln = listFirst(list);
-				listDelNode(list, ln);
-			}
-			for (j = 0; j < rtrim; j++) {
-				ln = listLast(list);
-				listDelNode(list, ln);
+			if (o->encoding == REDIS_ENCODING_ZIPLIST) {
+				o->ptr = ziplistDeleteRange(o->ptr, 0, ltrim);
+				o->ptr = ziplistDeleteRange(o->ptr, llen - ltrim - rtrim, rtrim);
+			} else {
+				chunklistDeleteRange(o->ptr, 0, ltrim);
+				chunklistDeleteRange(o->ptr, llen - ltrim - rtrim, rtrim);
 			}
 			server.dirty++;
 			addReply(c, shared.ok);
@@ -4409,109 +6231,241 @@ static void lremCommand(redisClient *c) {
 		if (o->type != REDIS_LIST) {
 			addReply(c, shared.wrongtypeerr);
 		} else {
-			list *list = o->ptr;
-			listNode *ln, *next;
+			listTypeIterator *li;
+			listTypeEntry entry;
 			int toremove = atoi(c->argv[2]->ptr);
 			int removed = 0;
-			int fromtail = 0;
 
 			if (toremove < 0) {
 				toremove = -toremove;
-				fromtail = 1;
+				li = listTypeInitIterator(o, -1, REDIS_HEAD);
+			} else {
+				li = listTypeInitIterator(o, 0, REDIS_TAIL);
 			}
-			ln = fromtail ? list->tail : list->head;
-			while (ln) {
-				robj *ele = listNodeValue(ln);
-
-				next = fromtail ? ln->prev : ln->next;
-				if (compareStringObjects(ele, c->argv[3]) == 0) {
-					listDelNode(list, ln);
+			while (listTypeNext(li, &entry)) {
+				if (listTypeEqual(&entry, c->argv[3])) {
+					listTypeDelete(&entry);
 					server.dirty++;
 					removed++;
 					if (toremove && removed == toremove) break;
 				}
-				ln = next;
 			}
-			addReplySds(c, sdscatprintf(sdsempty(), ":%d\r\n", removed));
+			listTypeReleaseIterator(li);
+			addReplyLongLong(c, removed);
+		}
+	}
+}
+
+/* This is the semantic of this command:
+ *  RPOPLPUSH srclist dstlist:
+ *   IF LLEN(srclist) > 0
+ *     element = RPOP srclist
+ *     LPUSH dstlist element
+ *     RETURN element
+ *   ELSE
+ *     RETURN nil
+ *   END
+ *  END
+ *
+ * The idea is to be able to get an element from a list in a reliable way
+ * since the element is not just returned but pushed against another list
+ * as well. This command was originally proposed by Ezra Zygmuntowicz.
+ */
+// 从链表的右边弹出，放到另一个链表的左边（也可以是同一个链表）
+static void rpoplpushcommand(redisClient *c) {
+	robj *sobj;
+
+
+	sobj = lookupKeyWrite(c->db, c->argv[1]);
+	if (sobj == NULL) {
+		addReply(c, shared.nullbulk);
+	} else {
+		if (sobj->type != REDIS_LIST) {
+			addReply(c, shared.wrongtypeerr);
+		} else if (listTypeLength(sobj) == 0) {
+			addReply(c, shared.nullbulk);
+		} else {
+			robj *dobj = lookupKeyWrite(c->db, c->argv[2]);
+			robj *ele;
+
+			if (dobj && dobj->type != REDIS_LIST) {
+				addReply(c, shared.wrongtypeerr);
+				return;
+			}
+
+			// 从第一个链表Src右边取出数据
+			ele = listTypePop(sobj, REDIS_TAIL);
+
+			/* Add the element to the target list (unless it's directly
+			 * passed to some BLPOP-ing client */
+			if (!handleClientsWaitingListPush(c, c->argv[2], ele)) {
+				if (dobj == NULL) {
+					/* Create the list if the key does not exist */
+					dobj = createZiplistObject();
+					dictAdd(c->db->dict, c->argv[2], dobj);
+					incrRefCount(c->argv[2]);
+				}
+				// 如果没有阻塞的客户端等待，才放入到链表dst左边
+				listTypePush(dobj, ele, REDIS_HEAD);
+			}
+
+			/* Send the element to the client as reply as well */
+			addReplyBulkLen(c, ele);
+			addReply(c, ele);
+			addReply(c, shared.crlf);
+			decrRefCount(ele);
+			server.dirty++;
 		}
 	}
 }
 
-/* This is the semantic of this command:
- *  RPOPLPUSH srclist dstlist:
- *   IF LLEN(srclist) > 0
- *     element = RPOP srclist
- *     LPUSH dstlist element
- *     RETURN element
- *   ELSE
- *     RETURN nil
- *   END
- *  END
- *
- * The idea is to be able to get an element from a list in a reliable way
- * since the element is not just returned but pushed against another list
- * as well. This command was originally proposed by Ezra Zygmuntowicz.
- */
-// 从链表的右边弹出，放到另一个链表的左边（也可以是同一个链表）
-static void rpoplpushcommand(redisClient *c) {
-	robj *sobj;
 
+/* ==================================== Sets ================================ */
+
+// 此版本的Set采用的是Dict哈希映射来实现的
+/* Sets only composed of integers are created with the intset encoding (a
+ * sorted array of integers, see intset.c), and are converted to a dict the
+ * first time a non integer member is added or when they get more than
+ * set-max-intset-entries elements. The setType*() functions hide the
+ * encoding to the commands implementation. */
+
+/* Return a new set object able to hold 'value' */
+static robj *setTypeCreate(robj *value) {
+	if (isObjectRepresentableAsLongLong(value, NULL) == REDIS_OK)
+		return createIntsetObject();
+	return createSetObject();
+}
+
+/* Convert an intset encoded set to a dict */
+static void setTypeConvert(robj *subject) {
+	intset *is = subject->ptr;
+	dict *d = createSetDict(&setDictType);
+	int64_t value;
+	uint32_t j;
+
+	redisAssert(subject->encoding == REDIS_ENCODING_INTSET);
+	/* Presize the dict to avoid rehashing */
+	dictExpand(d, intsetLen(is));
+	for (j = 0; intsetGet(is, j, &value); j++)
+		dictAdd(d, createStringObjectFromLongLong(value), NULL);
+	subject->encoding = REDIS_ENCODING_HT;
+	subject->ptr = d;
+	zfree(is);
+}
+
+/* Add 'value' to the set, return 1 if it was not already a member. */
+static int setTypeAdd(robj *subject, robj *value) {
+	long long llval;
+
+	if (subject->encoding == REDIS_ENCODING_INTSET) {
+		if (isObjectRepresentableAsLongLong(value, &llval) == REDIS_OK) {
+			int success;
+
+			subject->ptr = intsetAdd(subject->ptr, llval, &success);
+			if (success && intsetLen(subject->ptr) >
+			        server.set_max_intset_entries)
+				setTypeConvert(subject);
+			return success;
+		}
+		/* Not an integer, this set can't be an intset anymore */
+		setTypeConvert(subject);
+	}
+	if (dictAdd(subject->ptr, value, NULL) == DICT_OK) {
+		incrRefCount(value);
+		return 1;
+	}
+	return 0;
+}
+
+/* Remove 'value' from the set, return 1 if it was a member. */
+static int setTypeRemove(robj *subject, robj *value) {
+	long long llval;
+
+	if (subject->encoding == REDIS_ENCODING_INTSET) {
+		int success;
+
+		if (isObjectRepresentableAsLongLong(value, &llval) != REDIS_OK)
+			return 0;
+		subject->ptr = intsetRemove(subject->ptr, llval, &success);
+		return success;
+	}
+	if (dictDelete(subject->ptr, value) == DICT_OK) {
+		if (htNeedsResize(subject->ptr)) dictResize(subject->ptr);
+		return 1;
+	}
+	return 0;
+}
+
+static int setTypeIsMember(robj *subject, robj *value) {
+	long long llval;
+
+	if (subject->encoding == REDIS_ENCODING_INTSET)
+		return isObjectRepresentableAsLongLong(value, &llval) == REDIS_OK &&
+		       intsetFind(subject->ptr, llval);
+	return dictFind(subject->ptr, value) != NULL;
+}
+
+static unsigned long setTypeSize(robj *subject) {
+	if (subject->encoding == REDIS_ENCODING_INTSET)
+		return intsetLen(subject->ptr);
+	return dictSize((dict*)subject->ptr);
+}
+
+/* Return a random member of a non empty set. The returned object has its
+ * reference count incremented, the caller should decrRefCount() it. */
+static robj *setTypeRandomElement(robj *subject) {
+	robj *ele;
+
+	if (subject->encoding == REDIS_ENCODING_INTSET)
+		return createStringObjectFromLongLong(intsetRandom(subject->ptr));
+	ele = dictGetEntryKey(dictGetRandomKey(subject->ptr));
+	incrRefCount(ele);
+	return ele;
+}
 
-	sobj = lookupKeyWrite(c->db, c->argv[1]);
-	if (sobj == NULL) {
-		addReply(c, shared.nullbulk);
-	} else {
-		if (sobj->type != REDIS_LIST) {
-			addReply(c, shared.wrongtypeerr);
-		} else {
-			list *srclist = sobj->ptr;
-			// 从第一个链表Src右边取出数据
-			listNode *ln = listLast(srclist);
+/* Iterate the members of a set. The dict is iterated with a safe iterator,
+ * so the commands can lookup the same set while iterating it. */
+static setTypeIterator *setTypeInitIterator(robj *subject) {
+	setTypeIterator *si = zmalloc(sizeof(*si));
 
-			if (ln == NULL) {
-				addReply(c, shared.nullbulk);
-			} else {
-				robj *dobj = lookupKeyWrite(c->db, c->argv[2]);
-				robj *ele = listNodeValue(ln);
-				list *dstlist;
+	si->subject = subject;
+	si->ii = 0;
+	si->di = (subject->encoding == REDIS_ENCODING_HT) ?
+	         dictGetSafeIterator(subject->ptr) : NULL;
+	return si;
+}
 
-				if (dobj && dobj->type != REDIS_LIST) {
-					addReply(c, shared.wrongtypeerr);
-					return;
-				}
+static void setTypeReleaseIterator(setTypeIterator *si) {
+	if (si->di) dictReleaseIterator(si->di);
+	zfree(si);
+}
 
-				/* Add the element to the target list (unless it's directly
-				 * passed to some BLPOP-ing client */
-				if (!handleClientsWaitingListPush(c, c->argv[2], ele)) {
-					if (dobj == NULL) {
-						/* Create the list if the key does not exist */
-						dobj = createListObject();
-						dictAdd(c->db->dict, c->argv[2], dobj);
-						incrRefCount(c->argv[2]);
-					}
-					// 如果没有阻塞的客户端等待，才放入到链表dst左边
-					dstlist = dobj->ptr;
-					listAddNodeHead(dstlist, ele);
-					incrRefCount(ele);
-				}
+/* Return the next member or NULL. Like setTypeRandomElement() the caller
+ * should decrRefCount() the returned object. */
+static robj *setTypeNext(setTypeIterator *si) {
+	if (si->di) {
+		dictEntry *de = dictNext(si->di);
+		robj *ele;
 
-				/* Send the element to the client as reply as well */
-				addReplyBulkLen(c, ele);
-				addReply(c, ele);
-				addReply(c, shared.crlf);
+		if (de == NULL) return NULL;
+		ele = dictGetEntryKey(de);
+		incrRefCount(ele);
+		return ele;
+	} else {
+		int64_t value;
 
-				/* Finally remove the element from the source list */
-				listDelNode(srclist, ln);
-				server.dirty++;
-			}
-		}
+		if (!intsetGet(si->subject->ptr, si->ii++, &value)) return NULL;
+		return createStringObjectFromLongLong(value);
 	}
 }
 
-
-/* ==================================== Sets ================================ */
-
-// 此版本的Set采用的是Dict哈希映射来实现的
+/* Reply with a member of a set and release it */
+static void addReplySetMember(redisClient *c, robj *ele) {
+	addReplyBulkLen(c, ele);
+	addReply(c, ele);
+	addReply(c, shared.crlf);
+	decrRefCount(ele);
+}
 
 // 添加集合元素
 static void saddCommand(redisClient *c) {
@@ -4520,7 +6474,7 @@ static void saddCommand(redisClient *c) {
 	set = lookupKeyWrite(c->db, c->argv[1]);
 	if (set == NULL) {
 		// 创建集合对象
-		set = createSetObject();
+		set = setTypeCreate(c->argv[2]);
 		dictAdd(c->db->dict, c->argv[1], set);
 		incrRefCount(c->argv[1]);
 	} else {
@@ -4529,8 +6483,7 @@ static void saddCommand(redisClient *c) {
 			return;
 		}
 	}
-	if (dictAdd(set->ptr, c->argv[2], NULL) == DICT_OK) {
-		incrRefCount(c->argv[2]);
+	if (setTypeAdd(set, c->argv[2])) {
 		server.dirty++;
 		// 成功则返回1
 		addReply(c, shared.cone);
@@ -4552,9 +6505,8 @@ static void sremCommand(redisClient *c) {
 			addReply(c, shared.wrongtypeerr);
 			return;
 		}
-		if (dictDelete(set->ptr, c->argv[2]) == DICT_OK) {
+		if (setTypeRemove(set, c->argv[2])) {
 			server.dirty++;
-			if (htNeedsResize(set->ptr)) dictResize(set->ptr);
 			addReply(c, shared.cone);
 		} else {
 			// 元素不存在
@@ -4581,7 +6533,7 @@ static void smoveCommand(redisClient *c) {
 		return;
 	}
 	/* Remove the element from the source set */
-	if (dictDelete(srcset->ptr, c->argv[3]) == DICT_ERR) {
+	if (!setTypeRemove(srcset, c->argv[3])) {
 		/* Key not found in the src set! return zero */
 		addReply(c, shared.czero);
 		return;
@@ -4589,12 +6541,11 @@ static void smoveCommand(redisClient *c) {
 	server.dirty++;
 	/* Add the element to the destination set */
 	if (!dstset) {
-		dstset = createSetObject();
+		dstset = setTypeCreate(c->argv[3]);
 		dictAdd(c->db->dict, c->argv[2], dstset);
 		incrRefCount(c->argv[2]);
 	}
-	if (dictAdd(dstset->ptr, c->argv[3], NULL) == DICT_OK)
-		incrRefCount(c->argv[3]);
+	setTypeAdd(dstset, c->argv[3]);
 	addReply(c, shared.cone);
 }
 
@@ -4610,7 +6561,7 @@ static void sismemberCommand(redisClient *c) {
 			addReply(c, shared.wrongtypeerr);
 			return;
 		}
-		if (dictFind(set->ptr, c->argv[2]))
+		if (setTypeIsMember(set, c->argv[2]))
 			addReply(c, shared.cone);
 		else
 			addReply(c, shared.czero);
@@ -4620,7 +6571,6 @@ static void sismemberCommand(redisClient *c) {
 // 获取集合元素个数
 static void scardCommand(redisClient *c) {
 	robj *o;
-	dict *s;
 
 	o = lookupKeyRead(c->db, c->argv[1]);
 	if (o == NULL) {
@@ -4630,9 +6580,7 @@ static void scardCommand(redisClient *c) {
 		if (o->type != REDIS_SET) {
 			addReply(c, shared.wrongtypeerr);
 		} else {
-			s = o->ptr;
-			addReplySds(c, sdscatprintf(sdsempty(), ":%lu\r\n",
-			                            dictSize(s)));
+			addReplyLongLong(c, setTypeSize(o));
 		}
 	}
 }
@@ -4640,7 +6588,6 @@ static void scardCommand(redisClient *c) {
 // 从集合中弹出一个元素（随机）
 static void spopCommand(redisClient *c) {
 	robj *set;
-	dictEntry *de;
 
 	set = lookupKeyWrite(c->db, c->argv[1]);
 	if (set == NULL) {
@@ -4650,17 +6597,13 @@ static void spopCommand(redisClient *c) {
 			addReply(c, shared.wrongtypeerr);
 			return;
 		}
-		de = dictGetRandomKey(set->ptr);
-		if (de == NULL) {
+		if (setTypeSize(set) == 0) {
 			addReply(c, shared.nullbulk);
 		} else {
-			robj *ele = dictGetEntryKey(de);
+			robj *ele = setTypeRandomElement(set);
 
-			addReplyBulkLen(c, ele);
-			addReply(c, ele);
-			addReply(c, shared.crlf);
-			dictDelete(set->ptr, ele);
-			if (htNeedsResize(set->ptr)) dictResize(set->ptr);
+			setTypeRemove(set, ele);
+			addReplySetMember(c, ele);
 			server.dirty++;
 		}
 	}
@@ -4669,7 +6612,6 @@ static void spopCommand(redisClient *c) {
 // 和spopCommand实现类似，只是少了元素删除的操作
 static void srandmemberCommand(redisClient *c) {
 	robj *set;
-	dictEntry *de;
 
 	set = lookupKeyRead(c->db, c->argv[1]);
 	if (set == NULL) {
@@ -4679,30 +6621,24 @@ static void srandmemberCommand(redisClient *c) {
 			addReply(c, shared.wrongtypeerr);
 			return;
 		}
-		de = dictGetRandomKey(set->ptr);
-		if (de == NULL) {
+		if (setTypeSize(set) == 0)
 			addReply(c, shared.nullbulk);
-		} else {
-			robj *ele = dictGetEntryKey(de);
-
-			addReplyBulkLen(c, ele);
-			addReply(c, ele);
-			addReply(c, shared.crlf);
-		}
+		else
+			addReplySetMember(c, setTypeRandomElement(set));
 	}
 }
 
 static int qsortCompareSetsByCardinality(const void *s1, const void *s2) {
-	dict **d1 = (void*) s1, **d2 = (void*) s2;
+	robj **o1 = (void*) s1, **o2 = (void*) s2;
+	unsigned long l1 = setTypeSize(*o1), l2 = setTypeSize(*o2);
 
-	return dictSize(*d1) - dictSize(*d2);
+	return (l1 > l2) - (l1 < l2);
 }
 
 static void sinterGenericCommand(redisClient *c, robj **setskeys, unsigned long setsnum, robj *dstkey) {
-	dict **dv = zmalloc(sizeof(dict*)*setsnum);
-	dictIterator *di;
-	dictEntry *de;
-	robj *lenobj = NULL, *dstset = NULL;
+	robj **sets = zmalloc(sizeof(robj*)*setsnum);
+	setTypeIterator *si;
+	robj *ele, *lenobj = NULL, *dstset = NULL;
 	unsigned long j, cardinality = 0;
 
 	for (j = 0; j < setsnum; j++) {
@@ -4712,7 +6648,7 @@ static void sinterGenericCommand(redisClient *c, robj **setskeys, unsigned long
 		         lookupKeyWrite(c->db, setskeys[j]) :
 		         lookupKeyRead(c->db, setskeys[j]);
 		if (!setobj) {
-			zfree(dv);
+			zfree(sets);
 			if (dstkey) {
 				if (deleteKey(c->db, dstkey))
 					server.dirty++;
@@ -4723,15 +6659,15 @@ static void sinterGenericCommand(redisClient *c, robj **setskeys, unsigned long
 			return;
 		}
 		if (setobj->type != REDIS_SET) {
-			zfree(dv);
+			zfree(sets);
 			addReply(c, shared.wrongtypeerr);
 			return;
 		}
-		dv[j] = setobj->ptr;
+		sets[j] = setobj;
 	}
 	/* Sort sets from the smallest to largest, this will improve our
 	 * algorithm's performace */
-	qsort(dv, setsnum, sizeof(dict*), qsortCompareSetsByCardinality);
+	qsort(sets, setsnum, sizeof(robj*), qsortCompareSetsByCardinality);
 
 	/* The first thing we should output is the total number of elements...
 	 * since this is a multi-bulk write, but at this stage we don't know
@@ -4739,39 +6675,34 @@ static void sinterGenericCommand(redisClient *c, robj **setskeys, unsigned long
 	 * to the output list and save the pointer to later modify it with the
 	 * right length */
 	if (!dstkey) {
-		lenobj = createObject(REDIS_STRING, NULL);
-		addReply(c, lenobj);
-		decrRefCount(lenobj);
+		lenobj = addDeferredReply(c);
 	} else {
 		/* If we have a target key where to store the resulting set
 		 * create this key with an empty set inside */
-		dstset = createSetObject();
+		dstset = createIntsetObject();
 	}
 
 	/* Iterate all the elements of the first (smallest) set, and test
 	 * the element against all the other sets, if at least one set does
 	 * not include the element it is discarded */
-	di = dictGetIterator(dv[0]);
-
-	while ((de = dictNext(di)) != NULL) {
-		robj *ele;
-
+	si = setTypeInitIterator(sets[0]);
+	while ((ele = setTypeNext(si)) != NULL) {
 		for (j = 1; j < setsnum; j++)
-			if (dictFind(dv[j], dictGetEntryKey(de)) == NULL) break;
-		if (j != setsnum)
-			continue; /* at least one set does not contain the member */
-		ele = dictGetEntryKey(de);
+			if (!setTypeIsMember(sets[j], ele)) break;
+		if (j != setsnum) {
+			/* at least one set does not contain the member */
+			decrRefCount(ele);
+			continue;
+		}
 		if (!dstkey) {
-			addReplyBulkLen(c, ele);
-			addReply(c, ele);
-			addReply(c, shared.crlf);
+			addReplySetMember(c, ele);
 			cardinality++;
 		} else {
-			dictAdd(dstset->ptr, ele, NULL);
-			incrRefCount(ele);
+			setTypeAdd(dstset, ele);
+			decrRefCount(ele);
 		}
 	}
-	dictReleaseIterator(di);
+	setTypeReleaseIterator(si);
 
 	if (dstkey) {
 		/* Store the resulting set into the target */
@@ -4781,19 +6712,30 @@ static void sinterGenericCommand(redisClient *c, robj **setskeys, unsigned long
 	}
 
 	if (!dstkey) {
-		lenobj->ptr = sdscatprintf(sdsempty(), "*%lu\r\n", cardinality);
+		setDeferredReplyLength(lenobj, '*', cardinality);
 	} else {
-		addReplySds(c, sdscatprintf(sdsempty(), ":%lu\r\n",
-		                            dictSize((dict*)dstset->ptr)));
+		addReplyLongLong(c, setTypeSize(dstset));
 		server.dirty++;
 	}
-	zfree(dv);
+	zfree(sets);
 }
 
 static void sinterCommand(redisClient *c) {
 	sinterGenericCommand(c, c->argv + 1, c->argc - 1, NULL);
 }
 
+static void sscanCommand(redisClient *c) {
+	robj *set = lookupKeyRead(c->db, c->argv[1]);
+
+	if (set == NULL) {
+		addReply(c, shared.emptyscan);
+	} else if (set->type != REDIS_SET) {
+		addReply(c, shared.wrongtypeerr);
+	} else {
+		scanGenericCommand(c, set, 2);
+	}
+}
+
 static void sinterstoreCommand(redisClient *c) {
 	sinterGenericCommand(c, c->argv + 2, c->argc - 2, c->argv[1]);
 }
@@ -4803,10 +6745,9 @@ static void sinterstoreCommand(redisClient *c) {
 
 // 集合操作
 static void sunionDiffGenericCommand(redisClient *c, robj **setskeys, int setsnum, robj *dstkey, int op) {
-	dict **dv = zmalloc(sizeof(dict*)*setsnum);
-	dictIterator *di;
-	dictEntry *de;
-	robj *dstset = NULL;
+	robj **sets = zmalloc(sizeof(robj*)*setsnum);
+	setTypeIterator *si;
+	robj *ele, *dstset = NULL;
 	int j, cardinality = 0;
 
 	// 查找出Key对应的集合，并校验类型
@@ -4817,68 +6758,54 @@ static void sunionDiffGenericCommand(redisClient *c, robj **setskeys, int setsnu
 		         lookupKeyWrite(c->db, setskeys[j]) :
 		         lookupKeyRead(c->db, setskeys[j]);
 		if (!setobj) {
-			dv[j] = NULL;
+			sets[j] = NULL;
 			continue;
 		}
 		if (setobj->type != REDIS_SET) {
-			zfree(dv);
+			zfree(sets);
 			addReply(c, shared.wrongtypeerr);
 			return;
 		}
-		dv[j] = setobj->ptr;
+		sets[j] = setobj;
 	}
 
 	/* We need a temp set object to store our union. If the dstkey
 	 * is not NULL (that is, we are inside an SUNIONSTORE operation) then
 	 * this set object will be the resulting object to set into the target key*/
 	// 用于临时存储集合操作的结果，如果dstkey不为空，则用此对象替换掉该key对应的值
-	dstset = createSetObject();
+	dstset = createIntsetObject();
 
 	/* Iterate all the elements of all the sets, add every element a single
 	 * time to the result set */
 	for (j = 0; j < setsnum; j++) {
-		if (op == REDIS_OP_DIFF && j == 0 && !dv[j]) break; /* result set is empty */
-		if (!dv[j]) continue; /* non existing keys are like empty sets */
-
-		di = dictGetIterator(dv[j]);
-
-		while ((de = dictNext(di)) != NULL) {
-			robj *ele;
+		if (op == REDIS_OP_DIFF && j == 0 && !sets[j]) break; /* result set is empty */
+		if (!sets[j]) continue; /* non existing keys are like empty sets */
 
-			/* dictAdd will not add the same element multiple times */
-			ele = dictGetEntryKey(de);
+		si = setTypeInitIterator(sets[j]);
+		while ((ele = setTypeNext(si)) != NULL) {
+			/* setTypeAdd will not add the same element multiple times */
 			if (op == REDIS_OP_UNION || j == 0) {
 				// 集合并操作，将所有元素都添加到dstset中
 				// 或者是集合差操作，但是第一个集合作为初始集合
-				if (dictAdd(dstset->ptr, ele, NULL) == DICT_OK) {
-					incrRefCount(ele);
-					cardinality++;
-				}
+				if (setTypeAdd(dstset, ele)) cardinality++;
 			} else if (op == REDIS_OP_DIFF) {
 				// 集合差操作，当前集合所拥有的元素从初始集合中删除
-				if (dictDelete(dstset->ptr, ele) == DICT_OK) {
-					cardinality--;
-				}
+				if (setTypeRemove(dstset, ele)) cardinality--;
 			}
+			decrRefCount(ele);
 		}
-		dictReleaseIterator(di);
+		setTypeReleaseIterator(si);
 
 		if (op == REDIS_OP_DIFF && cardinality == 0) break; /* result set is empty */
 	}
 
 	/* Output the content of the resulting set, if not in STORE mode */
 	if (!dstkey) {
-		addReplySds(c, sdscatprintf(sdsempty(), "*%d\r\n", cardinality));
-		di = dictGetIterator(dstset->ptr);
-		while ((de = dictNext(di)) != NULL) {
-			robj *ele;
-
-			ele = dictGetEntryKey(de);
-			addReplyBulkLen(c, ele);
-			addReply(c, ele);
-			addReply(c, shared.crlf);
-		}
-		dictReleaseIterator(di);
+		addReplyMultiBulkLen(c, cardinality);
+		si = setTypeInitIterator(dstset);
+		while ((ele = setTypeNext(si)) != NULL)
+			addReplySetMember(c, ele);
+		setTypeReleaseIterator(si);
 	} else {
 		/* If we have a target key where to store the resulting set
 		 * create this key with the result set inside */
@@ -4891,11 +6818,10 @@ static void sunionDiffGenericCommand(redisClient *c, robj **setskeys, int setsnu
 	if (!dstkey) {
 		decrRefCount(dstset);
 	} else {
-		addReplySds(c, sdscatprintf(sdsempty(), ":%lu\r\n",
-		                            dictSize((dict*)dstset->ptr)));
+		addReplyLongLong(c, setTypeSize(dstset));
 		server.dirty++;
 	}
-	zfree(dv);
+	zfree(sets);
 }
 
 // 集合并
@@ -5328,7 +7254,7 @@ static void zremrangebyscoreCommand(redisClient *c) {
 		deleted = zslDeleteRange(zs->zsl, min, max, zs->dict);
 		if (htNeedsResize(zs->dict)) dictResize(zs->dict);
 		server.dirty += deleted;
-		addReplySds(c, sdscatprintf(sdsempty(), ":%lu\r\n", deleted));
+		addReplyLongLong(c, deleted);
 	}
 }
 
@@ -5387,8 +7313,7 @@ static void zrangeGenericCommand(redisClient *c, int reverse) {
 					ln = ln->forward[0];
 			}
 
-			addReplySds(c, sdscatprintf(sdsempty(), "*%d\r\n",
-			                            withscores ? (rangelen * 2) : rangelen));
+			addReplyMultiBulkLen(c, withscores ? (rangelen * 2) : rangelen);
 			for (j = 0; j < rangelen; j++) {
 				ele = ln->obj;
 				addReplyBulkLen(c, ele);
@@ -5457,9 +7382,7 @@ static void zrangebyscoreCommand(redisClient *c) {
 			 * are in the list, so we push this object that will represent
 			 * the multi-bulk length in the output buffer, and will "fix"
 			 * it later */
-			lenobj = createObject(REDIS_STRING, NULL);
-			addReply(c, lenobj);
-			decrRefCount(lenobj);
+			lenobj = addDeferredReply(c);
 
 			while (ln && ln->score <= max) {
 				// 而后逐个遍历（总时间复杂度logN+M）
@@ -5479,11 +7402,23 @@ static void zrangebyscoreCommand(redisClient *c) {
 				// limit为需要返回的个数
 				if (limit > 0) limit--;
 			}
-			lenobj->ptr = sdscatprintf(sdsempty(), "*%d\r\n", rangelen);
+			setDeferredReplyLength(lenobj, '*', rangelen);
 		}
 	}
 }
 
+static void zscanCommand(redisClient *c) {
+	robj *o = lookupKeyRead(c->db, c->argv[1]);
+
+	if (o == NULL) {
+		addReply(c, shared.emptyscan);
+	} else if (o->type != REDIS_ZSET) {
+		addReply(c, shared.wrongtypeerr);
+	} else {
+		scanGenericCommand(c, o, 2);
+	}
+}
+
 // 获取ZSet集合元素个数
 static void zcardCommand(redisClient *c) {
 	robj *o;
@@ -5498,7 +7433,7 @@ static void zcardCommand(redisClient *c) {
 			addReply(c, shared.wrongtypeerr);
 		} else {
 			zs = o->ptr;
-			addReplySds(c, sdscatprintf(sdsempty(), ":%lu\r\n", zs->zsl->length));
+			addReplyLongLong(c, zs->zsl->length);
 		}
 	}
 }
@@ -5726,8 +7661,8 @@ static void sortCommand(redisClient *c) {
 
 	/* Load the sorting vector with all the objects to sort */
 	switch (sortval->type) {
-	case REDIS_LIST: vectorlen = listLength((list*)sortval->ptr); break;
-	case REDIS_SET: vectorlen =  dictSize((dict*)sortval->ptr); break;
+	case REDIS_LIST: vectorlen = listTypeLength(sortval); break;
+	case REDIS_SET: vectorlen = setTypeSize(sortval); break;
 	case REDIS_ZSET: vectorlen = dictSize(((zset*)sortval->ptr)->dict); break;
 	default: vectorlen = 0; redisAssert(0); /* Avoid GCC warning */
 	}
@@ -5735,18 +7670,30 @@ static void sortCommand(redisClient *c) {
 	j = 0;
 
 	if (sortval->type == REDIS_LIST) {
-		list *list = sortval->ptr;
-		listNode *ln;
-		listIter li;
+		/* The references are released in the cleanup */
+		listTypeIterator *li = listTypeInitIterator(sortval, 0, REDIS_TAIL);
+		listTypeEntry entry;
 
-		listRewind(list, &li);
-		while ((ln = listNext(&li))) {
-			robj *ele = ln->value;
+		while (listTypeNext(li, &entry)) {
+			vector[j].obj = listTypeGet(&entry);
+			vector[j].u.score = 0;
+			vector[j].u.cmpobj = NULL;
+			j++;
+		}
+		listTypeReleaseIterator(li);
+	} else if (sortval->type == REDIS_SET &&
+	           sortval->encoding == REDIS_ENCODING_INTSET) {
+		/* The objects are created here, and released in the cleanup */
+		setTypeIterator *si = setTypeInitIterator(sortval);
+		robj *ele;
+
+		while ((ele = setTypeNext(si)) != NULL) {
 			vector[j].obj = ele;
 			vector[j].u.score = 0;
 			vector[j].u.cmpobj = NULL;
 			j++;
 		}
+		setTypeReleaseIterator(si);
 	} else {
 		dict *set;
 		dictIterator *di;
@@ -5781,7 +7728,7 @@ static void sortCommand(redisClient *c) {
 				if (alpha) {
 					vector[j].u.cmpobj = getDecodedObject(byval);
 				} else {
-					if (byval->encoding == REDIS_ENCODING_RAW) {
+					if (sdsEncodedObject(byval)) {
 						vector[j].u.score = strtod(byval->ptr, NULL);
 					} else {
 						/* Don't need to decode the object if it's
@@ -5795,7 +7742,7 @@ static void sortCommand(redisClient *c) {
 				}
 			} else {
 				if (!alpha) {
-					if (vector[j].obj->encoding == REDIS_ENCODING_RAW)
+					if (sdsEncodedObject(vector[j].obj))
 						vector[j].u.score = strtod(vector[j].obj->ptr, NULL);
 					else {
 						if (vector[j].obj->encoding == REDIS_ENCODING_INT)
@@ -5833,7 +7780,7 @@ static void sortCommand(redisClient *c) {
 	outputlen = getop ? getop * (end - start + 1) : end - start + 1;
 	if (storekey == NULL) {
 		/* STORE option not specified, sent the sorting result to client */
-		addReplySds(c, sdscatprintf(sdsempty(), "*%d\r\n", outputlen));
+		addReplyMultiBulkLen(c, outputlen);
 		for (j = start; j <= end; j++) {
 			listNode *ln;
 			listIter li;
@@ -5863,18 +7810,14 @@ static void sortCommand(redisClient *c) {
 			}
 		}
 	} else {
-		robj *listObject = createListObject();
-		list *listPtr = (list*) listObject->ptr;
+		robj *listObject = createZiplistObject();
 
 		/* STORE option specified, set the sorting result as a List object */
 		for (j = start; j <= end; j++) {
 			listNode *ln;
 			listIter li;
 
-			if (!getop) {
-				listAddNodeTail(listPtr, vector[j].obj);
-				incrRefCount(vector[j].obj);
-			}
+			if (!getop) listTypePush(listObject, vector[j].obj, REDIS_TAIL);
 			listRewind(operations, &li);
 			while ((ln = listNext(&li))) {
 				redisSortOperation *sop = ln->value;
@@ -5883,10 +7826,12 @@ static void sortCommand(redisClient *c) {
 
 				if (sop->type == REDIS_SORT_GET) {
 					if (!val || val->type != REDIS_STRING) {
-						listAddNodeTail(listPtr, createStringObject("", 0));
+						robj *empty = createStringObject("", 0);
+
+						listTypePush(listObject, empty, REDIS_TAIL);
+						decrRefCount(empty);
 					} else {
-						listAddNodeTail(listPtr, val);
-						incrRefCount(val);
+						listTypePush(listObject, val, REDIS_TAIL);
 					}
 				} else {
 					redisAssert(sop->type == REDIS_SORT_GET); /* always fails */
@@ -5900,16 +7845,19 @@ static void sortCommand(redisClient *c) {
 		 * SORT result is empty a new key is set and maybe the old content
 		 * replaced. */
 		server.dirty += 1 + outputlen;
-		addReplySds(c, sdscatprintf(sdsempty(), ":%d\r\n", outputlen));
+		addReplyLongLong(c, outputlen);
 	}
 
 	/* Cleanup */
-	decrRefCount(sortval);
-	listRelease(operations);
 	for (j = 0; j < vectorlen; j++) {
 		if (sortby && alpha && vector[j].u.cmpobj)
 			decrRefCount(vector[j].u.cmpobj);
+		if (sortval->type == REDIS_LIST ||
+		        sortval->encoding == REDIS_ENCODING_INTSET)
+			decrRefCount(vector[j].obj);
 	}
+	decrRefCount(sortval);
+	listRelease(operations);
 	zfree(vector);
 }
 
@@ -5942,8 +7890,12 @@ static sds genRedisInfoString(void) {
 	time_t uptime = time(NULL) - server.stat_starttime;
 	int j;
 	char hmem[64];
+	long long overflows = listenOverflowsCounter();
 
 	bytesToHuman(hmem, zmalloc_used_memory());
+	objcacheFlushStats();
+	if (overflows != -1 && server.stat_listen_overflows != -1)
+		overflows -= server.stat_listen_overflows;
 	info = sdscatprintf(sdsempty(),
 	                    "redis_version:%s\r\n"
 	                    "arch_bits:%s\r\n"
@@ -5956,12 +7908,22 @@ static sds genRedisInfoString(void) {
 	                    "blocked_clients:%d\r\n"
 	                    "used_memory:%zu\r\n"
 	                    "used_memory_human:%s\r\n"
+	                    "used_memory_rss:%zu\r\n"
+	                    "mem_fragmentation_ratio:%.2f\r\n"
 	                    "changes_since_last_save:%lld\r\n"
 	                    "bgsave_in_progress:%d\r\n"
 	                    "last_save_time:%ld\r\n"
 	                    "bgrewriteaof_in_progress:%d\r\n"
 	                    "total_connections_received:%lld\r\n"
+	                    "rejected_connections:%lld\r\n"
+	                    "instantaneous_accepts_per_sec:%lld\r\n"
+	                    "accept_queue_overflows:%lld\r\n"
 	                    "total_commands_processed:%lld\r\n"
+	                    "io_threads:%d\r\n"
+	                    "io_threaded_reads_processed:%lld\r\n"
+	                    "io_threaded_writes_processed:%lld\r\n"
+	                    "object_cache_hits:%lld\r\n"
+	                    "object_cache_misses:%lld\r\n"
 	                    "vm_enabled:%d\r\n"
 	                    "role:%s\r\n"
 	                    , REDIS_VERSION,
@@ -5975,12 +7937,22 @@ static sds genRedisInfoString(void) {
 	                    server.blockedclients,
 	                    zmalloc_used_memory(),
 	                    hmem,
+	                    zmalloc_get_rss(),
+	                    zmalloc_get_fragmentation_ratio(),
 	                    server.dirty,
 	                    server.bgsavechildpid != -1,
 	                    server.lastsave,
 	                    server.bgrewritechildpid != -1,
 	                    server.stat_numconnections,
+	                    server.stat_rejected_conn,
+	                    server.stat_accepts_per_sec,
+	                    overflows,
 	                    server.stat_numcommands,
+	                    server.netio_threads,
+	                    server.stat_netio_reads,
+	                    server.stat_netio_writes,
+	                    server.stat_objcache_hits,
+	                    server.stat_objcache_misses,
 	                    server.vm_enabled != 0,
 	                    server.masterhost == NULL ? "master" : "slave"
 	                   );
@@ -5997,6 +7969,14 @@ static sds genRedisInfoString(void) {
 		                    server.master ? ((int)(time(NULL) - server.master->lastinteraction)) : -1
 		                   );
 	}
+	if (server.listenworkers > 1) {
+		info = sdscatprintf(info,
+		                    "listen_workers:%d\r\n"
+		                    "listen_worker_id:%d\r\n"
+		                    , server.listenworkers,
+		                    server.workerid
+		                   );
+	}
 	if (server.vm_enabled) {
 		lockThreadedIO();
 		info = sdscatprintf(info,
@@ -6042,8 +8022,7 @@ static sds genRedisInfoString(void) {
 
 static void infoCommand(redisClient *c) {
 	sds info = genRedisInfoString();
-	addReplySds(c, sdscatprintf(sdsempty(), "$%lu\r\n",
-	                            (unsigned long)sdslen(info)));
+	addReplyLongLongWithPrefix(c, sdslen(info), '$');
 	addReplySds(c, info);
 	addReply(c, shared.crlf);
 }
@@ -6165,7 +8144,7 @@ static void ttlCommand(redisClient *c) {
 		ttl = (int) (expire - time(NULL));
 		if (ttl < 0) ttl = -1;
 	}
-	addReplySds(c, sdscatprintf(sdsempty(), ":%d\r\n", ttl));
+	addReplyLongLong(c, ttl);
 }
 
 /* ================================ MULTI/EXEC ============================== */
@@ -6230,7 +8209,7 @@ static void execCommand(redisClient *c) {
 
 	orig_argv = c->argv;
 	orig_argc = c->argc;
-	addReplySds(c, sdscatprintf(sdsempty(), "*%d\r\n", c->mstate.count));
+	addReplyMultiBulkLen(c, c->mstate.count);
 	for (j = 0; j < c->mstate.count; j++) {
 		c->argc = c->mstate.commands[j].argc;
 		c->argv = c->mstate.commands[j].argv;
@@ -6355,7 +8334,7 @@ static void unblockClientWaitingData(redisClient *c) {
 	 * unblockClientWaitingData() gets called from freeClient() because
 	 * freeClient() will be smart enough to call this function
 	 * *after* c->querybuf was set to NULL. */
-	if (c->querybuf && sdslen(c->querybuf) > 0) processInputBuffer(c);
+	if (c->querybuf && sdslen(c->querybuf) > c->qbpos) processInputBuffer(c);
 }
 
 /* This should be called from any function PUSHing into lists.
@@ -6408,8 +8387,7 @@ static void blockingPopGenericCommand(redisClient *c, int where) {
 				addReply(c, shared.wrongtypeerr);
 				return;
 			} else {
-				list *list = o->ptr;
-				if (listLength(list) != 0) {
+				if (listTypeLength(o) != 0) {
 					/* If the list contains elements fall back to the usual
 					 * non-blocking POP operation */
 					robj *argv[2], **orig_argv;
@@ -6529,7 +8507,7 @@ static void syncCommand(redisClient *c) {
 	 * the client about already issued commands. We need a fresh reply
 	 * buffer registering the differences between the BGSAVE and the current
 	 * dataset, so that we can copy to other slaves if needed. */
-	if (listLength(c->reply) != 0) {
+	if (c->bufpos != 0 || listLength(c->reply) != 0) {
 		addReplySds(c, sdsnew("-ERR SYNC is invalid with pending input\r\n"));
 		return;
 	}
@@ -6555,6 +8533,8 @@ static void syncCommand(redisClient *c) {
 			 * another slave. Set the right state, and copy the buffer. */
 			listRelease(c->reply);
 			c->reply = listDup(slave->reply);
+			memcpy(c->buf, slave->buf, slave->bufpos);
+			c->bufpos = slave->bufpos;
 			c->replstate = REDIS_REPL_WAIT_BGSAVE_END;
 			redisLog(REDIS_NOTICE, "Waiting for end of BGSAVE for SYNC");
 		} else {
@@ -6585,7 +8565,7 @@ static void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
 	REDIS_NOTUSED(el);
 	REDIS_NOTUSED(mask);
 	char buf[REDIS_IOBUF_LEN];
-	ssize_t nwritten, buflen;
+	ssize_t nwritten, buflen, totwritten = 0;
 
 	if (slave->repldboff == 0) {
 		/* Write the bulk write count before to transfer the DB. In theory here
@@ -6604,21 +8584,33 @@ static void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
 		}
 		sdsfree(bulkcount);
 	}
-	lseek(slave->repldbfd, slave->repldboff, SEEK_SET);
-	buflen = read(slave->repldbfd, buf, REDIS_IOBUF_LEN);
-	if (buflen <= 0) {
-		redisLog(REDIS_WARNING, "Read error sending DB to slave: %s",
-		         (buflen == 0) ? "premature EOF" : strerror(errno));
-		freeClient(slave);
-		return;
-	}
-	if ((nwritten = write(fd, buf, buflen)) == -1) {
-		redisLog(REDIS_VERBOSE, "Write error sending DB to slave: %s",
-		         strerror(errno));
-		freeClient(slave);
-		return;
+	/* Transfer chunks until the socket buffer is full or we sent
+	 * REDIS_MAX_WRITE_PER_EVENT bytes, so that in edge triggered mode we
+	 * don't stop before the kernel is able to notify us again. */
+	while (slave->repldboff < slave->repldbsize) {
+		lseek(slave->repldbfd, slave->repldboff, SEEK_SET);
+		buflen = read(slave->repldbfd, buf, REDIS_IOBUF_LEN);
+		if (buflen <= 0) {
+			redisLog(REDIS_WARNING, "Read error sending DB to slave: %s",
+			         (buflen == 0) ? "premature EOF" : strerror(errno));
+			freeClient(slave);
+			return;
+		}
+		if ((nwritten = write(fd, buf, buflen)) == -1) {
+			if (errno == EAGAIN) break;
+			redisLog(REDIS_VERBOSE, "Write error sending DB to slave: %s",
+			         strerror(errno));
+			freeClient(slave);
+			return;
+		}
+		slave->repldboff += nwritten;
+		totwritten += nwritten;
+		if (nwritten != buflen) break;
+		if (totwritten >= REDIS_MAX_WRITE_PER_EVENT) {
+			aeRearmFileEvent(server.el, fd);
+			break;
+		}
 	}
-	slave->repldboff += nwritten;
 	if (slave->repldboff == slave->repldbsize) {
 		close(slave->repldbfd);
 		slave->repldbfd = -1;
@@ -6789,6 +8781,7 @@ static int syncWithMaster(void) {
 		close(fd);
 		return REDIS_ERR;
 	}
+	anetNonBlock(NULL, fd);
 	server.master = createClient(fd);
 	server.master->flags |= REDIS_MASTER;
 	server.master->authenticated = 1;
@@ -6820,25 +8813,31 @@ static void slaveofCommand(redisClient *c) {
 
 /* ============================ Maxmemory directive  ======================== */
 
-/* Try to free one object form the pre-allocated objects free list.
+/* Try to free objects form the pre-allocated objects free list: the
+ * cache of the main thread, or else a batch of the global pool.
  * This is useful under low mem conditions as by default we take 1 million
  * free objects allocated. On success REDIS_OK is returned, otherwise
  * REDIS_ERR. */
 static int tryFreeOneObjectFromFreelist(void) {
 	robj *o;
 
-	if (server.vm_enabled) pthread_mutex_lock(&server.obj_freelist_mutex);
-	if (listLength(server.objfreelist)) {
-		listNode *head = listFirst(server.objfreelist);
-		o = listNodeValue(head);
-		listDelNode(server.objfreelist, head);
-		if (server.vm_enabled) pthread_mutex_unlock(&server.obj_freelist_mutex);
+	if (objcache) {
+		o = objcache;
+		objcache = o->ptr;
+		objcache_len--;
 		zfree(o);
 		return REDIS_OK;
-	} else {
-		if (server.vm_enabled) pthread_mutex_unlock(&server.obj_freelist_mutex);
-		return REDIS_ERR;
 	}
+	if (objcache_prev) {
+		freeObjectChain(objcache_prev);
+		objcache_prev = NULL;
+		return REDIS_OK;
+	}
+	if (server.objcache_batch && (o = objpoolGetBatch()) != NULL) {
+		freeObjectChain(o);
+		return REDIS_OK;
+	}
+	return REDIS_ERR;
 }
 
 /* This function gets called when 'maxmemory' is set on the config file to limit
@@ -6981,6 +8980,7 @@ static struct redisClient *createFakeClient(void) {
 	c->argc = 0;
 	c->argv = NULL;
 	c->flags = 0;
+	c->bufpos = 0;
 	/* We set the fake client as a slave waiting for the synchronization
 	 * so that Redis will not try to send replies to this client. */
 	c->replstate = REDIS_REPL_WAIT_BGSAVE_START;
@@ -7054,12 +9054,13 @@ int loadAppendOnlyFile(char *filename) {
 				argv[j] = tryObjectSharing(argv[j]);
 		}
 		if (cmd->flags & REDIS_CMD_BULK)
-			tryObjectEncoding(argv[argc - 1]);
+			argv[argc - 1] = tryObjectEncoding(argv[argc - 1]);
 		/* Run the command in the context of a fake client */
 		fakeClient->argc = argc;
 		fakeClient->argv = argv;
 		cmd->proc(fakeClient);
-		/* Discard the reply objects list from the fake client */
+		/* Discard the replies of the fake client */
+		fakeClient->bufpos = 0;
 		while (listLength(fakeClient->reply))
 			listDelNode(fakeClient->reply, listFirst(fakeClient->reply));
 		/* Clean up, ready for the next command */
@@ -7099,7 +9100,7 @@ static int fwriteBulk(FILE *fp, robj *obj) {
 	 * is called).
 	 * Also makes sure that key objects don't get incrRefCount-ed when VM
 	 * is enabled */
-	if (obj->encoding != REDIS_ENCODING_RAW) {
+	if (!sdsEncodedObject(obj)) {
 		obj = getDecodedObject(obj);
 		decrrc = 1;
 	}
@@ -7115,6 +9116,39 @@ err:
 	return 0;
 }
 
+/* Write a C buffer in bulk format $<count>\r\n<payload>\r\n */
+static int fwriteBulkString(FILE *fp, unsigned char *s, unsigned long len) {
+	char buf[128];
+	int buflen;
+
+	buflen = snprintf(buf, sizeof(buf), "$%lu\r\n", len);
+	if (fwrite(buf, buflen, 1, fp) == 0) return 0;
+	if (len && fwrite(s, len, 1, fp) == 0) return 0;
+	if (fwrite("\r\n", 2, 1, fp) == 0) return 0;
+	return 1;
+}
+
+/* Write an integer in bulk format $<count>\r\n<payload>\r\n */
+static int fwriteBulkLongLong(FILE *fp, long long value) {
+	char buf[128], nbuf[32];
+	int len = ll2string(nbuf, sizeof(nbuf), value);
+
+	len = snprintf(buf, sizeof(buf), "$%d\r\n%s\r\n", len, nbuf);
+	return fwrite(buf, len, 1, fp) != 0;
+}
+
+/* Write the value of a ziplist entry in bulk format */
+static int fwriteBulkZiplistEntry(FILE *fp, unsigned char *p) {
+	unsigned char *sval;
+	unsigned int slen;
+	long long lval;
+
+	ziplistGet(p, &sval, &slen, &lval);
+	if (sval)
+		return fwriteBulkString(fp, sval, slen);
+	return fwriteBulkLongLong(fp, lval);
+}
+
 /* Write a double value in bulk format $<count>\r\n<payload>\r\n */
 static int fwriteBulkDouble(FILE *fp, double d) {
 	char buf[128], dbuf[128];
@@ -7160,7 +9194,7 @@ static int rewriteAppendOnlyFile(char *filename) {
 		redisDb *db = server.db + j;
 		dict *d = db->dict;
 		if (dictSize(d) == 0) continue;
-		di = dictGetIterator(d);
+		di = dictGetSafeIterator(d);
 		if (!di) {
 			fclose(fp);
 			return REDIS_ERR;
@@ -7201,18 +9235,32 @@ static int rewriteAppendOnlyFile(char *filename) {
 				if (fwriteBulk(fp, o) == 0) goto werr;
 			} else if (o->type == REDIS_LIST) {
 				/* Emit the RPUSHes needed to rebuild the list */
-				list *list = o->ptr;
-				listNode *ln;
-				listIter li;
+				listTypeIterator *li = listTypeInitIterator(o, 0, REDIS_TAIL);
+				listTypeEntry entry;
 
-				listRewind(list, &li);
-				while ((ln = listNext(&li))) {
+				while (listTypeNext(li, &entry)) {
 					char cmd[] = "*3\r\n$5\r\nRPUSH\r\n";
-					robj *eleobj = listNodeValue(ln);
+
+					if (fwrite(cmd, sizeof(cmd) - 1, 1, fp) == 0 ||
+					        fwriteBulk(fp, key) == 0 ||
+					        fwriteBulkZiplistEntry(fp, entry.zi) == 0) {
+						listTypeReleaseIterator(li);
+						goto werr;
+					}
+				}
+				listTypeReleaseIterator(li);
+			} else if (o->type == REDIS_SET &&
+			           o->encoding == REDIS_ENCODING_INTSET) {
+				/* Emit the SADDs needed to rebuild the set */
+				int64_t value;
+				uint32_t ii;
+
+				for (ii = 0; intsetGet(o->ptr, ii, &value); ii++) {
+					char cmd[] = "*3\r\n$4\r\nSADD\r\n";
 
 					if (fwrite(cmd, sizeof(cmd) - 1, 1, fp) == 0) goto werr;
 					if (fwriteBulk(fp, key) == 0) goto werr;
-					if (fwriteBulk(fp, eleobj) == 0) goto werr;
+					if (fwriteBulkLongLong(fp, value) == 0) goto werr;
 				}
 			} else if (o->type == REDIS_SET) {
 				/* Emit the SADDs needed to rebuild the set */
@@ -7441,7 +9489,6 @@ static void vmInit(void) {
 	server.io_processed = listCreate();
 	server.io_clients = listCreate();
 	pthread_mutex_init(&server.io_mutex, NULL);
-	pthread_mutex_init(&server.obj_freelist_mutex, NULL);
 	pthread_mutex_init(&server.io_swapfile_mutex, NULL);
 	server.io_active_threads = 0;
 	if (pipe(pipefds) == -1) {
@@ -7701,7 +9748,6 @@ static robj *vmPreviewObject(robj *key) {
 static double computeObjectSwappability(robj *o) {
 	time_t age = server.unixtime - o->vm.atime;
 	long asize = 0;
-	list *l;
 	dict *d;
 	struct dictEntry *de;
 	int z;
@@ -7709,28 +9755,24 @@ static double computeObjectSwappability(robj *o) {
 	if (age <= 0) return 0;
 	switch (o->type) {
 	case REDIS_STRING:
-		if (o->encoding != REDIS_ENCODING_RAW) {
+		if (!sdsEncodedObject(o)) {
 			asize = sizeof(*o);
 		} else {
 			asize = sdslen(o->ptr) + sizeof(*o) + sizeof(long) * 2;
 		}
 		break;
 	case REDIS_LIST:
-		l = o->ptr;
-		listNode *ln = listFirst(l);
-
-		asize = sizeof(list);
-		if (ln) {
-			robj *ele = ln->value;
-			long elesize;
-
-			elesize = (ele->encoding == REDIS_ENCODING_RAW) ?
-			          (sizeof(*o) + sdslen(ele->ptr)) :
-			          sizeof(*o);
-			asize += (sizeof(listNode) + elesize) * listLength(l);
-		}
+		if (o->encoding == REDIS_ENCODING_ZIPLIST)
+			asize = ziplistBlobLen(o->ptr);
+		else
+			asize = chunklistBlobLen(o->ptr);
 		break;
 	case REDIS_SET:
+		if (o->encoding == REDIS_ENCODING_INTSET) {
+			asize = intsetBlobLen(o->ptr);
+			break;
+		}
+		/* Fall through */
 	case REDIS_ZSET:
 		z = (o->type == REDIS_ZSET);
 		d = z ? ((zset*)o->ptr)->dict : o->ptr;
@@ -7743,7 +9785,7 @@ static double computeObjectSwappability(robj *o) {
 
 			de = dictGetRandomKey(d);
 			ele = dictGetEntryKey(de);
-			elesize = (ele->encoding == REDIS_ENCODING_RAW) ?
+			elesize = sdsEncodedObject(ele) ?
 			          (sizeof(*o) + sdslen(ele->ptr)) :
 			          sizeof(*o);
 			asize += (sizeof(struct dictEntry) + elesize) * dictSize(d);
@@ -7788,8 +9830,10 @@ static int vmSwapOneObject(int usethreads) {
 			 * Also don't swap shared objects if threaded VM is on, as we
 			 * try to ensure that the main thread does not touch the
 			 * object while the I/O thread is using it, but we can't
-			 * control other keys without adding additional mutex. */
+			 * control other keys without adding additional mutex.
+			 * Swapping the shared integers would not free anything. */
 			if (key->storage != REDIS_VM_MEMORY ||
+			        val->refcount == REDIS_SHARED_REFCOUNT ||
 			        (server.vm_max_threads != 0 && val->refcount != 1)) {
 				if (maxtries) i--; /* don't count this try */
 				continue;
@@ -7992,7 +10036,12 @@ static void vmThreadedIOCompletedJob(aeEventLoop *el, int fd, void *privdata,
 			}
 		}
 		processed++;
-		if (processed == toprocess) return;
+		if (processed == toprocess) {
+			/* Bytes for the jobs we left are still in the pipe: make sure
+			 * we are called again in edge triggered mode as well. */
+			aeRearmFileEvent(server.el, fd);
+			return;
+		}
 	}
 	if (retval < 0 && errno != EAGAIN) {
 		redisLog(REDIS_WARNING,
@@ -8032,7 +10081,7 @@ again:
 			iojob *job = ln->value;
 
 			if (job->canceled) continue; /* Skip this, already canceled. */
-			if (compareStringObjects(job->key, o) == 0) {
+			if (equalStringObjects(job->key, o)) {
 				redisLog(REDIS_DEBUG, "*** CANCELED %p (%s) (type %d) (LIST ID %d)\n",
 				         (void*)job, (char*)o->ptr, job->type, i);
 				/* Mark the pages as free since the swap didn't happened
@@ -8103,6 +10152,7 @@ static void *IOThreadEntryPoint(void *arg) {
 			         (long long) pthread_self());
 			server.io_active_threads--;
 			unlockThreadedIO();
+			flushObjectCache();
 			return NULL;
 		}
 		ln = listFirst(server.io_newjobs);
@@ -8267,8 +10317,8 @@ static void debugCommand(redisClient *c) {
 		}
 		key = dictGetEntryKey(de);
 		val = dictGetEntryVal(de);
-		if (server.vm_enabled && (key->storage == REDIS_VM_MEMORY ||
-		                          key->storage == REDIS_VM_SWAPPING)) {
+		if (!server.vm_enabled || key->storage == REDIS_VM_MEMORY ||
+		        key->storage == REDIS_VM_SWAPPING) {
 			addReplySds(c, sdscatprintf(sdsempty(),
 			                            "+Key at:%p refcount:%d, value at:%p refcount:%d "
 			                            "encoding:%d serializedlength:%lld\r\n",
@@ -8310,9 +10360,31 @@ static void debugCommand(redisClient *c) {
 		} else {
 			addReply(c, shared.err);
 		}
+	} else if (!strcasecmp(c->argv[1]->ptr, "allocstats")) {
+#ifdef USE_ARENA
+		/* One line per size class: block size, runs, blocks allocated and
+		 * blocks available in the runs. */
+		sds stats = sdsnew("allocator:arena\r\n");
+		size_t size, runs, used, capacity, small = 0, um = zmalloc_used_memory();
+		int j;
+
+		for (j = 0; arenaClassStats(j, &size, &runs, &used, &capacity); j++) {
+			stats = sdscatprintf(stats, "class:%zu runs=%zu,used=%zu,capacity=%zu\r\n",
+			                     size, runs, used, capacity);
+			small += size * used;
+		}
+		stats = sdscatprintf(stats, "small_bytes:%zu\r\nlarge_bytes:%zu\r\n",
+		                     small, um > small ? um - small : 0);
+		addReplyLongLongWithPrefix(c, sdslen(stats), '$');
+		addReplySds(c, stats);
+		addReply(c, shared.crlf);
+#else
+		addReplySds(c, sdsnew(
+		                "-ERR Allocator statistics need a build with USE_ARENA=yes\r\n"));
+#endif
 	} else {
 		addReplySds(c, sdsnew(
-		                "-ERR Syntax error, try DEBUG [SEGFAULT|OBJECT <key>|SWAPOUT <key>|RELOAD]\r\n"));
+		                "-ERR Syntax error, try DEBUG [SEGFAULT|OBJECT <key>|SWAPOUT <key>|RELOAD|ALLOCSTATS]\r\n"));
 	}
 }
 
@@ -8349,6 +10421,66 @@ void linuxOvercommitMemoryWarning(void) {
 }
 #endif /* __linux__ */
 
+/* Number of connections dropped because the accept queue of a listening
+ * socket was full, as reported by the TcpExt ListenOverflows counter of
+ * /proc/net/netstat. Note that the counter is host wide. Returns -1 if the
+ * information is not available. */
+static long long listenOverflowsCounter(void) {
+#ifdef __linux__
+	FILE *fp = fopen("/proc/net/netstat", "r");
+	char names[4096], values[4096];
+	long long count = -1;
+
+	if (!fp) return -1;
+	/* Every group is a line of names followed by a line of values */
+	while (fgets(names, sizeof(names), fp) != NULL &&
+	        fgets(values, sizeof(values), fp) != NULL) {
+		sds *n, *v;
+		int nc, vc, j;
+
+		if (strncmp(names, "TcpExt:", 7)) continue;
+		n = sdssplitlen(names, strlen(names), " ", 1, &nc);
+		v = sdssplitlen(values, strlen(values), " ", 1, &vc);
+		for (j = 1; j < nc && j < vc; j++) {
+			if (!strcmp(n[j], "ListenOverflows")) {
+				count = strtoll(v[j], NULL, 10);
+				break;
+			}
+		}
+		for (j = 0; j < nc; j++) sdsfree(n[j]);
+		for (j = 0; j < vc; j++) sdsfree(v[j]);
+		zfree(n);
+		zfree(v);
+		break;
+	}
+	fclose(fp);
+	return count;
+#else
+	return -1;
+#endif
+}
+
+/* Set the seed of the hash function used by the dicts to a random value,
+ * so that the distribution of the keys in the buckets can't be predicted.
+ * Must be called before any dict is created. */
+static void initHashFunctionSeed(void) {
+	uint8_t seed[16];
+	struct timeval tv;
+	int fd, j, ok = 0;
+
+	if ((fd = open("/dev/urandom", O_RDONLY)) != -1) {
+		ok = read(fd, seed, sizeof(seed)) == sizeof(seed);
+		close(fd);
+	}
+	if (!ok) {
+		/* Weak fallback, still better than a fixed seed */
+		gettimeofday(&tv, NULL);
+		srand(tv.tv_sec ^ tv.tv_usec ^ getpid());
+		for (j = 0; j < (int) sizeof(seed); j++) seed[j] = rand();
+	}
+	dictSetHashFunctionSeed(seed);
+}
+
 static void daemonize(void) {
 	int fd;
 	FILE *fp;
@@ -8373,7 +10505,146 @@ static void daemonize(void) {
 	}
 }
 
+/* Called in the parent when a listen worker terminates */
+static void listenWorkerDoneHandler(pid_t pid, int statloc) {
+	int j;
+
+	for (j = 1; j < server.listenworkers && server.workerpids; j++) {
+		if (server.workerpids[j] != pid) continue;
+		server.workerpids[j] = -1;
+		if (WIFSIGNALED(statloc))
+			redisLog(REDIS_WARNING, "Listen worker %d terminated by signal %d",
+			         j, WTERMSIG(statloc));
+		else
+			redisLog(REDIS_WARNING, "Listen worker %d exited with code %d",
+			         j, WEXITSTATUS(statloc));
+		return;
+	}
+}
+
+/* Called by serverCron(): reap the terminated workers in the parent, and
+ * exit the workers whose parent is gone. */
+static void checkListenWorkers(void) {
+	int j, statloc;
+
+	if (server.listenworkers <= 1) return;
+	if (server.workerid != 0) {
+		if (getppid() != server.workersppid) {
+			redisLog(REDIS_WARNING, "Parent process gone, listen worker %d exiting", server.workerid);
+			exit(0);
+		}
+		return;
+	}
+	for (j = 1; j < server.listenworkers; j++) {
+		if (server.workerpids[j] != -1 &&
+		        waitpid(server.workerpids[j], &statloc, WNOHANG) == server.workerpids[j])
+			listenWorkerDoneHandler(server.workerpids[j], statloc);
+	}
+}
+
+#ifdef CMDLOOKUP_BENCHMARK_MAIN
+/* Command lookup microbenchmark. Build it with 'make cmdlookup-benchmark'.
+ *
+ * Every command of the table is looked up, in upper case as clients
+ * usually send it, both with the old linear strcasecmp() scan of cmdTable[]
+ * and with the hash table index used by lookupCommand(). */
+static long long ustime(void) {
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return ((long long)tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+static struct redisCommand *lookupCommandLinear(char *name) {
+	int j = 0;
+	while (cmdTable[j].name != NULL) {
+		if (!strcasecmp(name, cmdTable[j].name)) return &cmdTable[j];
+		j++;
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int iterations = (argc > 1) ? atoi(argv[1]) : 100000;
+	struct redisCommand *volatile cmd;
+	double linear, hashed, maxlinear = 0, maxhashed = 0;
+	double totlinear = 0, tothashed = 0;
+	int numcmds, i, j;
+
+	initHashFunctionSeed();
+	populateCommandTable();
+	for (numcmds = 0; cmdTable[numcmds].name != NULL; numcmds++);
+	for (j = 0; j < numcmds; j++) {
+		sds name = sdsnew(cmdTable[j].name);
+		long long start;
+
+		sdstoupper(name);
+		start = ustime();
+		for (i = 0; i < iterations; i++) cmd = lookupCommandLinear(name);
+		linear = (double)(ustime() - start) * 1000 / iterations;
+		start = ustime();
+		for (i = 0; i < iterations; i++) cmd = lookupCommand(name);
+		hashed = (double)(ustime() - start) * 1000 / iterations;
+		redisAssert(cmd == &cmdTable[j]);
+
+		if (linear > maxlinear) maxlinear = linear;
+		if (hashed > maxhashed) maxhashed = hashed;
+		totlinear += linear;
+		tothashed += hashed;
+		if (argc > 2)
+			printf("%-20s linear %8.1f ns  hashed %8.1f ns\n",
+			       cmdTable[j].name, linear, hashed);
+		sdsfree(name);
+	}
+	printf("%d commands, %d lookups each\n", numcmds, iterations);
+	printf("linear scan: %.1f ns per lookup on average, %.1f ns worst case\n",
+	       totlinear / numcmds, maxlinear);
+	printf("hash table:  %.1f ns per lookup on average, %.1f ns worst case\n",
+	       tothashed / numcmds, maxhashed);
+	return 0;
+}
+#else
+/* Fork the listen workers. Every worker is a full slave process of its own:
+ * it binds the same port using SO_REUSEPORT, so that the kernel spreads
+ * the clients among the processes, and it takes its dataset from the
+ * master with the usual replication link. Workers don't persist anything
+ * (the sync with the master uses a private dump file) and exit as soon as
+ * the parent process is gone. */
+static void startListenWorkers(void) {
+	pid_t pid;
+	int j;
+
+	if (server.listenworkers <= 1) return;
+	if (server.masterhost == NULL) {
+		redisLog(REDIS_WARNING, "listen-workers can only be used together with slaveof. Exiting.");
+		exit(1);
+	}
+	server.workersppid = getpid();
+	server.workerpids = zmalloc(sizeof(pid_t)*server.listenworkers);
+	server.workerpids[0] = -1;
+	for (j = 1; j < server.listenworkers; j++) {
+		if ((pid = fork()) == -1) {
+			redisLog(REDIS_WARNING, "Can't fork listen worker: %s", strerror(errno));
+			exit(1);
+		}
+		if (pid == 0) {
+			/* Worker */
+			server.workerid = j;
+			zfree(server.workerpids);
+			server.workerpids = NULL;
+			resetServerSaveParams();
+			server.appendonly = 0;
+			server.dbfilename = sdscatprintf(sdsempty(), "%s.worker%d",
+			                                 server.dbfilename, j);
+			return;
+		}
+		server.workerpids[j] = pid;
+		redisLog(REDIS_NOTICE, "Listen worker %d started with pid %ld", j, (long) pid);
+	}
+}
+
 int main(int argc, char **argv) {
+	initHashFunctionSeed();
 	initServerConfig();
 	if (argc == 2) {
 		resetServerSaveParams();
@@ -8385,6 +10656,7 @@ int main(int argc, char **argv) {
 		redisLog(REDIS_WARNING, "Warning: no config file specified, using the default config. In order to specify a config file use 'redis-server /path/to/redis.conf'");
 	}
 	if (server.daemonize) daemonize();
+	startListenWorkers();
 	initServer();
 	redisLog(REDIS_NOTICE, "Server started, Redis version " REDIS_VERSION);
 #ifdef __linux__
@@ -8402,6 +10674,7 @@ int main(int argc, char **argv) {
 	aeDeleteEventLoop(server.el);
 	return 0;
 }
+#endif
 
 /* ============================= Backtrace support ========================= */
 
@@ -97,7 +97,10 @@ void sdsupdatelen(sds s) {
     sh->len = reallen;
 }
 
-static sds sdsMakeRoomFor(sds s, size_t addlen) {
+/* Make sure there are at least 'addlen' free bytes at the end of the
+ * string. If greedy is true the buffer is doubled, so that many appends
+ * are amortized, otherwise exactly 'addlen' bytes are added. */
+static sds sdsMakeRoomForGeneric(sds s, size_t addlen, int greedy) {
     struct sdshdr *sh, *newsh;
     size_t free = sdsavail(s);
     size_t len, newlen;
@@ -105,7 +108,7 @@ static sds sdsMakeRoomFor(sds s, size_t addlen) {
     if (free >= addlen) return s;
     len = sdslen(s);
     sh = (void*) (s-(sizeof(struct sdshdr)));
-    newlen = (len+addlen)*2;
+    newlen = greedy ? (len+addlen)*2 : len+addlen;
     newsh = zrealloc(sh, sizeof(struct sdshdr)+newlen+1);
 #ifdef SDS_ABORT_ON_OOM
     if (newsh == NULL) sdsOomAbort();
@@ -117,6 +120,25 @@ static sds sdsMakeRoomFor(sds s, size_t addlen) {
     return newsh->buf;
 }
 
+sds sdsMakeRoomFor(sds s, size_t addlen) {
+    return sdsMakeRoomForGeneric(s,addlen,1);
+}
+
+sds sdsMakeRoomForNonGreedy(sds s, size_t addlen) {
+    return sdsMakeRoomForGeneric(s,addlen,0);
+}
+
+/* Account for 'incr' bytes written by the caller in the free space at the
+ * end of the string, after sdsMakeRoomFor(). This allows to read(2)
+ * directly into an sds string without an intermediate buffer. */
+void sdsIncrLen(sds s, size_t incr) {
+    struct sdshdr *sh = (void*) (s-(sizeof(struct sdshdr)));
+
+    sh->len += incr;
+    sh->free -= incr;
+    s[sh->len] = '\0';
+}
+
 sds sdscatlen(sds s, void *t, size_t len) {
     struct sdshdr *sh;
     size_t curlen = sdslen(s);
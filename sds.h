@@ -52,6 +52,9 @@ sds sdscatlen(sds s, void *t, size_t len);
 sds sdscat(sds s, char *t);
 sds sdscpylen(sds s, char *t, size_t len);
 sds sdscpy(sds s, char *t);
+sds sdsMakeRoomFor(sds s, size_t addlen);
+sds sdsMakeRoomForNonGreedy(sds s, size_t addlen);
+void sdsIncrLen(sds s, size_t incr);
 
 #ifdef __GNUC__
 sds sdscatprintf(sds s, const char *fmt, ...)
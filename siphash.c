@@ -0,0 +1,106 @@
+/* SipHash-1-2 implementation for the Redis hash tables.
+ *
+ * SipHash is a keyed hash designed by Jean-Philippe Aumasson and Daniel J.
+ * Bernstein: without knowing the 128 bit key (that Redis picks at random
+ * at startup) it is not possible to build many keys colliding in the same
+ * bucket, so clients can't degrade the hash tables to linked lists.
+ *
+ * The input is processed 8 bytes at a time. We use one compression round
+ * and two finalization rounds (SipHash-1-2 instead of the SipHash-2-4 of
+ * the paper), that is still considered good enough for hash tables and is
+ * a lot faster with short keys.
+ *
+ * This implementation was written following the reference implementation,
+ * that is released to the public domain (CC0) by its authors:
+ *
+ *   Jean-Philippe Aumasson <jeanphilippe.aumasson@gmail.com>
+ *   Daniel J. Bernstein <djb@cr.yp.to>
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#include "siphash.h"
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+/* Little endian load, the compiler turns it into a single load on
+ * little endian targets that support unaligned accesses. */
+#define U8TO64_LE(p)                                                        \
+    (((uint64_t)((p)[0])) | ((uint64_t)((p)[1]) << 8) |                     \
+     ((uint64_t)((p)[2]) << 16) | ((uint64_t)((p)[3]) << 24) |              \
+     ((uint64_t)((p)[4]) << 32) | ((uint64_t)((p)[5]) << 40) |              \
+     ((uint64_t)((p)[6]) << 48) | ((uint64_t)((p)[7]) << 56))
+
+#define U8TO64_LE_NOCASE(p)                                                 \
+    (((uint64_t)(tolower((p)[0]))) |                                        \
+     ((uint64_t)(tolower((p)[1])) << 8) |                                   \
+     ((uint64_t)(tolower((p)[2])) << 16) |                                  \
+     ((uint64_t)(tolower((p)[3])) << 24) |                                  \
+     ((uint64_t)(tolower((p)[4])) << 32) |                                  \
+     ((uint64_t)(tolower((p)[5])) << 40) |                                  \
+     ((uint64_t)(tolower((p)[6])) << 48) |                                  \
+     ((uint64_t)(tolower((p)[7])) << 56))
+
+#define SIPROUND                                                            \
+    do {                                                                    \
+        v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32);           \
+        v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2;                              \
+        v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0;                              \
+        v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32);           \
+    } while (0)
+
+/* The body of siphash() and siphash_nocase(), that only differ in the way
+ * the input words are loaded. */
+#define SIPHASH_BODY(LOAD, CONV)                                            \
+    uint64_t k0 = U8TO64_LE(k);                                             \
+    uint64_t k1 = U8TO64_LE(k + 8);                                         \
+    uint64_t v0 = 0x736f6d6570736575ULL ^ k0;                               \
+    uint64_t v1 = 0x646f72616e646f6dULL ^ k1;                               \
+    uint64_t v2 = 0x6c7967656e657261ULL ^ k0;                               \
+    uint64_t v3 = 0x7465646279746573ULL ^ k1;                               \
+    const uint8_t *end = in + inlen - (inlen % sizeof(uint64_t));           \
+    int left = inlen & 7;                                                   \
+    uint64_t b = ((uint64_t)inlen) << 56;                                   \
+    uint64_t m;                                                             \
+                                                                            \
+    for (; in != end; in += 8) {                                            \
+        m = LOAD(in);                                                       \
+        v3 ^= m;                                                            \
+        SIPROUND;                                                           \
+        v0 ^= m;                                                            \
+    }                                                                       \
+                                                                            \
+    switch (left) {                                                         \
+    case 7: b |= ((uint64_t)CONV(in[6])) << 48; /* fall through */          \
+    case 6: b |= ((uint64_t)CONV(in[5])) << 40; /* fall through */          \
+    case 5: b |= ((uint64_t)CONV(in[4])) << 32; /* fall through */          \
+    case 4: b |= ((uint64_t)CONV(in[3])) << 24; /* fall through */          \
+    case 3: b |= ((uint64_t)CONV(in[2])) << 16; /* fall through */          \
+    case 2: b |= ((uint64_t)CONV(in[1])) << 8; /* fall through */           \
+    case 1: b |= ((uint64_t)CONV(in[0])); break;                            \
+    case 0: break;                                                          \
+    }                                                                       \
+                                                                            \
+    v3 ^= b;                                                                \
+    SIPROUND;                                                               \
+    v0 ^= b;                                                                \
+    v2 ^= 0xff;                                                             \
+    SIPROUND;                                                               \
+    SIPROUND;                                                               \
+    return v0 ^ v1 ^ v2 ^ v3;
+
+#define SIPHASH_NOCONV(c) (c)
+
+/* Hash 'inlen' bytes at 'in' using the 16 bytes key 'k' */
+uint64_t siphash(const uint8_t *in, size_t inlen, const uint8_t *k) {
+    SIPHASH_BODY(U8TO64_LE, SIPHASH_NOCONV)
+}
+
+/* Like siphash() but 'in' is hashed as if it was all lower case, so that
+ * strings only differing in case have the same hash. */
+uint64_t siphash_nocase(const uint8_t *in, size_t inlen, const uint8_t *k) {
+    SIPHASH_BODY(U8TO64_LE_NOCASE, tolower)
+}
+
@@ -0,0 +1,14 @@
+/* SipHash-1-2, see siphash.c
+ *
+ * See the siphash.c file for the copyright notice. */
+
+#ifndef __SIPHASH_H
+#define __SIPHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint64_t siphash(const uint8_t *in, size_t inlen, const uint8_t *k);
+uint64_t siphash_nocase(const uint8_t *in, size_t inlen, const uint8_t *k);
+
+#endif
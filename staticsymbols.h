@@ -17,7 +17,7 @@ static struct redisFunctionSym symsTable[] = {
 {"brpopCommand",(unsigned long)brpopCommand},
 {"bytesToHuman",(unsigned long)bytesToHuman},
 {"call",(unsigned long)call},
-{"closeTimedoutClients",(unsigned long)closeTimedoutClients},
+{"clientsCron",(unsigned long)clientsCron},
 {"compareStringObjects",(unsigned long)compareStringObjects},
 {"computeObjectSwappability",(unsigned long)computeObjectSwappability},
 {"createClient",(unsigned long)createClient},
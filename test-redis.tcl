@@ -269,6 +269,36 @@ proc main {server port} {
         $r dbsize
     } {6}
 
+    test {SCAN returns every key while the keyspace grows} {
+        for {set j 0} {$j < 500} {incr j} {$r set scan:$j $j}
+        set cur 0
+        array set seen {}
+        set extra 0
+        while 1 {
+            set res [$r scan $cur match scan:* count 10]
+            set cur [lindex $res 0]
+            foreach k [lindex $res 1] {set seen($k) 1}
+            # Resize the table between two calls
+            for {set j 0} {$j < 20} {incr j} {$r set scanextra:[incr extra] x}
+            if {$cur == 0} break
+        }
+        set missing 0
+        for {set j 0} {$j < 500} {incr j} {
+            if {![info exists seen(scan:$j)]} {incr missing}
+        }
+        foreach key [$r keys scan*] {$r del $key}
+        list $missing [array size seen] [lsort [array names seen key_*]]
+    } {0 500 {}}
+
+    test {SCAN COUNT must be a positive integer} {
+        set res {}
+        foreach count {abc 10x {} 0 -1 99999999999999999999} {
+            catch {$r scan 0 count $count} err
+            lappend res [string match {ERR*syntax*} $err]
+        }
+        lappend res [lindex [$r scan 0 count 9223372036854775807] 0]
+    } {1 1 1 1 1 1 0}
+
     test {DEL all keys} {
         foreach key [$r keys *] {$r del $key}
         $r dbsize
@@ -389,6 +419,76 @@ proc main {server port} {
         append res [$r exists emptykey]
     } {10}
 
+    test {Short strings are embedded in the object, also after DEBUG RELOAD} {
+        $r set short foo
+        $r set limit [string repeat a 39]
+        $r set long [string repeat b 40]
+        $r set number 12345
+        set res {}
+        foreach i {0 1} {
+            foreach k {short limit long number} {
+                regexp {encoding:(\d+)} [$r debug object $k] -> enc
+                lappend res $enc
+            }
+            $r debug reload
+        }
+        lappend res [$r get short] [string length [$r get limit]] \
+            [string length [$r get long]] [$r incr number]
+    } {6 6 0 1 6 6 0 1 foo 39 40 12346}
+
+    test {Small integer values are shared objects, also after INCR and DEBUG RELOAD} {
+        $r set smallint1 100
+        $r set smallint2 99
+        $r incr smallint2
+        $r set bigint 1000000
+        set res {}
+        foreach i {0 1} {
+            regexp {value at:(\S+) refcount:(\d+)} [$r debug object smallint1] -> v1 rc1
+            regexp {value at:(\S+)} [$r debug object smallint2] -> v2
+            regexp {value at:\S+ refcount:(\d+)} [$r debug object bigint] -> rc3
+            lappend res [expr {$v1 eq $v2}] [expr {$rc1 > 1}] $rc3
+            $r debug reload
+        }
+        lappend res [$r get smallint1] [$r incr smallint2] [$r get bigint]
+    } {1 1 1 1 1 1 100 101 1000000}
+
+    test {Freed objects are reused from the object cache} {
+        # Start above the shared integers, that are never allocated, with
+        # an object already freed by the first INCR
+        $r set cachedcounter 1000000
+        $r incr cachedcounter
+        regexp {object_cache_hits:(\d+)} [$r info] -> hits1
+        for {set j 0} {$j < 100} {incr j} {$r incr cachedcounter}
+        regexp {object_cache_hits:(\d+)} [$r info] -> hits2
+        set res [list [$r get cachedcounter] [expr {$hits2-$hits1 >= 100}]]
+        $r del cachedcounter
+        set _ $res
+    } {1000101 1}
+
+    test {INFO reports the RSS and the fragmentation ratio} {
+        set i [$r info]
+        regexp {used_memory:(\d+)} $i -> used
+        regexp {used_memory_rss:(\d+)} $i -> rss
+        regexp {mem_fragmentation_ratio:([0-9.]+)} $i -> ratio
+        list [expr {$rss > 0}] [expr {abs($ratio - double($rss)/$used) < 0.1}]
+    } {1 1}
+
+    test {DEBUG ALLOCSTATS reports the size classes in use} {
+        # Without USE_ARENA=yes the command replies with an error
+        if {[catch {$r debug allocstats} stats]} {
+            string match {*USE_ARENA*} $stats
+        } else {
+            set small 0
+            set found 0
+            foreach {- size used} [regexp -all -inline {class:(\d+) runs=\d+,used=(\d+)} $stats] {
+                incr small [expr {$size*$used}]
+                if {$used > 0} {set found 1}
+            }
+            regexp {small_bytes:(\d+)} $stats -> reported
+            expr {$found && $small == $reported}
+        }
+    } {1}
+
     test {Commands pipelining} {
         set fd [$r channel]
         puts -nonewline $fd "SET k1 4\r\nxyzk\r\nGET k1\r\nPING\r\n"
@@ -400,6 +500,145 @@ proc main {server port} {
         format $res
     } {1xyzk1}
 
+    test {Inline and multi bulk commands pipelining, split writes} {
+        set fd [$r channel]
+        puts -nonewline $fd "*3\r\n\$3\r\nSET\r\n\$2\r\nk2\r\n\$5\r\nhel"
+        flush $fd
+        after 100
+        puts -nonewline $fd "lo\r\n\r\n  GET   k2 \r\nSET k3 2\r\n"
+        flush $fd
+        after 100
+        puts -nonewline $fd "ab\r\nGET k3\r\n"
+        flush $fd
+        set res {}
+        append res [string match OK* [::redis::redis_read_reply $fd]]
+        append res [::redis::redis_read_reply $fd]
+        append res [string match OK* [::redis::redis_read_reply $fd]]
+        append res [::redis::redis_read_reply $fd]
+        format $res
+    } {1hello1ab}
+
+    test {Big bulk arguments pipelined with other commands} {
+        set fd [$r channel]
+        set buf [string repeat "xyz" 50000]
+        puts -nonewline $fd "*3\r\n\$3\r\nSET\r\n\$2\r\nk4\r\n\$150000\r\n$buf\r\n"
+        puts -nonewline $fd "SET k5 150000\r\n$buf\r\nEXISTS k4\r\nPING\r\n"
+        flush $fd
+        set res {}
+        append res [string match OK* [::redis::redis_read_reply $fd]]
+        append res [string match OK* [::redis::redis_read_reply $fd]]
+        append res [::redis::redis_read_reply $fd]
+        append res [string match PONG* [::redis::redis_read_reply $fd]]
+        append res [expr {[$r get k4] eq $buf && [$r get k5] eq $buf}]
+        format $res
+    } {11111}
+
+    test {Small and big replies pipelined are received in order} {
+        set fd [$r channel]
+        $r set k6 [string repeat "x" 20000]
+        for {set j 0} {$j < 3000} {incr j} {
+            puts -nonewline $fd "GET k1\r\nGET k6\r\nPING\r\nKEYS k6\r\n"
+        }
+        flush $fd
+        set err {}
+        for {set j 0} {$j < 3000} {incr j} {
+            set res [::redis::redis_read_reply $fd]
+            append res [string length [::redis::redis_read_reply $fd]]
+            append res [::redis::redis_read_reply $fd]
+            append res [::redis::redis_read_reply $fd]
+            if {$res ne {xyzk20000PONGk6}} {
+                set err "Unexpected reply at $j: $res"
+                break
+            }
+        }
+        set _ $err
+    } {}
+
+    test {Inline commands pipelined by many clients at once} {
+        # With io-threads > 1 the commands are looked up by several
+        # network threads at the same time
+        set fds {}
+        for {set c 0} {$c < 8} {incr c} {
+            set fd [socket $server $port]
+            fconfigure $fd -encoding binary -translation binary
+            for {set j 0} {$j < 2000} {incr j} {
+                puts -nonewline $fd "PING\r\nexists nokey:$j\r\nTyPe nokey:$c\r\n"
+            }
+            lappend fds $fd
+        }
+        foreach fd $fds {flush $fd}
+        set err {}
+        for {set c 0} {$c < 8} {incr c} {
+            set fd [lindex $fds $c]
+            for {set j 0} {$j < 2000} {incr j} {
+                set res [::redis::redis_read_reply $fd]
+                append res [::redis::redis_read_reply $fd]
+                append res [::redis::redis_read_reply $fd]
+                if {$err eq {} && $res ne "PONG0none"} {
+                    set err "Unexpected reply from client $c at $j: $res"
+                }
+            }
+            close $fd
+        }
+        set _ $err
+    } {}
+
+    test {Integer and length replies around the shared headers range} {
+        set res {}
+        foreach n {0 -1 9 10 99 100 -100 255 256 12345678901} {
+            $r set foo 0
+            lappend res [$r incrby foo $n] [$r get foo]
+        }
+        $r del mylist
+        for {set j 0} {$j < 257} {incr j} {$r rpush mylist $j}
+        lappend res [$r llen mylist] [llength [$r lrange mylist 0 254]]
+        lappend res [llength [$r lrange mylist 0 255]] [llength [$r lrange mylist 0 -1]]
+        $r del mylist foo
+        set res
+    } {0 0 -1 -1 9 9 10 10 99 99 100 100 -100 -100 255 255 256 256 12345678901 12345678901 257 255 256 257}
+
+    test {Command names are case insensitive} {
+        set fd [$r channel]
+        puts -nonewline $fd "SeT foo 3\r\nbar\r\nGeT foo\r\n"
+        puts -nonewline $fd "*3\r\n\$3\r\nsET\r\n\$3\r\nfoo\r\n\$3\r\nxyz\r\n"
+        puts -nonewline $fd "MuLtI\r\nINCR counter\r\nget foo\r\nExEc\r\nGETX foo\r\n"
+        flush $fd
+        set res {}
+        for {set j 0} {$j < 8} {incr j} {
+            catch {::redis::redis_read_reply $fd} reply
+            lappend res $reply
+        }
+        $r del foo counter
+        set res
+    } {OK bar OK OK QUEUED QUEUED {1 xyz} {ERR unknown command 'GETX'}}
+
+    test {Keyspace is consistent while the hash table is rehashed} {
+        $r flushdb
+        set err {}
+        for {set j 0} {$j < 5000} {incr j} {
+            $r set rh:$j $j
+            if {$j % 331 == 0} {
+                if {[llength [$r keys rh:*]] != $j+1} {
+                    set err "KEYS mismatch after $j insertions"
+                    break
+                }
+                if {![$r exists [$r randomkey]]} {
+                    set err "RANDOMKEY returned a non existing key"
+                    break
+                }
+            }
+        }
+        for {set j 0} {$j < 5000 && $err eq {}} {incr j 2} {
+            if {[$r del rh:$j] != 1} {set err "rh:$j not found on DEL"}
+        }
+        for {set j 1} {$j < 5000 && $err eq {}} {incr j 2} {
+            if {[$r get rh:$j] != $j} {set err "rh:$j not found on GET"}
+        }
+        lappend err [$r dbsize] [llength [$r keys rh:*]]
+        $r flushdb
+        set err
+    } {2500 2500}
+
     test {Non existing command} {
         catch {$r foobaredcommand} err
         string match ERR* $err
@@ -776,6 +1015,141 @@ proc main {server port} {
         format $err
     } {ERR*value*}
 
+    test {Small lists are ziplist encoded until they get too many or too big elements} {
+        $r del mylist biglist
+        foreach v {a 5 -1 70000 007 -9223372036854775808 {} b} {
+            $r rpush mylist $v
+        }
+        regexp {encoding:(\d+)} [$r debug object mylist] -> enc1
+        set res [list $enc1 [$r lrange mylist 0 -1] [$r lindex mylist -4] \
+            [$r lindex mylist 8] [$r llen mylist]]
+        $r rpush mylist [string repeat x 65]
+        regexp {encoding:(\d+)} [$r debug object mylist] -> enc2
+        lappend res $enc2 [$r lindex mylist -1] [$r lindex mylist 2]
+        for {set j 0} {$j < 128} {incr j} {$r lpush biglist $j}
+        regexp {encoding:(\d+)} [$r debug object biglist] -> enc3
+        $r lpush biglist 128
+        regexp {encoding:(\d+)} [$r debug object biglist] -> enc4
+        lappend res $enc3 $enc4 [$r llen biglist] [$r lindex biglist 0] [$r lindex biglist -1]
+    } {5 {a 5 -1 70000 007 -9223372036854775808 {} b} 007 {} 8 4 xxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxxx -1 5 4 129 128 0}
+
+    test {LREM, LTRIM, LSET and RPOPLPUSH against ziplist encoded lists} {
+        $r del mylist target
+        foreach v {1 foo 01 1 bar 1 foo} {$r rpush mylist $v}
+        set res [list [$r lrem mylist -1 foo] [$r lrem mylist 0 1] [$r lrange mylist 0 -1]]
+        $r lset mylist 0 10
+        $r lset mylist -1 [string repeat y 100]
+        regexp {encoding:(\d+)} [$r debug object mylist] -> enc
+        lappend res $enc [$r lrange mylist 0 1]
+        $r del mylist
+        foreach v {a b c d e f} {$r rpush mylist $v}
+        $r ltrim mylist 1 -2
+        lappend res [$r lrange mylist 0 -1] [$r rpoplpush mylist target] \
+            [$r rpoplpush mylist mylist] [$r lrange mylist 0 -1] [$r lrange target 0 -1]
+    } {1 3 {foo 01 bar} 4 {10 01} {b c d e} e d {d b c} e}
+
+    test {Random operations on lists crossing the ziplist limits} {
+        set err {}
+        for {set run 0} {$run < 10} {incr run} {
+            $r del mylist
+            set model {}
+            for {set j 0} {$j < 400} {incr j} {
+                switch [randomInt 3] {
+                    0 {set v [randomInt 300]}
+                    1 {set v [randstring 0 10 alpha]}
+                    2 {set v [randstring 60 70 alpha]}
+                }
+                switch [randomInt 8] {
+                    0 - 1 - 2 {$r rpush mylist $v; lappend model $v}
+                    3 {$r lpush mylist $v; set model [linsert $model 0 $v]}
+                    4 {
+                        if {[llength $model]} {
+                            $r lpop mylist
+                            set model [lrange $model 1 end]
+                        }
+                    }
+                    5 {
+                        if {[llength $model]} {
+                            set idx [randomInt [llength $model]]
+                            $r lset mylist $idx $v
+                            lset model $idx $v
+                        }
+                    }
+                    6 {
+                        set e [lindex $model [randomInt [expr {[llength $model]+1}]]]
+                        $r lrem mylist 0 $e
+                        set m {}
+                        foreach x $model {if {$x ne $e} {lappend m $x}}
+                        set model $m
+                    }
+                    7 {
+                        # LTRIM clamps an end index before the head to 0,
+                        # so only trim lists longer than the trimmed part
+                        if {[llength $model] > 10} {
+                            set s [randomInt 5]
+                            set e [expr {-1-[randomInt 5]}]
+                            $r ltrim mylist $s $e
+                            set model [lrange $model $s end-[expr {-1-$e}]]
+                        }
+                    }
+                }
+            }
+            if {[$r lrange mylist 0 -1] ne $model} {
+                set err "Mismatch in run $run"
+                break
+            }
+        }
+        set _ $err
+    } {}
+
+    test {Ziplist encoded lists after DEBUG RELOAD and an AOF rewrite} {
+        $r del mylist
+        foreach v {10 foo -20 5000000000 {} bar} {$r rpush mylist $v}
+        $r debug reload
+        regexp {encoding:(\d+)} [$r debug object mylist] -> enc
+        set res [list $enc [$r lrange mylist 0 -1]]
+        $r bgrewriteaof
+        waitForBgrewriteaof $r
+        $r debug loadaof
+        lappend res [$r lrange mylist 0 -1] [$r llen mylist]
+    } {5 {10 foo -20 5000000000 {} bar} {10 foo -20 5000000000 {} bar} 6}
+
+    test {Big chunked lists: LINDEX, LSET, LRANGE, LTRIM, LREM and reload} {
+        $r del mylist
+        set model {}
+        for {set j 0} {$j < 5000} {incr j} {
+            if {$j % 3} {
+                $r rpush mylist $j; lappend model $j
+            } else {
+                $r lpush mylist $j; set model [linsert $model 0 $j]
+            }
+        }
+        set err {}
+        for {set j 0} {$j < 200} {incr j} {
+            set idx [randomInt [llength $model]]
+            if {[$r lindex mylist $idx] ne [lindex $model $idx]} {
+                set err "LINDEX mismatch at $idx"
+            }
+            if {$j % 2} {
+                $r lset mylist -[expr {$idx+1}] x$j
+                lset model end-$idx x$j
+            }
+        }
+        $r ltrim mylist 300 -401
+        set model [lrange $model 300 end-400]
+        $r lrem mylist 0 x1
+        set model [lsearch -all -inline -not -exact $model x1]
+        foreach v [lrange $model 1000 1200] {$r lrem mylist 1 $v}
+        set model [concat [lrange $model 0 999] [lrange $model 1201 end]]
+        if {[$r lrange mylist 1500 1600] ne [lrange $model 1500 1600]} {
+            set err "LRANGE mismatch"
+        }
+        $r debug reload
+        regexp {encoding:(\d+)} [$r debug object mylist] -> enc
+        list $err $enc [expr {[$r llen mylist] == [llength $model]}] \
+            [expr {[$r lrange mylist 0 -1] eq $model}]
+    } {{} 4 1 1}
+
     test {SADD, SCARD, SISMEMBER, SMEMBERS basics} {
         $r sadd myset foo
         $r sadd myset bar
@@ -877,6 +1251,68 @@ proc main {server port} {
         list [lsort [list [$r spop myset] [$r spop myset] [$r spop myset]]] [$r scard myset]
     } {{1 2 3} 0}
 
+    test {Sets of integers are intset encoded until a string is added} {
+        $r del myset
+        foreach v {5 -3 70000 -9223372036854775808 9223372036854775807 5} {
+            $r sadd myset $v
+        }
+        regexp {encoding:(\d+)} [$r debug object myset] -> enc1
+        set res [list $enc1 [$r scard myset] [$r sismember myset 70000] \
+            [$r sismember myset 070000] [$r sismember myset foo] \
+            [$r sort myset] [$r srem myset -3] [$r srem myset -3]]
+        $r sadd myset foo
+        regexp {encoding:(\d+)} [$r debug object myset] -> enc2
+        lappend res $enc2 [lsort [$r smembers myset]]
+    } {3 5 1 0 0 {-9223372036854775808 -3 5 70000 9223372036854775807} 1 0 2 {-9223372036854775808 5 70000 9223372036854775807 foo}}
+
+    test {Intset is converted to a hash table past set-max-intset-entries} {
+        $r del myset
+        for {set j 0} {$j < 512} {incr j} {$r sadd myset $j}
+        regexp {encoding:(\d+)} [$r debug object myset] -> enc1
+        $r sadd myset 512
+        regexp {encoding:(\d+)} [$r debug object myset] -> enc2
+        list $enc1 $enc2 [$r scard myset] [$r sismember myset 512]
+    } {3 2 513 1}
+
+    test {SINTER, SUNION, SDIFF and SMOVE mixing intset and hash table sets} {
+        $r del set1 set2 set3 res
+        foreach v {1 2 3 4 5} {$r sadd set1 $v}
+        foreach v {3 4 5 6 a} {$r sadd set2 $v}
+        list [lsort [$r sinter set1 set2]] [lsort [$r sunion set1 set2]] \
+            [lsort [$r sdiff set1 set2]] [$r sinterstore res set1 set1] \
+            [$r smove set2 set1 a] [$r smove set1 set3 1] \
+            [lsort [$r smembers set1]] [$r smembers set3]
+    } {{3 4 5} {1 2 3 4 5 6 a} {1 2} 5 1 1 {2 3 4 5 a} 1}
+
+    test {Intset encoded sets after DEBUG RELOAD and an AOF rewrite} {
+        $r del myset
+        foreach v {10 -20 30000 5000000000} {$r sadd myset $v}
+        $r debug reload
+        regexp {encoding:(\d+)} [$r debug object myset] -> enc
+        set res [list $enc [$r sort myset]]
+        $r bgrewriteaof
+        waitForBgrewriteaof $r
+        $r debug loadaof
+        lappend res [$r sort myset] [$r scard myset]
+    } {3 {-20 10 30000 5000000000} {-20 10 30000 5000000000} 4}
+
+    test {Big sets keep all the members after shrinking and growing again} {
+        $r del bigset
+        set expected {}
+        for {set i 0} {$i < 2000} {incr i} {$r sadd bigset m$i}
+        # Deleting most of the members shrinks the table, then the set
+        # grows again while still rehashing
+        for {set i 10} {$i < 2000} {incr i} {$r srem bigset m$i}
+        for {set i 0} {$i < 10} {incr i} {lappend expected m$i}
+        for {set i 0} {$i < 1000} {incr i} {
+            $r sadd bigset n$i
+            lappend expected n$i
+        }
+        set res [list [$r scard bigset] [expr {[lsort [$r smembers bigset]] eq [lsort $expected]}]]
+        foreach m $expected {$r srem bigset $m}
+        lappend res [$r scard bigset] [$r sadd bigset m0] [$r smembers bigset]
+    } {1010 1 0 1 m0}
+
     test {SAVE - make sure there are all the types as values} {
         # Wait for a background saving in progress to terminate
         waitForBgsave $r
@@ -1237,6 +1673,89 @@ proc main {server port} {
         $r zrange ztmp 0 -1 withscores
     } {y 1 x 10 z 30}
 
+    test {Integer encoded and plain string members compare as equal} {
+        $r del myset mylist
+        $r sadd myset 10
+        $r sadd myset 12345678901234567890
+        set res [list [$r sadd myset 10] [$r sadd myset 12345678901234567890]]
+        lappend res [$r sismember myset 10] [$r scard myset]
+        $r rpush mylist 10
+        $r rpush mylist 100
+        $r rpush mylist 1
+        $r rpush mylist 10
+        lappend res [$r lrem mylist 0 10] [$r lrange mylist 0 -1]
+        $r del myset mylist
+        set res
+    } {0 0 1 2 2 {100 1}}
+
+    test {SSCAN and ZSCAN} {
+        $r del scanset scanzset
+        for {set j 0} {$j < 200} {incr j} {
+            $r sadd scanset $j
+            $r zadd scanzset $j m$j
+        }
+        set members {}
+        set cur 0
+        while 1 {
+            set res [$r sscan scanset $cur count 7]
+            set cur [lindex $res 0]
+            eval lappend members [lindex $res 1]
+            if {$cur == 0} break
+        }
+        set pairs {}
+        set cur 0
+        while 1 {
+            set res [$r zscan scanzset $cur match m1*]
+            set cur [lindex $res 0]
+            eval lappend pairs [lindex $res 1]
+            if {$cur == 0} break
+        }
+        array set zs $pairs
+        list [llength [lsort -unique $members]] [array size zs] $zs(m199) \
+            [$r sscan nokey 0]
+    } {200 111 199 {0 {}}}
+
+    test {Big SET and ZSET crossing the open addressing size limit} {
+        $r del bigset bigzset
+        for {set j 0} {$j < 70000} {incr j} {
+            $r sadd bigset $j
+            if {$j < 1000} {$r zadd bigzset $j $j}
+        }
+        for {set j 0} {$j < 70000} {incr j 2} {
+            $r srem bigset $j
+        }
+        $r zremrangebyscore bigzset 0 499
+        $r debug reload
+        list [$r scard bigset] [$r sismember bigset 69999] \
+            [$r sismember bigset 69998] [$r zcard bigzset] \
+            [$r zscore bigzset 999]
+    } {35000 1 0 500 999}
+
+    test {SSCAN returns every member across the open addressing size limit} {
+        $r del bigset
+        for {set j 0} {$j < 95000} {incr j} {$r sadd bigset m$j}
+        set members {}
+        set res [$r sscan bigset 0 count 1000]
+        set cur [lindex $res 0]
+        eval lappend members [lindex $res 1]
+        # With open-addressing-sets the set is converted to a chained
+        # table in the middle of the scan, when its table must grow
+        for {set j 0} {$j < 5000} {incr j} {$r sadd bigset n$j}
+        while {$cur != 0} {
+            set res [$r sscan bigset $cur count 1000]
+            set cur [lindex $res 0]
+            eval lappend members [lindex $res 1]
+        }
+        set missing 0
+        array set seen {}
+        foreach m $members {set seen($m) 1}
+        for {set j 0} {$j < 95000} {incr j} {
+            if {![info exists seen(m$j)]} {incr missing}
+        }
+        $r del bigset
+        set missing
+    } {0}
+
     test {ZSETs stress tester - sorting is working well?} {
         set delta 0
         for {set test 0} {$test < 2} {incr test} {
@@ -1559,6 +2078,30 @@ proc main {server port} {
         list $e1 $e2
     } {1 1}
 
+    test {Keys and expires of more DBs after a reload} {
+        $r flushdb
+        $r select 10
+        $r flushdb
+        for {set j 0} {$j < 1000} {incr j} {
+            $r set key:$j $j
+            if {$j % 2} {$r expire key:$j 1000}
+        }
+        $r sadd myset a
+        $r select 9
+        for {set j 0} {$j < 300} {incr j} {
+            $r sadd myset $j
+            $r zadd myzset $j $j
+        }
+        $r debug reload
+        set res [list [$r dbsize] [$r scard myset] [$r zcard myzset]]
+        $r select 10
+        lappend res [$r dbsize] [$r get key:999] [$r ttl key:0] \
+            [expr {[$r ttl key:999] > 900}] [$r smembers myset]
+        $r flushdb
+        $r select 9
+        set res
+    } {2 300 300 1001 999 -1 1 a}
+
     test {PIPELINING stresser (also a regression for the old epoll bug)} {
         set fd2 [socket 127.0.0.1 6379]
         fconfigure $fd2 -encoding binary -translation binary
@@ -0,0 +1,452 @@
+/* Packed list of strings and integers, used as a memory efficient encoding
+ * for small Redis Lists.
+ *
+ * The entries are stored back to back in a single allocation, every entry
+ * taking just the bytes of its value plus two or three bytes of overhead.
+ * Strings representing integers are stored as integers of the smallest
+ * possible size. The list can be iterated in both directions.
+ *
+ * Pushing and popping at the head, inserting and deleting are O(N) because
+ * of the memmove() and realloc(), and accessing an element by index is O(N)
+ * as the entries have variable length, so this is only used for small
+ * lists (see list-max-ziplist-entries in redis.conf).
+ *
+ * Copyright (c) 2010, Salvatore Sanfilippo <antirez at gmail dot com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *   * Redistributions of source code must retain the above copyright notice,
+ *     this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of Redis nor the names of its contributors may be used
+ *     to endorse or promote products derived from this software without
+ *     specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+
+#include "ziplist.h"
+#include "zmalloc.h"
+
+/* Layout of the ziplist:
+ *
+ * <total bytes:uint32> <entries count:uint32> <entry> ... <entry> <0xFF>
+ *
+ * Every entry is an encoding byte, the payload, and the length of the
+ * encoding byte plus payload ("backlen"), so that the list can be walked
+ * from the tail as well. The backlen is stored in 7 bit groups and is read
+ * starting from its last byte: the last byte holds the 7 less significant
+ * bits, and the high bit of every byte is set if a more significant group
+ * precedes it. Since it only depends on the size of its own entry, adding
+ * or removing an entry never requires to update the next ones. */
+#define ZIP_HEADER_SIZE (sizeof(uint32_t)*2)
+#define ZIP_END 0xFF
+
+#define ZIPLIST_BYTES(zl) (*((uint32_t*)(zl)))
+#define ZIPLIST_LENGTH(zl) (*((uint32_t*)((zl)+sizeof(uint32_t))))
+#define ZIPLIST_ENTRY_HEAD(zl) ((zl)+ZIP_HEADER_SIZE)
+#define ZIPLIST_ENTRY_END(zl) ((zl)+ZIPLIST_BYTES(zl)-1)
+
+/* Encoding byte. Small integers and short strings only take one byte of
+ * overhead, strings that are canonical base 10 integers are always stored
+ * as integers. */
+#define ZIP_UINT7_MASK 0x80     /* 0xxxxxxx: integer 0..127 */
+#define ZIP_UINT7 0x00
+#define ZIP_STR6_MASK 0xC0      /* 10xxxxxx: string up to 63 bytes */
+#define ZIP_STR6 0x80
+#define ZIP_INT13_MASK 0xE0     /* 110xxxxx + 1 byte: integer -4096..4095 */
+#define ZIP_INT13 0xC0
+#define ZIP_STR12_MASK 0xF0     /* 1110xxxx + 1 byte: string up to 4095 bytes */
+#define ZIP_STR12 0xE0
+#define ZIP_STR32 0xF0          /* + 4 bytes length: any other string */
+#define ZIP_INT16 0xF1          /* + 2 bytes integer */
+#define ZIP_INT24 0xF2          /* + 3 bytes integer */
+#define ZIP_INT32 0xF3          /* + 4 bytes integer */
+#define ZIP_INT64 0xF4          /* + 8 bytes integer */
+
+typedef struct zlentry {
+    unsigned int headersize;    /* Encoding byte and string length */
+    unsigned int len;           /* String length or integer bytes */
+    unsigned int backlensize;   /* Bytes used by the backlen */
+    unsigned char *sval;        /* String, NULL for integers */
+    long long lval;             /* Integer value */
+} zlentry;
+
+/* Check if the string 's' is the canonical base 10 representation of a
+ * 64 bit signed integer (no spaces, no '+' sign, no leading zeroes), the
+ * only case where it can be stored as an integer and converted back to the
+ * very same string. */
+static int zipTryEncoding(unsigned char *s, unsigned int slen, long long *v) {
+    unsigned long long value = 0, limit;
+    unsigned int j = 0;
+    int negative = 0;
+
+    if (slen == 0 || slen > 20) return 0;
+    if (s[0] == '-') {
+        negative = 1;
+        if (++j == slen) return 0;
+    }
+    if (s[j] == '0') {
+        if (slen != 1) return 0;
+        *v = 0;
+        return 1;
+    }
+    limit = negative ? (unsigned long long)LLONG_MAX+1 : LLONG_MAX;
+    for (; j < slen; j++) {
+        if (s[j] < '0' || s[j] > '9') return 0;
+        if (value > (limit-(s[j]-'0'))/10) return 0;
+        value = value*10+(s[j]-'0');
+    }
+    *v = negative ? (long long)(0-value) : (long long)value;
+    return 1;
+}
+
+/* Bytes needed to store the encoding byte and payload of an integer */
+static unsigned int zipIntSize(long long v) {
+    if (v >= 0 && v <= 127) return 1;
+    if (v >= -4096 && v <= 4095) return 2;
+    if (v >= INT16_MIN && v <= INT16_MAX) return 3;
+    if (v >= -8388608 && v <= 8388607) return 4;
+    if (v >= INT32_MIN && v <= INT32_MAX) return 5;
+    return 9;
+}
+
+/* Bytes needed to store the encoding byte and payload of a string */
+static unsigned int zipStrSize(unsigned int slen) {
+    if (slen < 64) return 1+slen;
+    if (slen < 4096) return 2+slen;
+    return 5+slen;
+}
+
+static unsigned int zipBacklenSize(unsigned int l) {
+    if (l < 128) return 1;
+    if (l < 16384) return 2;
+    if (l < 2097152) return 3;
+    if (l < 268435456) return 4;
+    return 5;
+}
+
+static void zipStoreBacklen(unsigned char *p, unsigned int l) {
+    unsigned int n = zipBacklenSize(l), j;
+
+    for (j = 0; j < n; j++) {
+        p[n-1-j] = (l & 127) | (j < n-1 ? 128 : 0);
+        l >>= 7;
+    }
+}
+
+/* Read the backlen ending at 'p' (the last byte of the previous entry) */
+static unsigned int zipReadBacklen(unsigned char *p) {
+    unsigned int l = 0, shift = 0;
+
+    while (1) {
+        l |= (unsigned int)(p[0] & 127) << shift;
+        if (!(p[0] & 128)) break;
+        shift += 7;
+        p--;
+    }
+    return l;
+}
+
+static void zipStoreInt(unsigned char *p, long long v, unsigned int bytes) {
+    unsigned long long u = v;
+    unsigned int j;
+
+    for (j = 0; j < bytes; j++) {
+        p[j] = u & 255;
+        u >>= 8;
+    }
+}
+
+static long long zipReadInt(unsigned char *p, unsigned int bytes) {
+    unsigned long long u = 0;
+    unsigned int j;
+
+    for (j = 0; j < bytes; j++)
+        u |= (unsigned long long)p[j] << (8*j);
+    if (bytes < 8 && (u >> (8*bytes-1)) & 1)
+        u |= ~0ULL << (8*bytes);
+    return (long long)u;
+}
+
+/* Write the encoding byte and payload of an entry at 'p', followed by its
+ * backlen. Returns the number of bytes written. */
+static unsigned int zipStoreEntry(unsigned char *p, unsigned char *s,
+                                  unsigned int slen, int isint, long long v)
+{
+    unsigned int l;
+
+    if (isint) {
+        l = zipIntSize(v);
+        switch(l) {
+        case 1: p[0] = v; break;
+        case 2: p[0] = ZIP_INT13 | ((v >> 8) & 0x1F); p[1] = v & 255; break;
+        case 3: p[0] = ZIP_INT16; zipStoreInt(p+1,v,2); break;
+        case 4: p[0] = ZIP_INT24; zipStoreInt(p+1,v,3); break;
+        case 5: p[0] = ZIP_INT32; zipStoreInt(p+1,v,4); break;
+        default: p[0] = ZIP_INT64; zipStoreInt(p+1,v,8); break;
+        }
+    } else {
+        l = zipStrSize(slen);
+        if (slen < 64) {
+            p[0] = ZIP_STR6 | slen;
+        } else if (slen < 4096) {
+            p[0] = ZIP_STR12 | (slen >> 8);
+            p[1] = slen & 255;
+        } else {
+            p[0] = ZIP_STR32;
+            zipStoreInt(p+1,slen,4);
+        }
+        memcpy(p+l-slen,s,slen);
+    }
+    zipStoreBacklen(p+l,l);
+    return l+zipBacklenSize(l);
+}
+
+/* Decode the entry at 'p' */
+static void zipDecode(unsigned char *p, zlentry *e) {
+    unsigned char enc = p[0];
+
+    e->sval = NULL;
+    e->lval = 0;
+    if ((enc & ZIP_UINT7_MASK) == ZIP_UINT7) {
+        e->headersize = 1;
+        e->len = 0;
+        e->lval = enc;
+    } else if ((enc & ZIP_STR6_MASK) == ZIP_STR6) {
+        e->headersize = 1;
+        e->len = enc & 0x3F;
+    } else if ((enc & ZIP_INT13_MASK) == ZIP_INT13) {
+        e->headersize = 1;
+        e->len = 1;
+        e->lval = ((enc & 0x1F) << 8) | p[1];
+        if (e->lval >= 4096) e->lval -= 8192;
+    } else if ((enc & ZIP_STR12_MASK) == ZIP_STR12) {
+        e->headersize = 2;
+        e->len = ((enc & 0x0F) << 8) | p[1];
+    } else if (enc == ZIP_STR32) {
+        e->headersize = 5;
+        e->len = (unsigned int)zipReadInt(p+1,4);
+    } else {
+        e->headersize = 1;
+        switch(enc) {
+        case ZIP_INT16: e->len = 2; break;
+        case ZIP_INT24: e->len = 3; break;
+        case ZIP_INT32: e->len = 4; break;
+        default: e->len = 8; break;
+        }
+        e->lval = zipReadInt(p+1,e->len);
+    }
+    if ((enc & ZIP_STR6_MASK) == ZIP_STR6 ||
+        (enc & ZIP_STR12_MASK) == ZIP_STR12 || enc == ZIP_STR32)
+        e->sval = p+e->headersize;
+    e->backlensize = zipBacklenSize(e->headersize+e->len);
+}
+
+/* Total bytes used by the entry at 'p' */
+static unsigned int zipRawEntryLength(unsigned char *p) {
+    zlentry e;
+
+    zipDecode(p,&e);
+    return e.headersize+e.len+e.backlensize;
+}
+
+/* Create a new empty ziplist */
+unsigned char *ziplistNew(void) {
+    unsigned int bytes = ZIP_HEADER_SIZE+1;
+    unsigned char *zl = zmalloc(bytes);
+
+    ZIPLIST_BYTES(zl) = bytes;
+    ZIPLIST_LENGTH(zl) = 0;
+    zl[bytes-1] = ZIP_END;
+    return zl;
+}
+
+/* Insert the string 's' before the entry at 'p' (or at the end of the
+ * list if 'p' points to the terminator) */
+static unsigned char *__ziplistInsert(unsigned char *zl, unsigned char *p,
+                                      unsigned char *s, unsigned int slen)
+{
+    size_t curlen = ZIPLIST_BYTES(zl), offset = p-zl;
+    unsigned int reqlen;
+    long long value = 0;
+    int isint;
+
+    isint = zipTryEncoding(s,slen,&value);
+    reqlen = isint ? zipIntSize(value) : zipStrSize(slen);
+    reqlen += zipBacklenSize(reqlen);
+
+    zl = zrealloc(zl,curlen+reqlen);
+    p = zl+offset;
+    memmove(p+reqlen,p,curlen-offset);
+    zipStoreEntry(p,s,slen,isint,value);
+    ZIPLIST_BYTES(zl) = curlen+reqlen;
+    ZIPLIST_LENGTH(zl)++;
+    return zl;
+}
+
+/* Delete up to 'num' entries starting at 'p' */
+static unsigned char *__ziplistDelete(unsigned char *zl, unsigned char *p,
+                                      unsigned int num)
+{
+    unsigned char *first = p;
+    unsigned int deleted = 0;
+    size_t curlen = ZIPLIST_BYTES(zl);
+
+    while (deleted < num && p[0] != ZIP_END) {
+        p += zipRawEntryLength(p);
+        deleted++;
+    }
+    if (deleted == 0) return zl;
+    memmove(first,p,(zl+curlen)-p);
+    ZIPLIST_BYTES(zl) = curlen-(p-first);
+    ZIPLIST_LENGTH(zl) -= deleted;
+    return zrealloc(zl,ZIPLIST_BYTES(zl));
+}
+
+unsigned char *ziplistPush(unsigned char *zl, unsigned char *s, unsigned int slen, int where) {
+    unsigned char *p;
+
+    p = (where == ZIPLIST_HEAD) ? ZIPLIST_ENTRY_HEAD(zl) : ZIPLIST_ENTRY_END(zl);
+    return __ziplistInsert(zl,p,s,slen);
+}
+
+/* Return the entry at 'index', negative indexes start from the tail (-1 is
+ * the last element). NULL is returned when the index is out of range. */
+unsigned char *ziplistIndex(unsigned char *zl, long index) {
+    unsigned char *p;
+
+    if (index < 0) {
+        index = (-index)-1;
+        p = ziplistPrev(zl,ZIPLIST_ENTRY_END(zl));
+        while (p != NULL && index--)
+            p = ziplistPrev(zl,p);
+    } else {
+        p = ZIPLIST_ENTRY_HEAD(zl);
+        while (p[0] != ZIP_END && index--)
+            p += zipRawEntryLength(p);
+        if (p[0] == ZIP_END) p = NULL;
+    }
+    return p;
+}
+
+/* Return the entry after 'p', or NULL if 'p' is the last one */
+unsigned char *ziplistNext(unsigned char *zl, unsigned char *p) {
+    ((void) zl);
+
+    if (p[0] == ZIP_END) return NULL;
+    p += zipRawEntryLength(p);
+    return (p[0] == ZIP_END) ? NULL : p;
+}
+
+/* Return the entry before 'p', or NULL if 'p' is the first one. When 'p'
+ * points to the terminator the last entry is returned. */
+unsigned char *ziplistPrev(unsigned char *zl, unsigned char *p) {
+    unsigned int l;
+
+    if (p == ZIPLIST_ENTRY_HEAD(zl)) return NULL;
+    l = zipReadBacklen(p-1);
+    return p-zipBacklenSize(l)-l;
+}
+
+/* Get the value of the entry at 'p'. Strings are returned setting '*sval'
+ * and '*slen', for integers '*sval' is set to NULL and the value stored in
+ * '*lval'. Returns 0 if 'p' is not a valid entry. */
+int ziplistGet(unsigned char *p, unsigned char **sval, unsigned int *slen, long long *lval) {
+    zlentry e;
+
+    if (p == NULL || p[0] == ZIP_END) return 0;
+    zipDecode(p,&e);
+    *sval = e.sval;
+    if (e.sval) {
+        *slen = e.len;
+    } else {
+        *lval = e.lval;
+    }
+    return 1;
+}
+
+/* Insert an entry before 'p' */
+unsigned char *ziplistInsert(unsigned char *zl, unsigned char *p, unsigned char *s, unsigned int slen) {
+    return __ziplistInsert(zl,p,s,slen);
+}
+
+/* Replace the value of the entry at 'p'. Since the list may be reallocated
+ * the entry has to be looked up again using its offset or index. */
+unsigned char *ziplistReplace(unsigned char *zl, unsigned char *p, unsigned char *s, unsigned int slen) {
+    size_t offset = p-zl;
+
+    zl = __ziplistDelete(zl,p,1);
+    return __ziplistInsert(zl,zl+offset,s,slen);
+}
+
+/* Delete the entry at '*p', that is updated to point to the entry that was
+ * following it (or to the terminator), so that the list can be iterated
+ * while deleting. */
+unsigned char *ziplistDelete(unsigned char *zl, unsigned char **p) {
+    size_t offset = *p-zl;
+
+    zl = __ziplistDelete(zl,*p,1);
+    *p = zl+offset;
+    return zl;
+}
+
+/* Delete 'num' entries starting at 'index' */
+unsigned char *ziplistDeleteRange(unsigned char *zl, unsigned int index, unsigned int num) {
+    unsigned char *p = ziplistIndex(zl,index);
+
+    return (p == NULL) ? zl : __ziplistDelete(zl,p,num);
+}
+
+/* Append the entries of 'second' to 'first', that is returned. 'second'
+ * is left untouched. */
+unsigned char *ziplistMerge(unsigned char *first, unsigned char *second) {
+    size_t firstbytes = ZIPLIST_BYTES(first);
+    size_t secondlen = ZIPLIST_BYTES(second)-ZIP_HEADER_SIZE-1;
+
+    first = zrealloc(first,firstbytes+secondlen);
+    memcpy(first+firstbytes-1,ZIPLIST_ENTRY_HEAD(second),secondlen);
+    first[firstbytes+secondlen-1] = ZIP_END;
+    ZIPLIST_BYTES(first) = firstbytes+secondlen;
+    ZIPLIST_LENGTH(first) += ZIPLIST_LENGTH(second);
+    return first;
+}
+
+/* Return 1 if the entry at 'p' is equal to the string 's' */
+int ziplistCompare(unsigned char *p, unsigned char *s, unsigned int slen) {
+    zlentry e;
+    long long value;
+
+    if (p[0] == ZIP_END) return 0;
+    zipDecode(p,&e);
+    if (e.sval)
+        return e.len == slen && memcmp(e.sval,s,slen) == 0;
+    return zipTryEncoding(s,slen,&value) && value == e.lval;
+}
+
+unsigned int ziplistLen(unsigned char *zl) {
+    return ZIPLIST_LENGTH(zl);
+}
+
+size_t ziplistBlobLen(unsigned char *zl) {
+    return ZIPLIST_BYTES(zl);
+}
@@ -32,14 +32,43 @@
 #include <stdlib.h>
 #include <string.h>
 #include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
 #include "config.h"
+#include "zmalloc.h"
+#ifdef USE_ARENA
+#include "arena.h"
+#endif
 
-#if defined(__sun)
+/* When the allocator can tell the size of a block there is no need to store
+ * it in a header before the block */
+#ifdef HAVE_MALLOC_SIZE
+#define PREFIX_SIZE (0)
+#elif defined(__sun)
 #define PREFIX_SIZE sizeof(long long)
 #else
 #define PREFIX_SIZE sizeof(size_t)
 #endif
 
+/* With threads the counter is updated with atomic operations when
+ * available, so that allocating never takes a lock. */
+#ifdef HAVE_ATOMIC
+#define increment_used_memory(_n) do { \
+    if (zmalloc_thread_safe) { \
+        __sync_add_and_fetch(&used_memory, (_n)); \
+    } else { \
+        used_memory += _n; \
+    } \
+} while(0)
+
+#define decrement_used_memory(_n) do { \
+    if (zmalloc_thread_safe) { \
+        __sync_sub_and_fetch(&used_memory, (_n)); \
+    } else { \
+        used_memory -= _n; \
+    } \
+} while(0)
+#else
 #define increment_used_memory(_n) do { \
     if (zmalloc_thread_safe) { \
         pthread_mutex_lock(&used_memory_mutex);  \
@@ -59,8 +88,9 @@
         used_memory -= _n; \
     } \
 } while(0)
+#endif
 
-static size_t used_memory = 0;
+static volatile size_t used_memory = 0;
 static int zmalloc_thread_safe = 0;
 pthread_mutex_t used_memory_mutex = PTHREAD_MUTEX_INITIALIZER;
 
@@ -72,8 +102,42 @@ static void zmalloc_oom(size_t size) {
 }
 
 void *zmalloc(size_t size) {
-    void *ptr = malloc(size+PREFIX_SIZE);
+    void *ptr;
 
+#ifdef USE_ARENA
+    /* Small blocks come from the size class arena, that has no header */
+    if (size <= ARENA_MAX_SIZE) {
+        if ((ptr = arenaAlloc(size)) == NULL) zmalloc_oom(size);
+        increment_used_memory(arenaBlockSize(ptr));
+        return ptr;
+    }
+#endif
+    ptr = malloc(size+PREFIX_SIZE);
+    if (!ptr) zmalloc_oom(size);
+#ifdef HAVE_MALLOC_SIZE
+    increment_used_memory(redis_malloc_size(ptr));
+    return ptr;
+#else
+    *((size_t*)ptr) = size;
+    increment_used_memory(size+PREFIX_SIZE);
+    return (char*)ptr+PREFIX_SIZE;
+#endif
+}
+
+/* Like zmalloc() but the memory is zeroed. Big allocations are served by
+ * calloc() with fresh pages from the kernel, without touching them. */
+void *zcalloc(size_t size) {
+    void *ptr;
+
+#ifdef USE_ARENA
+    if (size <= ARENA_MAX_SIZE) {
+        if ((ptr = arenaAlloc(size)) == NULL) zmalloc_oom(size);
+        memset(ptr,0,size);
+        increment_used_memory(arenaBlockSize(ptr));
+        return ptr;
+    }
+#endif
+    ptr = calloc(1, size+PREFIX_SIZE);
     if (!ptr) zmalloc_oom(size);
 #ifdef HAVE_MALLOC_SIZE
     increment_used_memory(redis_malloc_size(ptr));
@@ -93,6 +157,20 @@ void *zrealloc(void *ptr, size_t size) {
     void *newptr;
 
     if (ptr == NULL) return zmalloc(size);
+#ifdef USE_ARENA
+    /* Moving between the arena and malloc() (or between two size classes)
+     * is a copy. Big blocks stay in malloc(): shrinking them under the
+     * arena limit is a plain realloc(). */
+    if (arenaOwns(ptr)) {
+        oldsize = arenaBlockSize(ptr);
+        if (size <= ARENA_MAX_SIZE && arenaClassSize(size) == oldsize)
+            return ptr;
+        newptr = zmalloc(size);
+        memcpy(newptr,ptr,oldsize < size ? oldsize : size);
+        zfree(ptr);
+        return newptr;
+    }
+#endif
 #ifdef HAVE_MALLOC_SIZE
     oldsize = redis_malloc_size(ptr);
     newptr = realloc(ptr,size);
@@ -121,6 +199,13 @@ void zfree(void *ptr) {
 #endif
 
     if (ptr == NULL) return;
+#ifdef USE_ARENA
+    if (arenaOwns(ptr)) {
+        decrement_used_memory(arenaBlockSize(ptr));
+        arenaFree(ptr);
+        return;
+    }
+#endif
 #ifdef HAVE_MALLOC_SIZE
     decrement_used_memory(redis_malloc_size(ptr));
     free(ptr);
@@ -143,12 +228,67 @@ char *zstrdup(const char *s) {
 size_t zmalloc_used_memory(void) {
     size_t um;
 
+#ifdef HAVE_ATOMIC
+    /* A word sized read is atomic, the counter is volatile */
+    um = used_memory;
+#else
     if (zmalloc_thread_safe) pthread_mutex_lock(&used_memory_mutex);
     um = used_memory;
     if (zmalloc_thread_safe) pthread_mutex_unlock(&used_memory_mutex);
+#endif
     return um;
 }
 
 void zmalloc_enable_thread_safeness(void) {
     zmalloc_thread_safe = 1;
+#ifdef USE_ARENA
+    arenaEnableThreadSafeness();
+#endif
+}
+
+/* Return the resident set size of the process in bytes, read from /proc on
+ * Linux. Elsewhere the used memory is returned, so the fragmentation ratio
+ * is always 1. */
+#if defined(__linux__)
+size_t zmalloc_get_rss(void) {
+    int page = sysconf(_SC_PAGESIZE);
+    size_t rss;
+    char buf[4096];
+    char *p, *x;
+    int fd, count;
+
+    if ((fd = open("/proc/self/stat",O_RDONLY)) == -1) return 0;
+    if ((count = read(fd,buf,sizeof(buf)-1)) <= 0) {
+        close(fd);
+        return 0;
+    }
+    close(fd);
+    buf[count] = '\0';
+
+    /* RSS is the 24th field. Skip the command name first, that is the only
+     * field that may contain spaces: 'p' is then the space before the 3rd
+     * field, and 21 more spaces are skipped. */
+    if ((p = strrchr(buf,')')) == NULL) return 0;
+    p++;
+    count = 21;
+    while (p && count--) {
+        p = strchr(p+1,' ');
+    }
+    if (!p) return 0;
+    x = strchr(p+1,' ');
+    if (x) *x = '\0';
+    rss = strtoll(p+1,NULL,10);
+    return rss*page;
+}
+#else
+size_t zmalloc_get_rss(void) {
+    return zmalloc_used_memory();
+}
+#endif
+
+/* Fragmentation ratio: resident memory over the memory used by Redis */
+float zmalloc_get_fragmentation_ratio(void) {
+    size_t um = zmalloc_used_memory();
+
+    return um ? (float)zmalloc_get_rss()/um : 0;
 }
@@ -32,10 +32,13 @@
 #define _ZMALLOC_H
 
 void *zmalloc(size_t size);
+void *zcalloc(size_t size);
 void *zrealloc(void *ptr, size_t size);
 void zfree(void *ptr);
 char *zstrdup(const char *s);
 size_t zmalloc_used_memory(void);
 void zmalloc_enable_thread_safeness(void);
+size_t zmalloc_get_rss(void);
+float zmalloc_get_fragmentation_ratio(void);
 
 #endif /* _ZMALLOC_H */